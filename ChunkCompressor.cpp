@@ -0,0 +1,321 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Parallel compression of HDF5 chunks with direct chunk write
+ *
+ */
+
+#include "ChunkCompressor.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <zlib.h>
+#ifdef JADAQ_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef JADAQ_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if !H5_VERSION_GE(1,10,3)
+#include <H5DOpublic.h>
+#define H5Dwrite_chunk H5DOwrite_chunk
+#endif
+
+/* Registered HDF5 filter IDs - see https://support.hdfgroup.org/services/filters.html */
+#define H5Z_FILTER_LZ4  32004
+#define H5Z_FILTER_ZSTD 32015
+
+ChunkCompressor::Filter ChunkCompressor::filter(const std::string& name)
+{
+    if (name == "none")
+        return None;
+    if (name == "deflate" || name == "gzip")
+        return Deflate;
+    if (name == "lz4")
+        return LZ4;
+    if (name == "zstd")
+        return Zstd;
+    throw std::invalid_argument("Unknown compression: " + name);
+}
+
+std::string ChunkCompressor::name(Filter filter)
+{
+    switch (filter)
+    {
+        case None: return "none";
+        case Deflate: return "deflate";
+        case LZ4: return "lz4";
+        case Zstd: return "zstd";
+    }
+    return "unknown";
+}
+
+bool ChunkCompressor::available(Filter filter)
+{
+    switch (filter)
+    {
+        case None:
+            return true;
+        case Deflate:
+            return H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0;
+#ifdef JADAQ_HAVE_LZ4
+        case LZ4:
+            return H5Zfilter_avail(H5Z_FILTER_LZ4) > 0;
+#endif
+#ifdef JADAQ_HAVE_ZSTD
+        case Zstd:
+            return H5Zfilter_avail(H5Z_FILTER_ZSTD) > 0;
+#endif
+        default:
+            return false;
+    }
+}
+
+void ChunkCompressor::setFilter(H5::DSetCreatPropList& properties, Filter filter, int level, bool shuffle)
+{
+    if (shuffle && filter != None)
+    {
+        properties.setShuffle();
+    }
+    switch (filter)
+    {
+        case None:
+            break;
+        case Deflate:
+            properties.setDeflate(level);
+            break;
+        case LZ4:
+        {
+            const unsigned int blockSize = 0; // Default - whole chunk in one block
+            properties.setFilter(H5Z_FILTER_LZ4, H5Z_FLAG_MANDATORY, 1, &blockSize);
+            break;
+        }
+        case Zstd:
+        {
+            const unsigned int zstdLevel = level;
+            properties.setFilter(H5Z_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, &zstdLevel);
+            break;
+        }
+    }
+}
+
+void ChunkCompressor::shuffle(const std::vector<char>& src, size_t elementSize, std::vector<char>& dst)
+{
+    const size_t n = src.size()/elementSize;
+    dst.resize(src.size());
+    for (size_t b = 0; b < elementSize; ++b)
+    {
+        char* out = dst.data() + b*n;
+        const char* in = src.data() + b;
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = in[i*elementSize];
+        }
+    }
+    /* Bytes left over from a partial element go last as they are */
+    std::copy(src.begin() + n*elementSize, src.end(), dst.begin() + n*elementSize);
+}
+
+#ifdef JADAQ_HAVE_LZ4
+static void putBigEndian(char* dst, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        dst[i] = (char)(value >> (8*(bytes-1-i)));
+    }
+}
+#endif
+
+bool ChunkCompressor::compress(Filter filter, int level, const std::vector<char>& src, std::vector<char>& dst)
+{
+    switch (filter)
+    {
+        case Deflate:
+        {
+            /* Same as the HDF5 deflate filter: a zlib stream */
+            uLongf size = compressBound(src.size());
+            dst.resize(size);
+            if (compress2((Bytef*)dst.data(), &size, (const Bytef*)src.data(), src.size(), level) != Z_OK)
+                return false;
+            dst.resize(size);
+            break;
+        }
+#ifdef JADAQ_HAVE_LZ4
+        case LZ4:
+        {
+            /* Same as the HDF5 LZ4 filter with the whole chunk in a single block: big endian original size (8 bytes)
+             * and block size (4 bytes) followed by the compressed size (4 bytes) and data of the block */
+            const size_t header = 8 + 4 + 4;
+            dst.resize(header + LZ4_compressBound((int)src.size()));
+            int size = LZ4_compress_default(src.data(), dst.data() + header, (int)src.size(), (int)(dst.size() - header));
+            if (size <= 0 || (size_t)size >= src.size())
+                return false;
+            putBigEndian(dst.data(), src.size(), 8);
+            putBigEndian(dst.data() + 8, src.size(), 4);
+            putBigEndian(dst.data() + 12, (uint64_t)size, 4);
+            dst.resize(header + size);
+            break;
+        }
+#endif
+#ifdef JADAQ_HAVE_ZSTD
+        case Zstd:
+        {
+            /* Same as the HDF5 Zstandard filter: a single zstd frame */
+            dst.resize(ZSTD_compressBound(src.size()));
+            size_t size = ZSTD_compress(dst.data(), dst.size(), src.data(), src.size(), level);
+            if (ZSTD_isError(size))
+                return false;
+            dst.resize(size);
+            break;
+        }
+#endif
+        default:
+            return false;
+    }
+    return dst.size() < src.size();
+}
+
+ChunkCompressor::ChunkCompressor(const Settings& settings_, std::mutex& hdf5Mutex_)
+        : settings(settings_)
+        , hdf5Mutex(hdf5Mutex_)
+{
+    size_t n = settings.threads;
+    if (n == 0)
+    {
+        n = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    maxQueued = 2*n + 2;
+    for (size_t i = 0; i < n; ++i)
+    {
+        threads.emplace_back(&ChunkCompressor::compressor, this);
+    }
+    threads.emplace_back(&ChunkCompressor::writer, this);
+}
+
+ChunkCompressor::~ChunkCompressor()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    work.notify_all();
+    progress.notify_all();
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+}
+
+void ChunkCompressor::submit(hid_t dataset, hsize_t offset, hsize_t extent, std::vector<char>&& data, size_t shuffle)
+{
+    std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+    chunk->dataset = dataset;
+    chunk->offset = offset;
+    chunk->extent = extent;
+    chunk->shuffle = shuffle;
+    chunk->data = std::move(data);
+    chunk->filterMask = 0;
+    chunk->done = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    progress.wait(lock, [this]() { return queue.size() < maxQueued; });
+    queue.push_back(chunk);
+    todo.push_back(chunk);
+    work.notify_one();
+}
+
+void ChunkCompressor::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    progress.wait(lock, [this]() { return queue.empty() && !writing; });
+}
+
+void ChunkCompressor::compressor()
+{
+    while (true)
+    {
+        std::shared_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work.wait(lock, [this]() { return stop || !todo.empty(); });
+            if (todo.empty())
+                return;
+            chunk = todo.front();
+            todo.pop_front();
+        }
+        bool compressed;
+        if (chunk->shuffle > 1)
+        {
+            std::vector<char> shuffled;
+            shuffle(chunk->data, chunk->shuffle, shuffled);
+            compressed = compress(settings.filter, settings.level, shuffled, chunk->compressed);
+        } else
+        {
+            compressed = compress(settings.filter, settings.level, chunk->data, chunk->compressed);
+        }
+        if (!compressed)
+        {
+            /* Store it as it is and tell HDF5 the filters were skipped */
+            chunk->compressed.swap(chunk->data);
+            chunk->filterMask = chunk->shuffle ? 0x3 : 0x1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk->done = true;
+        }
+        progress.notify_all();
+    }
+}
+
+void ChunkCompressor::writer()
+{
+    while (true)
+    {
+        std::shared_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            progress.wait(lock, [this]() { return (stop && queue.empty()) || (!queue.empty() && queue.front()->done); });
+            if (queue.empty())
+                return;
+            chunk = queue.front();
+            queue.pop_front();
+            writing = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(hdf5Mutex);
+            /* Never shrink the data set - a chunk may be written again after a partial one was published */
+            hsize_t size = 0;
+            hid_t space = H5Dget_space(chunk->dataset);
+            H5Sget_simple_extent_dims(space, &size, nullptr);
+            H5Sclose(space);
+            if ((chunk->extent > size && H5Dset_extent(chunk->dataset, &chunk->extent) < 0) ||
+                H5Dwrite_chunk(chunk->dataset, H5P_DEFAULT, chunk->filterMask, &chunk->offset,
+                               chunk->compressed.size(), chunk->compressed.data()) < 0)
+            {
+                std::cerr << "ERROR: could not write compressed HDF5 chunk at " << chunk->offset << std::endl;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writing = false;
+        }
+        progress.notify_all();
+    }
+}
@@ -0,0 +1,106 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Compress HDF5 chunks in a pool of worker threads and write them with
+ * direct chunk write from a single writer thread, in the order they were
+ * submitted. The chunks are compressed exactly like the matching HDF5
+ * filter would, so files read back with the standard filters: deflate is
+ * built into HDF5, LZ4 (32004) and Zstandard (32015) need the filter plugin
+ * and are only offered when it is available and jadaq was built with the
+ * library.
+ *
+ */
+
+#ifndef JADAQ_CHUNKCOMPRESSOR_HPP
+#define JADAQ_CHUNKCOMPRESSOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <H5Cpp.h>
+
+class ChunkCompressor
+{
+public:
+    enum Filter
+    {
+        None,
+        Deflate,
+        LZ4,
+        Zstd
+    };
+    struct Settings
+    {
+        Filter filter = None;
+        int level = 1;       // Compression level for deflate and Zstandard
+        size_t threads = 0;  // Compression threads, 0 for one per core
+    };
+    static Filter filter(const std::string& name);
+    static std::string name(Filter filter);
+    static bool available(Filter filter);
+    /* Add filters to the data set creation properties, so readers know how to decompress */
+    static void setFilter(H5::DSetCreatPropList& properties, Filter filter, int level, bool shuffle = false);
+    /* Byte shuffle like the HDF5 shuffle filter */
+    static void shuffle(const std::vector<char>& src, size_t elementSize, std::vector<char>& dst);
+    /* Returns false if the data does not compress */
+    static bool compress(Filter filter, int level, const std::vector<char>& src, std::vector<char>& dst);
+
+    /* All HDF5 calls must hold hdf5Mutex as the library is not thread safe */
+    ChunkCompressor(const Settings& settings, std::mutex& hdf5Mutex);
+    ~ChunkCompressor();
+    /* Compress data and write it as the chunk starting at element offset, extending the data set to extent.
+     * Give the element size as shuffle if the data set has the shuffle filter in front of the compression */
+    void submit(hid_t dataset, hsize_t offset, hsize_t extent, std::vector<char>&& data, size_t shuffle = 0);
+    /* Wait until everything submitted is written */
+    void flush();
+
+private:
+    struct Chunk
+    {
+        hid_t dataset;
+        hsize_t offset;
+        hsize_t extent;
+        size_t shuffle;
+        std::vector<char> data;
+        std::vector<char> compressed;
+        uint32_t filterMask;
+        bool done;
+    };
+    const Settings settings;
+    std::mutex& hdf5Mutex;
+    size_t maxQueued;
+    std::mutex mutex;
+    std::condition_variable work;      // Chunks to compress or stop
+    std::condition_variable progress;  // A chunk was compressed or written
+    std::deque<std::shared_ptr<Chunk> > queue;  // In submission order until written
+    std::deque<std::shared_ptr<Chunk> > todo;   // Waiting for compression
+    bool writing = false;
+    bool stop = false;
+    std::vector<std::thread> threads;
+    void compressor();
+    void writer();
+};
+
+#endif //JADAQ_CHUNKCOMPRESSOR_HPP
@@ -29,9 +29,18 @@
 #include "StringConversion.hpp"
 #include <regex>
 #include <iostream>
+#include <iomanip>
 #include <cstdint>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <map>
+#include <set>
+#include <algorithm>
 
-Configuration::Configuration(std::ifstream& file, bool verbose)
+Configuration::Configuration(std::ifstream& file, bool verbose, bool parallel_, const std::string& shadowPath_)
+        : shadowPath(shadowPath_)
+        , parallel(parallel_)
 {
     setVerbose(verbose);
     pt::ini_parser::read_ini(file, in);
@@ -46,9 +55,9 @@ std::vector<Digitizer>& Configuration::getDigitizers()
 /*
  * Read configuration from digitizers and write it on stream
  */
-void Configuration::write(std::ofstream& file)
+void Configuration::write(std::ofstream& file, bool verify)
 {
-    pt::write_ini(file,readBack());
+    pt::write_ini(file,readBack(verify));
 }
 
 /*
@@ -67,12 +76,30 @@ std::string to_string(const Configuration::Range& range)
 }
 
 
-static pt::ptree rangeNode(Digitizer& digitizer, FunctionID id, int begin, int end, bool verbose)
+/* The value of a setting (index -1 for the whole board). Unless verify the value jadaq applied
+ * since the last reset is taken from the shadow instead of the digitizer */
+static std::string value(Digitizer& digitizer, FunctionID id, int index, bool verify)
+{
+    if (!verify)
+    {
+        const Digitizer::Shadow& shadow = digitizer.getShadow();
+        auto it = shadow.find(std::make_pair(id, index < 0 ? -1 : digitizer.registerIndex(id, index)));
+        if (it != shadow.end())
+        {
+            /* As written but without a trailing comment from the ini file */
+            std::string written = it->second.substr(0, it->second.find_first_of("#;"));
+            return written.erase(written.find_last_not_of(" \t") + 1);
+        }
+    }
+    return index < 0 ? digitizer.get(id) : digitizer.get(id, index);
+}
+
+static pt::ptree rangeNode(Digitizer& digitizer, FunctionID id, int begin, int end, bool verbose, bool verify)
 {
     pt::ptree ptree;
     std::string prev;
     try {
-        prev = digitizer.get(id,begin);
+        prev = value(digitizer,id,begin,verify);
     } catch (caen::Error& e)
     {
         if (verbose) {
@@ -83,7 +110,7 @@ static pt::ptree rangeNode(Digitizer& digitizer, FunctionID id, int begin, int e
     for (int i = begin+1; i < end; ++i)
     {
         try {
-            std::string cur(digitizer.get(id,i));
+            std::string cur(value(digitizer,id,i,verify));
             if (cur != prev)
             {
                 ptree.put(to_string(Configuration::Range(begin,i-1)), prev);
@@ -115,124 +142,396 @@ static pt::ptree rangeNode(Digitizer& digitizer, FunctionID id, int begin, int e
     return ptree;
 }
 
-pt::ptree Configuration::readBack()
+static pt::ptree readBack(Digitizer& digitizer, bool verbose, bool verify)
 {
-    pt::ptree out;
-    for (Digitizer& digitizer: digitizers)
-    {
-        pt::ptree dPtree;
-        switch (digitizer.linkType) {
-            case CAEN_DGTZ_USB:
-                dPtree.put("USB", digitizer.linkNum);
-                break;
-            case CAEN_DGTZ_OpticalLink:
-                dPtree.put("OPTICAL", digitizer.linkNum);
-                break;
-            default:
-            std::cerr << "ERROR: Unsupported Link Type: " << digitizer.linkType << std::endl;
-        }
-        dPtree.put("VME", hex_string(digitizer.VMEBaseAddress));
-        dPtree.put("CONET", digitizer.conetNode);
+    pt::ptree dPtree;
+    switch (digitizer.linkType) {
+        case CAEN_DGTZ_USB:
+            dPtree.put("USB", digitizer.linkNum);
+            break;
+        case CAEN_DGTZ_OpticalLink:
+            dPtree.put("OPTICAL", digitizer.linkNum);
+            break;
+        default:
+        std::cerr << "ERROR: Unsupported Link Type: " << digitizer.linkType << std::endl;
+    }
+    dPtree.put("VME", hex_string(digitizer.VMEBaseAddress));
+    dPtree.put("CONET", digitizer.conetNode);
 
-        for (FunctionID id = functionIDbegin(); id < functionIDend(); ++id)
+    /* Most settings are plain registers - read them all at once */
+    digitizer.prefetchRegisters();
+    for (FunctionID id = functionIDbegin(); id < functionIDend(); ++id)
+    {
+        if (!takeIndex(id))
         {
-            if (!takeIndex(id))
+            try {
+                dPtree.put(to_string(id), value(digitizer, id, -1, verify));
+            } catch (caen::Error& e)
             {
-                try {
-                    dPtree.put(to_string(id), digitizer.get(id));
-                } catch (caen::Error& e)
-                {
-                    //Function not supported so we just skip it
-                    if (getVerbose()) {
-                        std::cerr << "WARNING: " << digitizer.name() << " could not read configuration for " << to_string(id) << ": " << e.what() << std::endl;
-                    }
-                } catch (std::runtime_error& e)
-                {
-                    //Internal helper init probably failed so we just skip it
-                    if (getVerbose()) {
-                        std::cerr << "WARNING: " << digitizer.name() << " could not handle configuration for " << to_string(id) << ": " << e.what() << std::endl;
-                    }   
+                //Function not supported so we just skip it
+                if (verbose) {
+                    std::cerr << "WARNING: " << digitizer.name() << " could not read configuration for " << to_string(id) << ": " << e.what() << std::endl;
                 }
-            }
-            else
+            } catch (std::runtime_error& e)
             {
-                pt::ptree fPtree = rangeNode(digitizer,id,0,digitizer.channels(), getVerbose());
-                if (!fPtree.empty())
-                {
-                    dPtree.put_child(to_string(id), fPtree);
+                //Internal helper init probably failed so we just skip it
+                if (verbose) {
+                    std::cerr << "WARNING: " << digitizer.name() << " could not handle configuration for " << to_string(id) << ": " << e.what() << std::endl;
                 }
             }
         }
-        for (uint32_t reg: digitizer.getRegisters())
+        else
+        {
+            pt::ptree fPtree = rangeNode(digitizer,id,0,digitizer.channels(), verbose, verify);
+            if (!fPtree.empty())
+            {
+                dPtree.put_child(to_string(id), fPtree);
+            }
+        }
+    }
+    for (uint32_t reg: digitizer.getRegisters())
+    {
+        try {
+            dPtree.put(to_string(Register) + "[" + hex_string(reg) + "]", value(digitizer, Register, reg, verify));
+        } catch (caen::Error& e)
+        {
+            std::cerr << "WARNING: " << digitizer.name() << " could not read register " << hex_string(reg) << ": " << e.what() << std::endl;
+        }
+    }
+    digitizer.clearRegisterCache();
+    return dPtree;
+}
+
+pt::ptree Configuration::readBack(bool verify)
+{
+    /* Like apply the digitizers on one link are read one after the other and the links in parallel */
+    std::vector<pt::ptree> boards(digitizers.size());
+    std::map<std::pair<int, int>, std::vector<size_t> > links;
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        links[std::make_pair((int)digitizers[i].linkType, digitizers[i].linkNum)].push_back(i);
+    }
+    const bool verbose = getVerbose();
+    auto task = [this, verbose, verify, &boards](const std::vector<size_t>& link)
+    {
+        for (size_t i: link)
+        {
+            boards[i] = ::readBack(digitizers[i], verbose, verify);
+        }
+    };
+    if (parallel && links.size() > 1)
+    {
+        std::vector<std::thread> threads;
+        for (auto& link: links)
+        {
+            threads.emplace_back(task, std::cref(link.second));
+        }
+        for (std::thread& thread: threads)
         {
-            dPtree.put(to_string(Register) + "[" + hex_string(reg) + "]", digitizer.get(Register,reg));
+            thread.join();
         }
-        out.put_child(digitizer.name(),dPtree);
+    } else
+    {
+        for (auto& link: links)
+        {
+            task(link.second);
+        }
+    }
+
+    pt::ptree out;
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        out.put_child(digitizers[i].name(), boards[i]);
     }
     return out;
 }
 
-static void configure(Digitizer& digitizer, pt::ptree& conf, bool verbose)
+/* Adds the time from construction to destruction to a Timing */
+class Stopwatch
 {
+private:
+    Configuration::Timing& timing;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit Stopwatch(Configuration::Timing& timing_)
+            : timing(timing_)
+            , start(std::chrono::steady_clock::now()) {}
+    ~Stopwatch()
+    {
+        timing.count += 1;
+        timing.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+static Configuration::Timing& timing(Configuration::BoardTiming& board, const std::string& setting)
+{
+    for (Configuration::Timing& t: board.settings)
+    {
+        if (t.setting == setting)
+            return t;
+    }
+    board.settings.push_back(Configuration::Timing{setting, 0, 0.0});
+    return board.settings.back();
+}
+
+/* One value to set - index -1 for settings without channel/group */
+struct Write
+{
+    FunctionID fid;
+    int index;
+    std::string value;
+};
+
+/* With held the digitizer has been open since its shadow was recorded, so the shadow in memory is trusted */
+static void configure(Digitizer& digitizer, pt::ptree& conf, bool verbose, Configuration::BoardTiming& timings,
+                      std::string shadowFile, bool held)
+{
+    /* Expand the ranges, keeping the order of the configuration file */
+    std::vector<Write> writes;
+    for (auto& setting : conf)
+    {
+        FunctionID fid = functionID(setting.first);
+        if (setting.second.empty()) //Setting without channel/group
+        {
+            writes.push_back(Write{fid, -1, setting.second.data()});
+        }
+        else //Setting with channel/group
+        {
+            for (auto& rangeSetting: setting.second)
+            {
+                assert(rangeSetting.second.empty());
+                Configuration::Range range{rangeSetting.first};
+                for (int i = range.begin(); i != range.end(); ++i)
+                {
+                    writes.push_back(Write{fid, i, rangeSetting.second.data()});
+                }
+            }
+        }
+    }
+
+    /* The shadow needs the scratch register to itself */
+    for (const Write& write: writes)
+    {
+        if (write.fid == Scratch)
+        {
+            if (!shadowFile.empty())
+            {
+                std::cerr << "WARNING: " << digitizer.name() << " configuration sets " << to_string(Scratch) <<
+                          " - not using the register shadow." << std::endl;
+                shadowFile.clear();
+            }
+            held = false;
+        }
+    }
+    /* Without a reset only the settings that changed since the saved configuration are written */
+    bool warm = held;
+    if (!warm && !shadowFile.empty())
+    {
+        try {
+            Stopwatch stopwatch(timing(timings, "loadShadow"));
+            warm = digitizer.loadShadow(shadowFile);
+        } catch (caen::Error& e)
+        {
+            std::cerr << "WARNING: " << digitizer.name() << " cannot keep a register shadow: " << e.what() << std::endl;
+            shadowFile.clear();
+        }
+    }
+    if (warm)
+    {
+        /* Every register set before must be set again - a reset is the only way back to a default */
+        std::set<std::pair<FunctionID,int> > covered;
+        for (const Write& write: writes)
+        {
+            if (write.index < 0 && digitizer.broadcast(write.fid))
+            {
+                for (int group = 0; group < (int)digitizer.groups(); ++group)
+                    covered.insert(std::make_pair(write.fid, group));
+            }
+            covered.insert(std::make_pair(write.fid, digitizer.registerIndex(write.fid, write.index)));
+        }
+        for (const auto& entry: digitizer.getShadow())
+        {
+            if (!covered.count(entry.first) && !(entry.first.second < 0 && digitizer.broadcast(entry.first.first)))
+            {
+                warm = false;
+                break;
+            }
+        }
+        /* BoardConfiguration sets bits through a bit set register - clearing them takes a reset */
+        for (const Write& write: writes)
+        {
+            if (write.fid == BoardConfiguration && !digitizer.applied(write.fid, write.value))
+                warm = false;
+        }
+    }
+    timings.reset = !warm;
+
     /* NOTE: it seems we need to force stop and reset for all
      * configuration settings to work. Most notably setDCOffset will
      * consitently fail with GenericError if we don't. */
     /* Stop any acquisition first
      * TODO Why is Acquisition running before configuration??
      * */
-    digitizer.stopAcquisition();
+    {
+        Stopwatch stopwatch(timing(timings, "stopAcquisition"));
+        digitizer.stopAcquisition();
+    }
     
-    /* Reset Digitizer */
-    digitizer.reset();
+    if (warm)
+    {
+        /* Should we fail half way the shadow no longer matches the board */
+        Stopwatch stopwatch(timing(timings, "invalidateShadow"));
+        digitizer.invalidateShadow();
+    } else
+    {
+        /* Reset Digitizer */
+        Stopwatch stopwatch(timing(timings, "reset"));
+        digitizer.reset();
+    }
 
-    for (auto& setting : conf)
+    for (size_t w = 0; w < writes.size(); ++w)
     {
-        FunctionID fid = functionID(setting.first);
-        if (setting.second.empty()) //Setting without channel/group
+        const Write& write = writes[w];
+        Configuration::Timing& settingTiming = timing(timings, to_string(write.fid));
+        if (write.index < 0) //Setting without channel/group
         {
-            try { digitizer.set(fid,setting.second.data()); }
+            if (digitizer.applied(write.fid, write.value))
+            {
+                timings.unchanged += 1;
+                continue;
+            }
+            try {
+                Stopwatch stopwatch(settingTiming);
+                digitizer.set(write.fid, write.value);
+            }
             catch (caen::Error& e)
             {
-                std::cerr << "ERROR: " << digitizer.name() << " could not set" << to_string(fid) << '(' << setting.second.data() << ") " << e.what() << std::endl;
+                std::cerr << "ERROR: " << digitizer.name() << " could not set" << to_string(write.fid) << '(' << write.value << ") " << e.what() << std::endl;
                 throw;
             }
             catch (std::runtime_error& e)
             {
                 if (verbose) {
-                    std::cout << "WARNING: " << digitizer.name() << " ignoring attempt to set " << to_string(fid) << ": " << e.what() << std::endl;
+                    std::cout << "WARNING: " << digitizer.name() << " ignoring attempt to set " << to_string(write.fid) << ": " << e.what() << std::endl;
                 }
             }
         }
         else //Setting with channel/group
         {
-            for (auto& rangeSetting: setting.second)
+            /* The same value for every group is one write to the broadcast register */
+            if (digitizer.broadcast(write.fid))
             {
-                assert(rangeSetting.second.empty());
-                Configuration::Range range{rangeSetting.first};
-                for (int i = range.begin(); i != range.end(); ++i)
+                std::vector<bool> groups(digitizer.groups(), false);
+                size_t n = w;
+                bool same = true;
+                for (; n < writes.size() && writes[n].fid == write.fid && writes[n].index >= 0; ++n)
                 {
-                    try { digitizer.set(fid, i, rangeSetting.second.data()); }
-                    catch (caen::Error& e)
-                    {
-                        std::cerr << "ERROR: " << digitizer.name() << " could not set" << to_string(fid) <<
-                                  '(' << i << ", " << rangeSetting.second.data() << ") " << e.what() << std::endl;
-                        throw;
-                    }
-                    catch (std::runtime_error& e)
+                    same = same && writes[n].value == write.value && writes[n].index < (int)groups.size();
+                    if (same)
+                        groups[writes[n].index] = true;
+                }
+                if (same && std::find(groups.begin(), groups.end(), false) == groups.end())
+                {
+                    bool changed = false;
+                    for (int group = 0; group < (int)groups.size(); ++group)
+                        changed = changed || !digitizer.applied(write.fid, group, write.value);
+                    if (changed)
                     {
-                        if (verbose) {
-                            std::cout << "WARNING: " << digitizer.name() << " ignoring attempt to set " << to_string(fid) << ": " << e.what() << std::endl;
+                        try {
+                            Stopwatch stopwatch(settingTiming);
+                            digitizer.set(write.fid, write.value);
                         }
-                        
+                        catch (caen::Error& e)
+                        {
+                            std::cerr << "ERROR: " << digitizer.name() << " could not set" << to_string(write.fid) <<
+                                      '(' << write.value << ") " << e.what() << std::endl;
+                            throw;
+                        }
+                        timings.unchanged += n - w - 1;
+                    } else
+                    {
+                        timings.unchanged += n - w;
                     }
+                    w = n - 1;
+                    continue;
+                }
+            }
+            if (digitizer.applied(write.fid, write.index, write.value))
+            {
+                timings.unchanged += 1;
+                continue;
+            }
+            try {
+                Stopwatch stopwatch(settingTiming);
+                digitizer.set(write.fid, write.index, write.value);
+            }
+            catch (caen::Error& e)
+            {
+                std::cerr << "ERROR: " << digitizer.name() << " could not set" << to_string(write.fid) <<
+                          '(' << write.index << ", " << write.value << ") " << e.what() << std::endl;
+                throw;
+            }
+            catch (std::runtime_error& e)
+            {
+                if (verbose) {
+                    std::cout << "WARNING: " << digitizer.name() << " ignoring attempt to set " << to_string(write.fid) << ": " << e.what() << std::endl;
                 }
+
             }
         }
     }
+
+    if (!shadowFile.empty())
+    {
+        Stopwatch stopwatch(timing(timings, "saveShadow"));
+        digitizer.saveShadow(shadowFile);
+    }
 }
 
-void Configuration::apply()
+/* A digitizer section from the configuration file and what became of it */
+struct Configuration::Board
+{
+    std::string name;
+    pt::ptree conf;
+    CAEN_DGTZ_ConnectionType linkType;
+    int linkNum;
+    int conet;
+    uint32_t vme;
+    Digitizer* held = nullptr;  // Already open - reconfigure it
+    bool reopened = false;      // held was opened again and only the saved shadow can tell what it holds
+    std::unique_ptr<Digitizer> digitizer;
+    Configuration::BoardTiming timings;
+    std::string error;
+
+    void open(bool verbose, const std::string& shadowPath)
+    {
+        auto start = std::chrono::steady_clock::now();
+        timings.name = name;
+        try {
+            if (held == nullptr)
+            {
+                Stopwatch stopwatch(timing(timings, "open"));
+                digitizer.reset(new Digitizer(linkType, linkNum, conet, vme));
+            }
+            Digitizer& target = held ? *held : *digitizer;
+            timings.name = target.name();
+            configure(target, conf, verbose, timings,
+                      shadowPath.empty() ? "" : shadowPath + "/" + target.name() + ".shadow", held != nullptr && !reopened);
+            /* Done here, on the task of the link, rather than when the run starts */
+            Stopwatch stopwatch(timing(timings, "prepare"));
+            target.prepare();
+        } catch (std::exception& e)
+        {
+            error = (digitizer || held) ? e.what() : std::string("unable to open digitizer: ") + e.what();
+        }
+        timings.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+/* The digitizer sections of the configuration */
+std::vector<Configuration::Board> Configuration::sections(const pt::ptree& in)
 {
+    std::vector<Board> boards;
     for (auto& section : in)
     {
         std::string name = section.first;
@@ -252,7 +551,6 @@ void Configuration::apply()
         conf.erase("VME");
         conet = conf.get<int>("CONET",0);
         conf.erase("CONET");
-        Digitizer* digitizer = nullptr;
         if (usb < 0 && optical < 0)
         {
             std::cerr << "ERROR: [" << name << ']' <<" contains neither USB nor OPTICAL number. One is REQUIRED." << std::endl;
@@ -261,20 +559,177 @@ void Configuration::apply()
             std::cerr << "ERROR: [" << name << ']' <<" contains both USB and OPTICAL number. Omly one is VALID" << std::endl;
             continue;
         }
-        try {
-            if (optical >= 0) {
-                digitizers.emplace_back(CAEN_DGTZ_OpticalLink, optical, conet, vme);
-            } else {
-                digitizers.emplace_back(CAEN_DGTZ_USB, usb, conet, vme);
+        boards.emplace_back();
+        Board& board = boards.back();
+        board.name = name;
+        board.conf = conf;
+        board.linkType = optical >= 0 ? CAEN_DGTZ_OpticalLink : CAEN_DGTZ_USB;
+        board.linkNum = optical >= 0 ? optical : usb;
+        board.conet = conet;
+        board.vme = vme;
+    }
+    return boards;
+}
+
+void Configuration::configureBoards(std::vector<Board>& boards)
+{
+    auto start = std::chrono::steady_clock::now();
+    /* Boards daisy chained on one link share it - they are configured one after the other by one task */
+    std::map<std::pair<int, int>, std::vector<Board*> > links;
+    for (Board& board: boards)
+    {
+        links[std::make_pair((int)board.linkType, board.linkNum)].push_back(&board);
+    }
+    const bool verbose = getVerbose();
+    const std::string& shadowPath = this->shadowPath;
+    auto task = [verbose, &shadowPath](std::vector<Board*>& link)
+    {
+        for (Board* board: link)
+        {
+            board->open(verbose, shadowPath);
+        }
+    };
+    if (parallel && links.size() > 1)
+    {
+        std::vector<std::thread> threads;
+        for (auto& link: links)
+        {
+            threads.emplace_back(task, std::ref(link.second));
+        }
+        for (std::thread& thread: threads)
+        {
+            thread.join();
+        }
+    } else
+    {
+        for (auto& link: links)
+        {
+            task(link.second);
+        }
+    }
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    timings.clear();
+    for (Board& board: boards)
+    {
+        timings.push_back(board.timings);
+        if (board.digitizer)
+        {
+            digitizers.emplace_back(std::move(*board.digitizer));
+        }
+        if (!board.error.empty())
+        {
+            failed += 1;
+        }
+    }
+    if (failed > 0)
+    {
+        std::cerr << "ERROR: " << failed << " of " << boards.size() << " digitizer(s) could not be configured:" << std::endl;
+        for (Board& board: boards)
+        {
+            if (!board.error.empty())
+            {
+                std::cerr << "\t[" << board.name << "] ";
+                if (board.digitizer || board.held)
+                    std::cerr << board.timings.name << " ";
+                std::cerr << board.error << std::endl;
             }
-            digitizer = &*digitizers.rbegin();
-        } catch (caen::Error& e)
+        }
+        throw std::runtime_error("Digitizer configuration failed");
+    }
+}
+
+void Configuration::apply()
+{
+    std::vector<Board> boards = sections(in);
+    configureBoards(boards);
+}
+
+void Configuration::reconfigure(std::ifstream& file)
+{
+    pt::ptree next;
+    pt::ini_parser::read_ini(file, next);
+    std::vector<Board> boards = sections(next);
+    /* The open digitizers keep their links - only their settings can change */
+    std::set<Digitizer*> held;
+    for (Board& board: boards)
+    {
+        for (Digitizer& digitizer: digitizers)
+        {
+            if (digitizer.linkType == board.linkType && digitizer.linkNum == board.linkNum &&
+                digitizer.conetNode == board.conet && digitizer.VMEBaseAddress == board.vme)
+            {
+                board.held = &digitizer;
+            }
+        }
+        if (board.held == nullptr || !held.insert(board.held).second)
         {
-            std::cerr << "ERROR: Unable to open digitizer [" << name << "]: " << e.what() << std::endl;
-            throw;
+            throw std::runtime_error("[" + board.name + "] is not one of the open digitizers");
+        }
+    }
+    if (held.size() != digitizers.size())
+    {
+        throw std::runtime_error("The configuration leaves out " + std::to_string(digitizers.size() - held.size()) +
+                                 " of the open digitizers");
+    }
+    in = next;
+    configureBoards(boards);
+}
+
+Configuration::BoardTiming Configuration::restore(Digitizer& digitizer)
+{
+    for (Board& board: sections(in))
+    {
+        if (digitizer.linkType == board.linkType && digitizer.linkNum == board.linkNum &&
+            digitizer.conetNode == board.conet && digitizer.VMEBaseAddress == board.vme)
+        {
+            board.held = &digitizer;
+            board.reopened = true;
+            board.open(getVerbose(), shadowPath);
+            if (!board.error.empty())
+                throw std::runtime_error(board.error);
+            return board.timings;
+        }
+    }
+    throw std::runtime_error(digitizer.name() + " is not in the configuration");
+}
+
+void Configuration::printTimings(std::ostream& out, bool detail) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "Configured " << timings.size() << " digitizer(s) in " << std::fixed << std::setprecision(3) << seconds <<
+        " s" << std::endl;
+    for (const BoardTiming& board: timings)
+    {
+        size_t count = 0;
+        for (const Timing& t: board.settings)
+        {
+            count += t.count;
+        }
+        out << std::setw(15) << board.name << ": " << std::fixed << std::setprecision(3) << board.seconds <<
+            " s for " << count << " call(s)";
+        if (!board.reset)
+            out << ", " << board.unchanged << " unchanged setting(s) skipped without reset";
+        else if (board.unchanged > 0)
+            out << ", " << board.unchanged << " repeated register write(s) merged";
+        out << std::endl;
+        if (!detail)
+            continue;
+        std::vector<Timing> settings(board.settings);
+        std::sort(settings.begin(), settings.end(), [](const Timing& a, const Timing& b) { return a.seconds > b.seconds; });
+        for (const Timing& t: settings)
+        {
+            if (t.count == 0)
+                continue;
+            out << std::setw(40) << t.setting << ": " << std::setprecision(3) << t.seconds*1e3 << " ms for " <<
+                t.count << " call(s)" << std::endl;
         }
-        configure(*digitizer,conf, getVerbose());
     }
+    out.flags(flags);
+    out.precision(precision);
 }
 
 Configuration::Range::Range(std::string s)
@@ -29,6 +29,8 @@
 #define JADAQ_CONFIGURATION_HPP
 
 #include <fstream>
+#include <ostream>
+#include <vector>
 #include "ini_parser.hpp"
 #include "Digitizer.hpp"
 
@@ -36,19 +38,56 @@ namespace pt = boost::property_tree;
 
 class Configuration
 {
+public:
+    /* Time spent on one kind of setting of one digitizer */
+    struct Timing
+    {
+        std::string setting;
+        size_t count;
+        double seconds;
+    };
+    struct BoardTiming
+    {
+        std::string name;
+        double seconds = 0.0;   // Opening and configuring
+        bool reset = true;      // Otherwise only changed settings were written
+        size_t unchanged = 0;   // Writes skipped because the register already holds the value
+        std::vector<Timing> settings;
+    };
 private:
     pt::ptree in;
     std::vector<Digitizer> digitizers;
-    pt::ptree readBack();
+    std::vector<BoardTiming> timings;
+    double seconds = 0.0;  // Opening and configuring all digitizers
+    pt::ptree readBack(bool verify);
+    std::string shadowPath;
+    bool parallel;
+    struct Board;
+    static std::vector<Board> sections(const pt::ptree& in);
+    void configureBoards(std::vector<Board>& boards);
     void apply();
     bool verbose_;
 public:
-    explicit Configuration(std::ifstream& file, bool verbose);
+    /* With parallel the digitizers on different links are opened and configured concurrently.
+     * With a shadowPath the settings applied to each digitizer are saved there, and the next
+     * configuration skips the reset and writes only what changed */
+    explicit Configuration(std::ifstream& file, bool verbose, bool parallel = true,
+                           const std::string& shadowPath = "");
+    /* Apply another configuration file to the open digitizers - only the settings that changed are
+     * written. The file must have a section for each of them and no others */
+    void reconfigure(std::ifstream& file);
+    /* Configure one of the digitizers again from its section, e.g. after it was reopened. Throws if it fails */
+    BoardTiming restore(Digitizer& digitizer);
     std::vector<Digitizer>& getDigitizers();
-    void write(std::ofstream& file);
+    /* Read back the configuration of the digitizers - all links in parallel if parallel. Unless verify
+     * the settings written by this configuration are taken as written, not read from the digitizers */
+    void write(std::ofstream& file, bool verify = false);
     void writeInput(std::ofstream& file);
     void setVerbose(bool verbose) { verbose_ = verbose; }
     bool getVerbose() { return verbose_; }
+    const std::vector<BoardTiming>& getTimings() const { return timings; }
+    /* Time per digitizer and, with detail, per setting - slowest first */
+    void printTimings(std::ostream& out, bool detail) const;
     class Range
     {
     private:
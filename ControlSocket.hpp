@@ -0,0 +1,193 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Local run control socket for the jadaq daemon: a unix stream socket
+ * taking one command per line and answering each with one line, "OK ..."
+ * or "ERROR ...". Clients are identified so a reply can come later, e.g.
+ * when a run ends. Polled from the acquisition loop, so no locking is
+ * needed around the digitizers.
+ *
+ */
+
+#ifndef JADAQ_CONTROLSOCKET_HPP
+#define JADAQ_CONTROLSOCKET_HPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+class ControlSocket
+{
+private:
+    struct Client
+    {
+        int id;
+        int fd;
+        std::string input;  // Received but not yet a whole line
+    };
+    std::string path;
+    int listener = -1;
+    int clients = 0;
+    std::vector<Client> connected;
+
+    static sockaddr_un address(const std::string& path)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::invalid_argument("Control socket path too long: \"" + path + "\"");
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    void disconnect(size_t i)
+    {
+        ::close(connected[i].fd);
+        connected.erase(connected.begin() + i);
+    }
+
+    /* Take a line from the input of a client if there is a whole one */
+    bool line(int& client, std::string& command)
+    {
+        for (Client& c: connected)
+        {
+            size_t end = c.input.find('\n');
+            if (end == std::string::npos)
+                continue;
+            command = c.input.substr(0, end);
+            c.input.erase(0, end + 1);
+            if (!command.empty() && command.back() == '\r')
+                command.pop_back();
+            client = c.id;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit ControlSocket(const std::string& path_)
+            : path(path_)
+    {
+        sockaddr_un addr = address(path);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw std::runtime_error(std::string("Could not create control socket: ") + strerror(errno));
+        /* A socket file nobody answers on is left over from a daemon that died */
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 && connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0)
+        {
+            ::close(probe);
+            ::close(listener);
+            throw std::runtime_error("Control socket \"" + path + "\" is in use by another daemon");
+        }
+        if (probe >= 0)
+            ::close(probe);
+        unlink(path.c_str());
+        if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0)
+        {
+            std::string error = strerror(errno);
+            ::close(listener);
+            throw std::runtime_error("Could not listen on control socket \"" + path + "\": " + error);
+        }
+    }
+
+    ~ControlSocket()
+    {
+        for (Client& c: connected)
+            ::close(c.fd);
+        ::close(listener);
+        unlink(path.c_str());
+    }
+
+    ControlSocket(const ControlSocket&) = delete;
+    ControlSocket& operator=(const ControlSocket&) = delete;
+
+    /* Wait at most timeout milliseconds for a command. Returns false if none came, otherwise the
+     * command and the client to reply to */
+    bool command(int timeout, int& client, std::string& command)
+    {
+        if (line(client, command))
+            return true;
+        std::vector<pollfd> fds(connected.size() + 1);
+        fds[0].fd = listener;
+        for (size_t i = 0; i < connected.size(); ++i)
+            fds[i + 1].fd = connected[i].fd;
+        for (pollfd& fd: fds)
+        {
+            fd.events = POLLIN;
+            fd.revents = 0;
+        }
+        if (poll(fds.data(), fds.size(), timeout) <= 0)
+            return false;
+        /* Backwards, so the clients that hung up can go */
+        for (size_t i = connected.size(); i > 0; --i)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            char buffer[1024];
+            ssize_t n = recv(connected[i - 1].fd, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                disconnect(i - 1);
+            else
+                connected[i - 1].input.append(buffer, n);
+        }
+        if (fds[0].revents != 0)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+                connected.push_back(Client{++clients, fd, ""});
+        }
+        return line(client, command);
+    }
+
+    /* A client that is gone by now is skipped */
+    void reply(int client, const std::string& reply)
+    {
+        for (size_t i = 0; i < connected.size(); ++i)
+        {
+            if (connected[i].id != client)
+                continue;
+            std::string message = reply + '\n';
+            size_t sent = 0;
+            while (sent < message.size())
+            {
+                ssize_t n = send(connected[i].fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    disconnect(i);
+                    return;
+                }
+                sent += n;
+            }
+            return;
+        }
+    }
+};
+
+#endif //JADAQ_CONTROLSOCKET_HPP
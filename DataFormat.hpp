@@ -32,7 +32,7 @@
 #include "Waveform.hpp"
 #include "EventIterator.hpp"
 
-#define VERSION {1,2}
+#define VERSION {1,3}
 
 #define JUMBO_PAYLOAD 9000
 #define IP_HEADER       20
@@ -54,7 +54,10 @@ namespace Data
         Waveform422 = WaveformBase | List422,
         Waveform8222 = WaveformBase | List8222,
     };
-    /* Shared meta data for the entire data package */
+    /* Shared meta data for the entire data package
+     * sequence is counted per digitizer by the sender starting from 0, and
+     * lets the receiver detect lost, duplicated and reordered packages.
+     */
     struct __attribute__ ((__packed__)) Header // 32 bytes
     {
         uint64_t runID;
@@ -63,10 +66,29 @@ namespace Data
         uint16_t elementType;
         uint16_t numElements;
         uint16_t version;
-        uint8_t __pad[6];
+        uint32_t sequence;
+        uint8_t __pad[2];
     };
+    static_assert(sizeof(Header) == 32, "Data::Header must be 32 bytes");
     static_assert(std::is_pod<Header>::value, "Data::Header must be POD");
 
+    /* When a digitizer started its run as seen by the host. Its time tags count from somewhere in
+     * [issued, issued + window], in ns since the epoch. offset is issued relative to the board of the
+     * run that was started first, so the time tags of two boards are at most
+     * |offset1 - offset2| + max(window1, window2) apart. Boards started by hardware from a master -
+     * the S-IN daisy chain - carry the start of the master.
+     * A digitizer recovered during the run starts again: the data from then on has globalTime epoch or
+     * later, and its time tags count from the new start.
+     */
+    struct StartTime
+    {
+        int64_t issued = 0;
+        int64_t offset = 0;
+        uint64_t epoch = 0;  // globalTime of the first data from this start - 0 at the start of the run
+        uint32_t window = 0;
+        uint8_t mode = 0;  // Start mode in Acquisition Control bits [1:0]: 0 software, 1 S-IN, 2 first trigger, 3 LVDS
+    };
+
     struct __attribute__ ((__packed__)) ListElement422
     {
         typedef uint32_t time_t;
@@ -89,6 +111,13 @@ namespace Data
         {
             os << PRINTD(channel) << " " << PRINTD(time) << " " << PRINTD(charge);
         }
+        /* Same text as printOn into out - gives the end of it */
+        char* formatOn(char* out) const
+        {
+            out = FORMATD(out, channel); *out++ = ' ';
+            out = FORMATD(out, time); *out++ = ' ';
+            return FORMATD(out, charge);
+        }
         static ElementType type() { return List422; }
         static void insertMembers(H5::CompType& datatype)
         {
@@ -135,6 +164,13 @@ namespace Data
         {
             os << PRINTD(channel) << " " << PRINTD(time) << " " << PRINTD(charge) << " " << PRINTD(baseline) ;
         }
+        char* formatOn(char* out) const
+        {
+            out = FORMATD(out, channel); *out++ = ' ';
+            out = FORMATD(out, time); *out++ = ' ';
+            out = FORMATD(out, charge); *out++ = ' ';
+            return FORMATD(out, baseline);
+        }
         static ElementType type() { return List8222; }
         static void insertMembers(H5::CompType& datatype)
         {
@@ -175,6 +211,11 @@ namespace Data
             listElement.printOn(os); os << " ";
             waveform.printOn(os);
         }
+        char* formatOn(char* out) const
+        {
+            out = listElement.formatOn(out); *out++ = ' ';
+            return waveform.formatOn(out);
+        }
         static void headerOn(std::ostream& os)
         {
             ListElementType::headerOn(os);
@@ -32,16 +32,22 @@
 #include "EventIterator.hpp"
 #include "container.hpp"
 #include "DataWriter.hpp"
+#include "trace.hpp"
 
 class DataHandler
 {
 public:
+    /* epoch is the globalTimeStamp of the data until the time tags first roll over - 0 at the start of a run */
     template<typename E>
-    void initialize(DataWriter& dataWriter, uint32_t digitizerID, size_t groups, size_t samples, const uint32_t* maxJitter)
+    void initialize(DataWriter& dataWriter, uint32_t digitizerID, size_t groups, size_t samples, const uint32_t* maxJitter,
+                    uint64_t epoch = 0)
     {
         instance.reset(new Implementation<E>(dataWriter,digitizerID,groups,samples,maxJitter));
+        instance->start(epoch);
     }
     void flush() { instance->flush(); }
+    /* Flush and drop the implementation - initialize again before use */
+    void release() { instance.reset(); }
     size_t operator()(DPPQDCEventIterator& it) { return instance->operator()(it); }
     static int64_t getTimeMsecs()
     {
@@ -54,6 +60,7 @@ private:
         virtual ~Interface() = default;
         virtual size_t operator()(DPPQDCEventIterator& it) = 0;
         virtual void flush() = 0;
+        virtual void start(uint64_t epoch) = 0;
     };
     /* E is element type e.g. Data::ListElementxxx
      * C is containertype i.e. jadaq::vector, jadaq::set, jadaq::buffer
@@ -101,6 +108,12 @@ private:
 
         } previous, current, next;
 
+        void write(const Buffer& buffer)
+        {
+            trace::emit(trace::Store, digitizerID, E::type(), buffer.buffer->size());
+            dataWriter(buffer.buffer, digitizerID, buffer.globalTimeStamp);
+        }
+
         void inline store(Buffer& buffer, typename E::EventType& event, uint16_t group)
         {
             buffer.maxLocalTime[group] = event.timeTag();
@@ -108,7 +121,7 @@ private:
                 buffer.buffer->emplace_back(event,group);
             } catch (std::length_error&)
             {
-                dataWriter(buffer.buffer, digitizerID, buffer.globalTimeStamp);
+                write(buffer);
                 buffer.buffer->clear();
                 buffer.buffer->emplace_back(event,group);
             }
@@ -123,10 +136,15 @@ private:
                 , current(groups)
                 , next(groups)
         {
+            dataWriter.addDataType(digitizerID, E::type(), E::size(samples));
             previous.malloc(dataWriter, samples, dataWriter.network());
             current.malloc(dataWriter, samples, dataWriter.network());
             next.malloc(dataWriter, samples, dataWriter.network());
         }
+        void start(uint64_t epoch)
+        {
+            current.globalTimeStamp = epoch;
+        }
         ~Implementation()
         {
             flush();
@@ -166,7 +184,7 @@ private:
             {
                 if (previous.buffer->size() > 0)
                 {
-                    dataWriter(previous.buffer, digitizerID, previous.globalTimeStamp);
+                    write(previous);
                 }
                 previous.clear();
                 std::swap(current,previous);
@@ -178,12 +196,12 @@ private:
         {
             if (previous.buffer->size() > 0)
             {
-                dataWriter(previous.buffer, digitizerID, previous.globalTimeStamp);
+                write(previous);
                 previous.clear();
             }
             if (current.buffer->size() > 0)
             {
-                dataWriter(current.buffer, digitizerID, current.globalTimeStamp);
+                write(current);
                 current.clear();
             }
             assert(next.buffer->size() == 0);
@@ -0,0 +1,161 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Read binary list files written by DataWriterBinary. The file is mapped
+ * into memory and the blocks and their elements are handed out where they
+ * are, without copying. A block cut short at the end of the file - e.g.
+ * when acquisition died - ends the iteration.
+ *
+ */
+
+#ifndef JADAQ_DATAREADERBINARY_HPP
+#define JADAQ_DATAREADERBINARY_HPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <iterator>
+#include "DataFormat.hpp"
+#include "container.hpp"
+#include "DataWriterBinary.hpp"
+
+class DataReaderBinary
+{
+public:
+    typedef DataWriterBinary::FileHeader FileHeader;
+    typedef DataWriterBinary::BlockHeader BlockHeader;
+
+    class Block
+    {
+    private:
+        const BlockHeader* block;
+    public:
+        explicit Block(const BlockHeader* block_) : block(block_) {}
+        const Data::Header& header() const { return block->header; }
+        uint32_t digitizerID() const { return block->header.digitizerID; }
+        uint16_t elementType() const { return block->header.elementType; }
+        uint64_t globalTime() const { return block->header.globalTime; }
+        size_t size() const { return block->header.numElements; }
+        size_t elementSize() const { return block->elementSize; }
+        const char* data() const { return (const char*)(block + 1); }
+        /* The elements as E - check elementType first */
+        template <typename E>
+        typename jadaq::buffer<E>::const_iterator begin() const
+        { return typename jadaq::buffer<E>::const_iterator(const_cast<char*>(data()), elementSize()); }
+        template <typename E>
+        typename jadaq::buffer<E>::const_iterator end() const
+        { return typename jadaq::buffer<E>::const_iterator(const_cast<char*>(data()) + size()*elementSize(), elementSize()); }
+        template <typename E>
+        const E& element(size_t i) const { return *(const E*)(data() + i*elementSize()); }
+    };
+
+    class iterator : public std::iterator<std::forward_iterator_tag, Block>
+    {
+    private:
+        const char* next;
+        const char* end;
+        /* The block at next if it is all there */
+        static const char* valid(const char* p, const char* end)
+        {
+            if ((size_t)(end - p) < sizeof(BlockHeader))
+                return end;
+            const BlockHeader* block = (const BlockHeader*)p;
+            if (block->elementSize == 0 ||
+                (size_t)(end - p) - sizeof(BlockHeader) < (size_t)block->header.numElements*block->elementSize)
+                return end;
+            return p;
+        }
+    public:
+        iterator(const char* p, const char* end_) : next(valid(p, end_)), end(end_) {}
+        Block operator*() const { return Block((const BlockHeader*)next); }
+        iterator& operator++()
+        {
+            const BlockHeader* block = (const BlockHeader*)next;
+            next = valid(next + sizeof(BlockHeader) + (size_t)block->header.numElements*block->elementSize, end);
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        bool operator==(const iterator& rhs) const { return next == rhs.next; }
+        bool operator!=(const iterator& rhs) const { return next != rhs.next; }
+    };
+
+private:
+    const char* map = nullptr;
+    size_t mapSize = 0;
+    const FileHeader* fileHeader = nullptr;
+
+public:
+    explicit DataReaderBinary(const std::string& filename)
+    {
+        int file = ::open(filename.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            throw std::runtime_error("Could not open binary data file: \"" + filename + "\"");
+        }
+        struct stat st;
+        if (fstat(file, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader))
+        {
+            ::close(file);
+            throw std::runtime_error("Not a jadaq binary data file: \"" + filename + "\"");
+        }
+        mapSize = st.st_size;
+        void* p = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (p == MAP_FAILED)
+        {
+            throw std::runtime_error("Could not map binary data file: \"" + filename + "\"");
+        }
+        madvise(p, mapSize, MADV_SEQUENTIAL);
+        map = (const char*)p;
+        fileHeader = (const FileHeader*)map;
+        if (memcmp(fileHeader->magic, DataWriterBinary::magic(), sizeof(fileHeader->magic)) != 0 ||
+            fileHeader->headerSize < sizeof(FileHeader) || fileHeader->blockHeaderSize != sizeof(BlockHeader) ||
+            fileHeader->headerSize > mapSize)
+        {
+            munmap((void*)map, mapSize);
+            throw std::runtime_error("Not a jadaq binary data file: \"" + filename + "\"");
+        }
+    }
+
+    ~DataReaderBinary()
+    {
+        munmap((void*)map, mapSize);
+    }
+
+    DataReaderBinary(const DataReaderBinary&) = delete;
+    DataReaderBinary& operator=(const DataReaderBinary&) = delete;
+
+    std::string id() const { return std::string(fileHeader->id, strnlen(fileHeader->id, sizeof(fileHeader->id))); }
+    uint16_t version() const { return fileHeader->version; }
+
+    iterator begin() const { return iterator(map + fileHeader->headerSize, map + mapSize); }
+    iterator end() const { return iterator(map + mapSize, map + mapSize); }
+};
+
+#endif //JADAQ_DATAREADERBINARY_HPP
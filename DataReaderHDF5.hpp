@@ -0,0 +1,311 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Read list data written by DataWriterHDF5 - in record or columnar layout.
+ * The time-range index (<name>_blocks) is used to read only the blocks that
+ * can hold elements in the requested time window and channels. Files
+ * without it are read in full. tables(), index() and the raw read() give
+ * every element data set, waveforms included, as written - e.g. to replay it.
+ *
+ */
+
+#ifndef JADAQ_DATAREADERHDF5_HPP
+#define JADAQ_DATAREADERHDF5_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <H5Cpp.h>
+#include "DataFormat.hpp"
+#include "DataWriterHDF5.hpp"
+
+class DataReaderHDF5
+{
+public:
+    typedef DataWriterHDF5::BlockEntry Block;
+    static constexpr const uint64_t allChannels = UINT64_MAX;
+
+private:
+    H5::H5File file;
+
+    static uint64_t channelBit(uint16_t channel) { return DataWriterHDF5::channelBit(channel); }
+    static bool exists(const H5::Group& group, const std::string& name)
+    { return H5Lexists(group.getId(), name.c_str(), H5P_DEFAULT) > 0; }
+
+    static hsize_t rows(const H5::DataSet& dataset)
+    {
+        hsize_t n = 0;
+        dataset.getSpace().getSimpleExtentDims(&n);
+        return n;
+    }
+
+    /* Read rows [first, first+n) of dataset */
+    static void readRows(const H5::DataSet& dataset, const H5::DataType& datatype, hsize_t first, hsize_t n, void* out)
+    {
+        H5::DataSpace fileSpace = dataset.getSpace();
+        fileSpace.selectHyperslab(H5S_SELECT_SET, &n, &first);
+        H5::DataSpace memSpace(1, &n);
+        dataset.read(out, datatype, memSpace, fileSpace);
+    }
+
+    /* Read rows [first, first+n) of elements of datatype from a record data set or a group of columns */
+    static void readElements(const H5::Group& group, const std::string& name, const H5::CompType& datatype,
+                             hsize_t first, hsize_t n, char* out)
+    {
+        if (group.childObjType(name) == H5O_TYPE_DATASET)
+        {
+            readRows(group.openDataSet(name), datatype, first, n, out);
+            return;
+        }
+        H5::Group columns = group.openGroup(name);
+        const size_t elementSize = datatype.getSize();
+        std::vector<char> values;
+        for (int i = 0; i < datatype.getNmembers(); ++i)
+        {
+            H5::DataType member = datatype.getMemberDataType(i);
+            const size_t offset = datatype.getMemberOffset(i);
+            const size_t size = member.getSize();
+            values.resize(n*size);
+            readRows(columns.openDataSet(datatype.getMemberName(i)), member, first, n, values.data());
+            for (hsize_t j = 0; j < n; ++j)
+            {
+                memcpy(out + j*elementSize + offset, values.data() + j*size, size);
+            }
+        }
+    }
+
+    static hsize_t elementRows(const H5::Group& group, const std::string& name, const H5::CompType& datatype)
+    {
+        if (group.childObjType(name) == H5O_TYPE_DATASET)
+        {
+            return rows(group.openDataSet(name));
+        }
+        return rows(group.openGroup(name).openDataSet(datatype.getMemberName(0)));
+    }
+
+    static bool endsWith(const std::string& name, const std::string& suffix)
+    { return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0; }
+
+    template <typename L>
+    static H5::CompType waveformType(size_t samples)
+    {
+        Data::WaveformElement<L> element;
+        element.waveform.num_samples = (uint16_t)samples;
+        return element.h5type();
+    }
+
+public:
+    /* An element data set of a digitizer, e.g. /<digitizerID>/Waveform422_<samples> */
+    struct Table
+    {
+        uint32_t digitizerID;
+        std::string name;
+        uint16_t elementType;
+        size_t elementSize;
+        hsize_t rows;
+    };
+    typedef DataWriterHDF5::IndexEntry IndexEntry;
+
+    /* The element type and size of a data set name - false if it is not one */
+    static bool parse(const std::string& name, uint16_t& elementType, size_t& elementSize)
+    {
+        if (name == DataWriterHDF5::name(Data::ListElement422()))
+        {
+            elementType = Data::List422;
+            elementSize = Data::ListElement422::size();
+            return true;
+        }
+        if (name == DataWriterHDF5::name(Data::ListElement8222()))
+        {
+            elementType = Data::List8222;
+            elementSize = Data::ListElement8222::size();
+            return true;
+        }
+        const std::string waveform = "Waveform";
+        const size_t underscore = name.find('_');
+        if (name.compare(0, waveform.size(), waveform) != 0 || underscore == std::string::npos ||
+            underscore + 1 == name.size() ||
+            name.find_first_not_of("0123456789", underscore + 1) != std::string::npos)
+            return false;
+        const std::string list = name.substr(waveform.size(), underscore - waveform.size());
+        const size_t samples = std::stoul(name.substr(underscore + 1));
+        if (list == "422")
+        {
+            elementType = Data::Waveform422;
+            elementSize = Data::WaveformElement<Data::ListElement422>::size(samples);
+            return true;
+        }
+        if (list == "8222")
+        {
+            elementType = Data::Waveform8222;
+            elementSize = Data::WaveformElement<Data::ListElement8222>::size(samples);
+            return true;
+        }
+        return false;
+    }
+
+    /* The in memory type of the elements of a table */
+    static H5::CompType datatype(const Table& table)
+    {
+        switch (table.elementType)
+        {
+            case Data::List422:
+                return Data::ListElement422::h5type();
+            case Data::List8222:
+                return Data::ListElement8222::h5type();
+            case Data::Waveform422:
+                return waveformType<Data::ListElement422>(
+                        (table.elementSize - Data::ListElement422::size() - Waveform::size(0))/sizeof(uint16_t));
+            case Data::Waveform8222:
+                return waveformType<Data::ListElement8222>(
+                        (table.elementSize - Data::ListElement8222::size() - Waveform::size(0))/sizeof(uint16_t));
+            default:
+                throw std::invalid_argument("unknown element type " + std::to_string(table.elementType));
+        }
+    }
+
+public:
+    explicit DataReaderHDF5(const std::string& filename)
+            : file(filename, H5F_ACC_RDONLY) {}
+
+    std::vector<uint32_t> digitizers() const
+    {
+        std::vector<uint32_t> result;
+        H5::Group root = file.openGroup("/");
+        for (hsize_t i = 0; i < root.getNumObjs(); ++i)
+        {
+            result.push_back((uint32_t)std::stoul(root.getObjnameByIdx(i)));
+        }
+        return result;
+    }
+
+    /* Blocks of E from digitizerID that may hold elements with time in [from, to) on the channels in channelMask */
+    template <typename E>
+    std::vector<Block> blocks(uint32_t digitizerID, uint64_t from, uint64_t to, uint64_t channelMask = allChannels) const
+    {
+        std::vector<Block> result;
+        const std::string digitizer = std::to_string(digitizerID);
+        if (!exists(file, digitizer))
+            return result;
+        H5::Group group = file.openGroup(digitizer);
+        const std::string name = DataWriterHDF5::name(E());
+        if (!exists(group, name))
+            return result;
+        std::vector<Block> all;
+        const std::string blocksName = DataWriterHDF5::blocksName(name);
+        if (exists(group, blocksName))
+        {
+            H5::DataSet dataset = group.openDataSet(blocksName);
+            all.resize(rows(dataset));
+            if (!all.empty())
+                readRows(dataset, DataWriterHDF5::blockType(), 0, all.size(), all.data());
+        } else
+        {
+            all.push_back(Block{0, elementRows(group, name, E::h5type()), 0, UINT64_MAX, allChannels});
+        }
+        for (const Block& block: all)
+        {
+            if (block.count > 0 && block.maxTime >= from && block.minTime < to && (block.channelMask & channelMask))
+                result.push_back(block);
+        }
+        return result;
+    }
+
+    /* Elements of E from digitizerID with time in [from, to) on the channels in channelMask in the order written */
+    template <typename E>
+    std::vector<E> read(uint32_t digitizerID, uint64_t from, uint64_t to, uint64_t channelMask = allChannels) const
+    {
+        std::vector<E> result;
+        std::vector<Block> matching = blocks<E>(digitizerID, from, to, channelMask);
+        if (matching.empty())
+            return result;
+        H5::Group group = file.openGroup(std::to_string(digitizerID));
+        const std::string name = DataWriterHDF5::name(E());
+        std::vector<E> elements;
+        for (size_t i = 0; i < matching.size(); )
+        {
+            /* Read adjacent blocks in one go */
+            hsize_t first = matching[i].first;
+            hsize_t n = matching[i].count;
+            for (++i; i < matching.size() && matching[i].first == first + n; ++i)
+            {
+                n += matching[i].count;
+            }
+            elements.resize(n);
+            readElements(group, name, E::h5type(), first, n, (char*)elements.data());
+            for (const E& element: elements)
+            {
+                if (element.time >= from && element.time < to && (channelBit(element.channel) & channelMask))
+                    result.push_back(element);
+            }
+        }
+        return result;
+    }
+
+    /* All element data sets in the file */
+    std::vector<Table> tables() const
+    {
+        std::vector<Table> result;
+        for (uint32_t digitizerID: digitizers())
+        {
+            H5::Group group = file.openGroup(std::to_string(digitizerID));
+            for (hsize_t i = 0; i < group.getNumObjs(); ++i)
+            {
+                Table table{digitizerID, group.getObjnameByIdx(i), Data::None, 0, 0};
+                if (endsWith(table.name, "_index") || endsWith(table.name, "_blocks") ||
+                    !parse(table.name, table.elementType, table.elementSize))
+                    continue;
+                table.rows = elementRows(group, table.name, datatype(table));
+                result.push_back(table);
+            }
+        }
+        return result;
+    }
+
+    /* The globalTime index of a table in the order written. Files without one give a single entry at globalTime 0 */
+    std::vector<IndexEntry> index(const Table& table) const
+    {
+        std::vector<IndexEntry> result;
+        H5::Group group = file.openGroup(std::to_string(table.digitizerID));
+        const std::string indexName = DataWriterHDF5::indexName(table.name);
+        if (!exists(group, indexName))
+        {
+            result.push_back(IndexEntry{0, 0, table.rows});
+            return result;
+        }
+        H5::DataSet dataset = group.openDataSet(indexName);
+        result.resize(rows(dataset));
+        if (!result.empty())
+            readRows(dataset, DataWriterHDF5::indexType(), 0, result.size(), result.data());
+        return result;
+    }
+
+    /* Rows [first, first+n) of a table as packed elements - n*table.elementSize bytes */
+    void read(const Table& table, hsize_t first, hsize_t n, char* out) const
+    {
+        if (n == 0)
+            return;
+        H5::Group group = file.openGroup(std::to_string(table.digitizerID));
+        readElements(group, table.name, datatype(table), first, n, out);
+    }
+};
+
+#endif //JADAQ_DATAREADERHDF5_HPP
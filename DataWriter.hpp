@@ -29,6 +29,7 @@
 #include <cstdint>
 #include "DataFormat.hpp"
 #include "container.hpp"
+#include "trace.hpp"
 
 class DataWriter
 {
@@ -41,9 +42,21 @@ public:
         return *this;
     }
 
+    /* Delete the writer, closing its output */
+    void close()
+    { instance.reset(); }
+
     void addDigitizer(uint32_t digitizerID)
     { instance->addDigitizer(digitizerID); }
 
+    /* Announce that digitizerID will deliver elements of elementType */
+    void addDataType(uint32_t digitizerID, uint16_t elementType, size_t elementSize)
+    { instance->addDataType(digitizerID, elementType, elementSize); }
+
+    /* Record when digitizerID started - before its first data - and when it started again after an error */
+    void setStartTime(uint32_t digitizerID, const Data::StartTime& start)
+    { instance->setStartTime(digitizerID, start); }
+
     // TODO get rid of this function
     bool network() const
     { return instance->network(); }
@@ -53,7 +66,11 @@ public:
 
     template<typename E>
     void operator()(const jadaq::buffer<E>* buffer, uint32_t digitizerID, uint64_t globalTimeStamp)
-    { instance->operator()(buffer,digitizerID,globalTimeStamp); }
+    {
+        trace::emit(trace::WriteBegin, digitizerID, E::type(), buffer->size());
+        instance->operator()(buffer,digitizerID,globalTimeStamp);
+        trace::emit(trace::WriteEnd, digitizerID, E::type(), buffer->size());
+    }
 
 
 private:
@@ -61,6 +78,8 @@ private:
     {
         virtual ~Concept() = default;
         virtual void addDigitizer(uint32_t digitizerID) = 0;
+        virtual void addDataType(uint32_t digitizerID, uint16_t elementType, size_t elementSize) = 0;
+        virtual void setStartTime(uint32_t digitizerID, const Data::StartTime& start) = 0;
         virtual bool network() const = 0;
         virtual void split(const std::string& id) = 0;
         virtual void operator()(const jadaq::buffer<Data::ListElement422>* buffer, uint32_t digitizerID, uint64_t globalTimeStamp) = 0;
@@ -75,6 +94,10 @@ private:
         ~Model() { delete val; }
         void addDigitizer(uint32_t digitizerID) override
         { val->addDigitizer(digitizerID); }
+        void addDataType(uint32_t digitizerID, uint16_t elementType, size_t elementSize) override
+        { val->addDataType(digitizerID, elementType, elementSize); }
+        void setStartTime(uint32_t digitizerID, const Data::StartTime& start) override
+        { val->setStartTime(digitizerID, start); }
         bool network() const override
         { return val->network(); }
         void split(const std::string& id) override
@@ -98,6 +121,8 @@ class DataWriterNull
 public:
     DataWriterNull() = default;
     void addDigitizer(uint32_t) {}
+    void addDataType(uint32_t, uint16_t, size_t) {}
+    void setStartTime(uint32_t, const Data::StartTime&) {}
     static bool network() { return false; }
     void split(const std::string&) { }
     template <typename E>
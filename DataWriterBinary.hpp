@@ -0,0 +1,325 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Write data to a native binary list file: a FileHeader followed by blocks,
+ * each a BlockHeader - the Data::Header of the network protocol plus the
+ * element size - and the elements exactly as they are in the jadaq::buffer.
+ * Everything is packed, so DataReaderBinary can map the file and hand out
+ * the elements where they are.
+ * The file is staged in large aligned buffers that a writer thread writes
+ * at aligned offsets, optionally with O_DIRECT to bypass the page cache.
+ *
+ */
+
+#ifndef JADAQ_DATAWRITERBINARY_HPP
+#define JADAQ_DATAWRITERBINARY_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include "DataFormat.hpp"
+#include "container.hpp"
+
+class DataWriterBinary
+{
+public:
+    static constexpr const size_t defaultBufferSize = 4<<20;
+    static constexpr const size_t alignment = 4096;  // Of buffers, writes and file offsets
+    struct Settings
+    {
+        size_t bufferSize;  // Bytes per write - a multiple of alignment
+        bool direct;        // Write with O_DIRECT, bypassing the page cache
+        Settings()
+                : bufferSize(defaultBufferSize)
+                , direct(false) {}
+    };
+    struct __attribute__ ((__packed__)) FileHeader // 64 bytes
+    {
+        char magic[8];             // "JADAQBIN"
+        uint16_t version;          // Data::currentVersion of the block headers and elements
+        uint16_t headerSize;       // sizeof(FileHeader)
+        uint16_t blockHeaderSize;  // sizeof(BlockHeader)
+        uint8_t __pad[2];
+        char id[48];               // The file id given to the writer, zero padded
+    };
+    static_assert(sizeof(FileHeader) == 64, "FileHeader must be 64 bytes");
+    struct __attribute__ ((__packed__)) BlockHeader // 40 bytes
+    {
+        Data::Header header;   // runID is 0 - the writer only knows the file id
+        uint32_t elementSize;
+        uint8_t __pad[4];
+    };
+    static_assert(sizeof(BlockHeader) == 40, "BlockHeader must be 40 bytes");
+    static constexpr const char* magic() { return "JADAQBIN"; }
+
+private:
+    static constexpr const size_t numBuffers = 4;
+    struct Buffer
+    {
+        char* data;
+        size_t used;
+        uint64_t offset;  // In the file
+        int file;
+    };
+
+    const std::string& pathname;
+    const std::string& basename;
+    const Settings settings;
+
+    std::mutex mutex;
+    std::condition_variable written;  // A buffer was written
+    std::condition_variable work;     // A buffer is full or stop
+    std::vector<Buffer> buffers;
+    std::vector<Buffer*> idle;
+    std::deque<Buffer*> full;
+    size_t writing = 0;
+    Buffer* current = nullptr;
+    int file = -1;
+    bool direct = false;
+    uint64_t fileSize = 0;
+    std::map<uint32_t, uint32_t> sequence;  // Blocks written per digitizer
+    bool stop = false;
+    std::thread writer;
+
+    static size_t alignUp(size_t n) { return (n + alignment - 1)/alignment*alignment; }
+
+    /* Called with mutex held */
+    void submit()
+    {
+        full.push_back(current);
+        work.notify_one();
+        std::unique_lock<std::mutex> lock(mutex, std::adopt_lock);
+        written.wait(lock, [this]() { return !idle.empty(); });
+        lock.release();
+        current = idle.back();
+        idle.pop_back();
+        current->used = 0;
+        current->offset = fileSize;
+        current->file = file;
+    }
+
+    void append(const void* src, size_t n)
+    {
+        const char* data = (const char*)src;
+        while (n > 0)
+        {
+            const size_t k = std::min(n, settings.bufferSize - current->used);
+            memcpy(current->data + current->used, data, k);
+            current->used += k;
+            fileSize += k;
+            data += k;
+            n -= k;
+            if (current->used == settings.bufferSize)
+            {
+                submit();
+            }
+        }
+    }
+
+    void writeLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work.wait(lock, [this]() { return stop || !full.empty(); });
+            if (full.empty())
+                return;
+            Buffer* buffer = full.front();
+            full.pop_front();
+            writing += 1;
+            lock.unlock();
+            /* O_DIRECT needs whole aligned blocks - close() cuts the file back to its real size */
+            size_t size = direct ? alignUp(buffer->used) : buffer->used;
+            if (size > buffer->used)
+            {
+                memset(buffer->data + buffer->used, 0, size - buffer->used);
+            }
+            size_t done = 0;
+            while (done < size)
+            {
+                ssize_t n = pwrite(buffer->file, buffer->data + done, size - done, buffer->offset + done);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    std::cerr << "ERROR: could not write binary data file: " << strerror(errno) << std::endl;
+                    break;
+                }
+                done += n;
+            }
+            lock.lock();
+            writing -= 1;
+            idle.push_back(buffer);
+            written.notify_all();
+        }
+    }
+
+    void open(const std::string& id)
+    {
+        std::string filename = pathname + basename + id + ".bin";
+        direct = false;
+        if (settings.direct)
+        {
+            file = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+            direct = file >= 0;
+            if (!direct && errno == EINVAL)
+            {
+                std::cerr << "WARNING: O_DIRECT is not supported for \"" << filename << "\" - using buffered writes." << std::endl;
+            }
+        }
+        if (file < 0)
+        {
+            file = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+        if (file < 0)
+        {
+            throw std::runtime_error("Could not open binary data file: \"" + filename + "\"");
+        }
+        fileSize = 0;
+        sequence.clear();
+        current->used = 0;
+        current->offset = 0;
+        current->file = file;
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = Data::currentVersion;
+        header.headerSize = sizeof(FileHeader);
+        header.blockHeaderSize = sizeof(BlockHeader);
+        strncpy(header.id, id.c_str(), sizeof(header.id) - 1);
+        append(&header, sizeof(header));
+    }
+
+    /* Called with mutex held */
+    void close()
+    {
+        if (current->used > 0)
+        {
+            submit();
+        }
+        std::unique_lock<std::mutex> lock(mutex, std::adopt_lock);
+        written.wait(lock, [this]() { return full.empty() && writing == 0; });
+        lock.release();
+        if (direct && ftruncate(file, fileSize) < 0)
+        {
+            std::cerr << "ERROR: could not truncate binary data file: " << strerror(errno) << std::endl;
+        }
+        ::close(file);
+        file = -1;
+        current->file = -1;  // Not the descriptor number, which may be reused, should open() fail
+    }
+
+public:
+    DataWriterBinary(const std::string& pathname_, const std::string& basename_, const std::string&& id,
+                     const Settings& settings_ = Settings())
+            : pathname(pathname_)
+            , basename(basename_)
+            , settings(settings_)
+            , buffers(numBuffers)
+    {
+        if (settings.bufferSize == 0 || settings.bufferSize % alignment)
+        {
+            throw std::invalid_argument("DataWriterBinary: the buffer size must be a multiple of " +
+                                        std::to_string(alignment));
+        }
+        for (Buffer& buffer: buffers)
+        {
+            if (posix_memalign((void**)&buffer.data, alignment, settings.bufferSize) != 0)
+                throw std::bad_alloc();
+            idle.push_back(&buffer);
+        }
+        current = idle.back();
+        idle.pop_back();
+        open(id);
+        writer = std::thread(&DataWriterBinary::writeLoop, this);
+    }
+
+    ~DataWriterBinary()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            close();
+            stop = true;
+        }
+        work.notify_all();
+        writer.join();
+        for (Buffer& buffer: buffers)
+        {
+            ::free(buffer.data);
+        }
+    }
+
+    void addDigitizer(uint32_t) {}
+
+    void addDataType(uint32_t, uint16_t, size_t) {}
+
+    /* The list file format has no room for it */
+    void setStartTime(uint32_t, const Data::StartTime&) {}
+
+    static bool network() { return false; }
+
+    /* The mutex is released even if the new file can not be created */
+    void split(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        close();
+        open(id);
+    }
+
+    template <typename E>
+    void operator()(const jadaq::buffer<E>* buffer, uint32_t digitizerID, uint64_t globalTimeStamp)
+    {
+        if (buffer->size() < 1)
+            return;
+        const size_t elementSize = (buffer->data_size() - buffer->header_size())/buffer->size();
+        const char* elements = buffer->data() + buffer->header_size();
+        std::lock_guard<std::mutex> lock(mutex);
+        BlockHeader block;
+        memset(&block, 0, sizeof(block));
+        block.header.globalTime = globalTimeStamp;
+        block.header.digitizerID = digitizerID;
+        block.header.elementType = E::type();
+        block.header.version = Data::currentVersion;
+        block.elementSize = (uint32_t)elementSize;
+        /* numElements is 16 bit */
+        for (size_t first = 0; first < buffer->size(); first += UINT16_MAX)
+        {
+            const size_t n = std::min(buffer->size() - first, (size_t)UINT16_MAX);
+            block.header.numElements = (uint16_t)n;
+            block.header.sequence = sequence[digitizerID]++;
+            append(&block, sizeof(block));
+            append(elements + first*elementSize, n*elementSize);
+        }
+    }
+};
+
+#endif //JADAQ_DATAWRITERBINARY_HPP
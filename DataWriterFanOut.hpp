@@ -0,0 +1,715 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Data writer that hands the same data to several writers (sinks), e.g. an
+ * HDF5 file and an online monitor over the network. Each sink runs on its
+ * own thread with a queue of reference counted buffers, so the data is
+ * copied once - out of the buffer the DataHandler reuses - and then shared
+ * by all sinks. What a sink that falls behind costs is set per sink: once
+ * its queue reaches the high-water mark it either still takes everything
+ * and blocks the acquisition when full, drops buffers, keeps only the list
+ * part of waveform buffers, or spills buffers to a scratch file that it
+ * replays when it has caught up. Whatever is not written is counted, so
+ * data loss is explicit and bounded instead of an overflow in the
+ * digitizers.
+ *
+ */
+
+#ifndef JADAQ_DATAWRITERFANOUT_HPP
+#define JADAQ_DATAWRITERFANOUT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "DataFormat.hpp"
+#include "container.hpp"
+#include "DataWriter.hpp"
+#include "trace.hpp"
+
+class DataWriterFanOut
+{
+public:
+    enum Policy
+    {
+        Block,       // Wait for room in the queue
+        Drop,        // Throw the buffer away for this sink
+        Downsample,  // Keep only the list part of waveform buffers, wait when still full
+        Spill        // Write the buffer to a scratch file and replay it when the sink has caught up
+    };
+    static constexpr const size_t defaultDepth = 64;
+
+    static Policy policy(const std::string& name)
+    {
+        if (name == "block")
+            return Block;
+        if (name == "drop")
+            return Drop;
+        if (name == "downsample")
+            return Downsample;
+        if (name == "spill")
+            return Spill;
+        throw std::invalid_argument("Unknown sink policy: \"" + name + "\" [block,drop,downsample,spill]");
+    }
+
+    struct Settings
+    {
+        Policy policy = Block;
+        size_t depth = defaultDepth;    // Buffers queued at most
+        float highWater = 0.75f;        // Part of depth where the policy takes over
+        std::string scratch = "/tmp";   // Directory of the spill file
+        uint64_t spillLimit = 4096;     // MB spilled at most - dropped beyond that
+    };
+
+    /* What a sink did with the buffers it was given */
+    struct Stats
+    {
+        uint64_t buffers = 0;
+        uint64_t elements = 0;
+        uint64_t highWater = 0;        // Times the queue reached the high-water mark
+        uint64_t dropped = 0;
+        uint64_t droppedElements = 0;
+        uint64_t downsampled = 0;      // Waveform buffers written as list data only
+        uint64_t spilled = 0;
+        uint64_t spilledBytes = 0;
+        uint64_t replayed = 0;
+        uint64_t lost = 0;             // Spilled buffers that could not be read back
+    };
+
+private:
+    struct Item
+    {
+        enum Kind { Digitizer, DataType, Start, Split, Elements } kind;
+        uint32_t digitizerID;
+        uint16_t elementType;
+        uint64_t value;                       // globalTimeStamp or elementSize
+        std::shared_ptr<const void> buffer;   // jadaq::buffer<E> of elementType
+        std::string id;
+        Data::StartTime start;
+        size_t elements;                      // In buffer
+    };
+
+    /* An item in a spill file, followed by length bytes: the buffer, the split id or the start time */
+    struct SpillRecord
+    {
+        uint32_t kind;
+        uint32_t digitizerID;
+        uint64_t value;
+        uint64_t elementSize;
+        uint64_t headerSize;
+        uint64_t capacity;
+        uint64_t length;
+        uint16_t elementType;
+    };
+
+    static void writeAll(int fd, const void* data, size_t size, uint64_t offset)
+    {
+        const char* from = (const char*)data;
+        while (size > 0)
+        {
+            ssize_t n = pwrite(fd, from, size, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error(std::string("write failed: ") + (n < 0 ? strerror(errno) : "no space"));
+            from += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    static void readAll(int fd, void* data, size_t size, uint64_t offset)
+    {
+        char* to = (char*)data;
+        while (size > 0)
+        {
+            ssize_t n = pread(fd, to, size, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error(std::string("read failed: ") + (n < 0 ? strerror(errno) : "truncated"));
+            to += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    template <typename E>
+    static const char* layout(const Item& item, SpillRecord& record)
+    {
+        const jadaq::buffer<E>* buffer = static_cast<const jadaq::buffer<E>*>(item.buffer.get());
+        record.elementSize = (buffer->data_size() - buffer->header_size())/buffer->size();
+        record.headerSize = buffer->header_size();
+        record.capacity = buffer->data_capacity();
+        record.length = buffer->data_size();
+        return buffer->data();
+    }
+
+    template <typename E>
+    static std::shared_ptr<const void> load(const SpillRecord& record, int fd, uint64_t offset)
+    {
+        std::shared_ptr<jadaq::buffer<E> > buffer(
+                new jadaq::buffer<E>(record.capacity, record.elementSize, record.headerSize));
+        readAll(fd, buffer->data(), record.length, offset);
+        buffer->setElements((record.length - record.headerSize)/record.elementSize);
+        return buffer;
+    }
+
+    /* The list part of a waveform buffer */
+    template <typename L>
+    static std::shared_ptr<const void> listOf(const Item& item)
+    {
+        typedef Data::WaveformElement<L> W;
+        const jadaq::buffer<W>* from = static_cast<const jadaq::buffer<W>*>(item.buffer.get());
+        std::shared_ptr<jadaq::buffer<L> > to(
+                new jadaq::buffer<L>(from->header_size() + from->size()*L::size(), L::size(), from->header_size()));
+        for (const W& element: *from)
+            to->push_back(element.listElement);
+        return to;
+    }
+
+    struct Sink
+    {
+        std::string name;
+        DataWriter writer;
+        Settings settings;
+        size_t highWater;               // Queued buffers where the policy takes over
+        std::mutex mutex;
+        std::condition_variable work;   // An item was queued or spilled, or stop
+        std::condition_variable space;  // An item was taken
+        std::deque<Item> queue;
+        bool stop = false;
+        bool failed = false;
+        bool high = false;              // The queue is at the high-water mark
+        Stats stats;
+        /* Once something is spilled everything is, until the sink has read it all back, to keep the order */
+        int spillFD = -1;
+        uint64_t spillRead = 0;
+        uint64_t spillWrite = 0;
+        bool spillFailed = false;
+        std::thread thread;
+
+        bool spilled() const { return spillRead < spillWrite; }
+
+        template <typename E>
+        void write(const Item& item)
+        {
+            writer(static_cast<const jadaq::buffer<E>*>(item.buffer.get()), item.digitizerID, item.value);
+        }
+
+        void process(const Item& item)
+        {
+            switch (item.kind)
+            {
+                case Item::Digitizer:
+                    writer.addDigitizer(item.digitizerID);
+                    break;
+                case Item::DataType:
+                    writer.addDataType(item.digitizerID, item.elementType, item.value);
+                    /* Announce the list data up front - no data sets can be added later in HDF5 SWMR mode */
+                    if (settings.policy == Downsample && (item.elementType & Data::WaveformBase))
+                    {
+                        const uint16_t list = item.elementType & ~Data::WaveformBase;
+                        writer.addDataType(item.digitizerID, list, list == Data::List422 ?
+                                           Data::ListElement422::size() : Data::ListElement8222::size());
+                    }
+                    break;
+                case Item::Start:
+                    writer.setStartTime(item.digitizerID, item.start);
+                    break;
+                case Item::Split:
+                    writer.split(item.id);
+                    break;
+                case Item::Elements:
+                    switch (item.elementType)
+                    {
+                        case Data::List422:
+                            write<Data::ListElement422>(item);
+                            break;
+                        case Data::List8222:
+                            write<Data::ListElement8222>(item);
+                            break;
+                        case Data::Waveform422:
+                            write<Data::WaveformElement<Data::ListElement422> >(item);
+                            break;
+                        case Data::Waveform8222:
+                            write<Data::WaveformElement<Data::ListElement8222> >(item);
+                            break;
+                    }
+                    break;
+            }
+        }
+
+        /* Take the oldest spilled item. Read without the lock - items are only appended meanwhile */
+        bool unspill(std::unique_lock<std::mutex>& lock, Item& item)
+        {
+            const int fd = spillFD;
+            const uint64_t offset = spillRead;
+            SpillRecord record;
+            std::string error;
+            lock.unlock();
+            try {
+                readAll(fd, &record, sizeof(record), offset);
+                const uint64_t data = offset + sizeof(record);
+                item.kind = (Item::Kind)record.kind;
+                item.digitizerID = record.digitizerID;
+                item.elementType = record.elementType;
+                item.value = record.value;
+                switch (item.kind)
+                {
+                    case Item::Split:
+                        item.id.resize(record.length);
+                        readAll(fd, &item.id[0], record.length, data);
+                        break;
+                    case Item::Start:
+                        readAll(fd, &item.start, sizeof(item.start), data);
+                        break;
+                    case Item::Elements:
+                        switch (item.elementType)
+                        {
+                            case Data::List422:
+                                item.buffer = load<Data::ListElement422>(record, fd, data);
+                                break;
+                            case Data::List8222:
+                                item.buffer = load<Data::ListElement8222>(record, fd, data);
+                                break;
+                            case Data::Waveform422:
+                                item.buffer = load<Data::WaveformElement<Data::ListElement422> >(record, fd, data);
+                                break;
+                            case Data::Waveform8222:
+                                item.buffer = load<Data::WaveformElement<Data::ListElement8222> >(record, fd, data);
+                                break;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            } catch (std::exception& e) {
+                error = e.what();
+            }
+            lock.lock();
+            if (!error.empty())
+            {
+                std::cerr << "ERROR: " << name << " output lost the rest of its spill file: " << error << std::endl;
+                stats.lost += stats.spilled - stats.replayed;
+                spillRead = spillWrite;
+                spillFailed = true;
+            }
+            else
+            {
+                spillRead = offset + sizeof(record) + record.length;
+                if (item.kind == Item::Elements)
+                    stats.replayed += 1;
+            }
+            if (spillRead == spillWrite)
+            {
+                spillRead = spillWrite = 0;
+                if (ftruncate(spillFD, 0) < 0)
+                    std::cerr << "WARNING: " << name << " output could not truncate its spill file" << std::endl;
+            }
+            return error.empty();
+        }
+
+        void loop()
+        {
+            trace::name(name + " output");
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                work.wait(lock, [this]() { return stop || !queue.empty() || spilled(); });
+                Item item;
+                if (!queue.empty())
+                {
+                    item = std::move(queue.front());
+                    queue.pop_front();
+                    space.notify_all();
+                }
+                else if (!spilled())
+                    return;
+                else if (!unspill(lock, item))
+                    continue;
+                if (failed)
+                    continue;
+                lock.unlock();
+                try {
+                    process(item);
+                } catch (std::exception& e) {
+                    std::cerr << "ERROR: " << name << " output failed and is disabled: " << e.what() << std::endl;
+                    lock.lock();
+                    failed = true;
+                    continue;
+                }
+                /* Release the buffer before taking the lock */
+                item.buffer.reset();
+                lock.lock();
+            }
+        }
+
+        void drop(const Item& item)
+        {
+            trace::emit(trace::Drop, item.digitizerID, item.elementType, item.elements);
+            stats.dropped += 1;
+            stats.droppedElements += item.elements;
+        }
+
+        void downsample(Item& item)
+        {
+            switch (item.elementType)
+            {
+                case Data::Waveform422:
+                    item.buffer = listOf<Data::ListElement422>(item);
+                    break;
+                case Data::Waveform8222:
+                    item.buffer = listOf<Data::ListElement8222>(item);
+                    break;
+                default:
+                    return;
+            }
+            item.elementType &= ~Data::WaveformBase;
+            stats.downsampled += 1;
+        }
+
+        /* Append to the spill file, which is opened - and unlinked - on first use. Only buffers count
+         * against the limit, so the control items keep their place */
+        bool spill(const Item& item)
+        {
+            if (spillFailed)
+                return false;
+            SpillRecord record{(uint32_t)item.kind, item.digitizerID, item.value, 0, 0, 0, 0, item.elementType};
+            const void* data = nullptr;
+            switch (item.kind)
+            {
+                case Item::Split:
+                    data = item.id.data();
+                    record.length = item.id.size();
+                    break;
+                case Item::Start:
+                    data = &item.start;
+                    record.length = sizeof(item.start);
+                    break;
+                case Item::Elements:
+                    switch (item.elementType)
+                    {
+                        case Data::List422:
+                            data = layout<Data::ListElement422>(item, record);
+                            break;
+                        case Data::List8222:
+                            data = layout<Data::ListElement8222>(item, record);
+                            break;
+                        case Data::Waveform422:
+                            data = layout<Data::WaveformElement<Data::ListElement422> >(item, record);
+                            break;
+                        case Data::Waveform8222:
+                            data = layout<Data::WaveformElement<Data::ListElement8222> >(item, record);
+                            break;
+                    }
+                    if (spillWrite + sizeof(record) + record.length > settings.spillLimit<<20)
+                        return false;
+                    break;
+                default:
+                    break;
+            }
+            try {
+                if (spillFD < 0)
+                {
+                    std::string path = settings.scratch + "/jadaq-spill-XXXXXX";
+                    spillFD = mkstemp(&path[0]);
+                    if (spillFD < 0)
+                        throw std::runtime_error("could not create " + path + ": " + strerror(errno));
+                    unlink(path.c_str());
+                }
+                writeAll(spillFD, &record, sizeof(record), spillWrite);
+                writeAll(spillFD, data, record.length, spillWrite + sizeof(record));
+            } catch (std::runtime_error& e) {
+                std::cerr << "ERROR: " << name << " output can not spill any more: " << e.what() << std::endl;
+                spillFailed = true;
+                return false;
+            }
+            spillWrite += sizeof(record) + record.length;
+            if (item.kind == Item::Elements)
+            {
+                stats.spilled += 1;
+                stats.spilledBytes += record.length;
+            }
+            work.notify_one();
+            return true;
+        }
+
+        /* Control items are never dropped */
+        void push(Item&& item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (item.kind != Item::Elements)
+            {
+                if (!spilled() || !spill(item))
+                {
+                    queue.push_back(std::move(item));
+                    work.notify_one();
+                }
+                return;
+            }
+            stats.buffers += 1;
+            stats.elements += item.elements;
+            if (failed)
+            {
+                drop(item);
+                return;
+            }
+            if (queue.size() >= highWater && !high)
+                stats.highWater += 1;
+            high = queue.size() >= highWater;
+            if (high || spilled())
+            {
+                switch (settings.policy)
+                {
+                    case Block:
+                        break;
+                    case Drop:
+                        drop(item);
+                        return;
+                    case Downsample:
+                        downsample(item);
+                        break;
+                    case Spill:
+                        if (!spill(item))
+                            drop(item);
+                        return;
+                }
+            }
+            if (queue.size() >= settings.depth)
+            {
+                trace::emit(trace::BlockBegin, item.digitizerID, item.elementType, item.elements);
+                space.wait(lock, [this]() { return queue.size() < settings.depth; });
+                trace::emit(trace::BlockEnd, item.digitizerID, item.elementType, item.elements);
+            }
+            queue.push_back(std::move(item));
+            work.notify_one();
+        }
+
+        ~Sink()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            work.notify_one();
+            if (thread.joinable())
+                thread.join();
+            if (spillFD >= 0)
+                ::close(spillFD);
+            if (stats.dropped > 0)
+            {
+                std::cerr << "WARNING: " << name << " output dropped " << stats.dropped << " of " << stats.buffers <<
+                          " buffers (" << stats.droppedElements << " of " << stats.elements << " events)." << std::endl;
+            }
+            if (stats.downsampled > 0)
+            {
+                std::cerr << "WARNING: " << name << " output kept only the list data of " << stats.downsampled <<
+                          " waveform buffers." << std::endl;
+            }
+            if (stats.spilled > 0)
+            {
+                std::cerr << "WARNING: " << name << " output spilled " << stats.spilled << " buffers (" <<
+                          (stats.spilledBytes>>20) << " MB) to scratch";
+                if (stats.lost > 0)
+                    std::cerr << " and lost " << stats.lost << " of them";
+                std::cerr << "." << std::endl;
+            }
+        }
+    };
+
+    /* Copies of the DataHandler buffers shared by the sinks - recycled by element type and size */
+    template <typename E>
+    class Pool
+    {
+    private:
+        struct Entry
+        {
+            size_t elementSize;
+            jadaq::buffer<E>* buffer;
+        };
+        std::mutex mutex;
+        std::vector<Entry> free;
+        void release(size_t elementSize, jadaq::buffer<E>* buffer)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free.push_back(Entry{elementSize, buffer});
+        }
+    public:
+        ~Pool()
+        {
+            for (Entry& entry: free)
+                delete entry.buffer;
+        }
+        std::shared_ptr<const void> copy(const jadaq::buffer<E>* from)
+        {
+            const size_t elementSize = (from->data_size() - from->header_size())/from->size();
+            jadaq::buffer<E>* buffer = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto it = free.rbegin(); it != free.rend(); ++it)
+                {
+                    if (it->elementSize == elementSize && it->buffer->data_capacity() == from->data_capacity() &&
+                        it->buffer->header_size() == from->header_size())
+                    {
+                        buffer = it->buffer;
+                        free.erase(std::next(it).base());
+                        break;
+                    }
+                }
+            }
+            if (buffer == nullptr)
+            {
+                buffer = new jadaq::buffer<E>(from->data_capacity(), elementSize, from->header_size());
+            }
+            buffer->copy(*from);
+            return std::shared_ptr<const void>(buffer, [this, elementSize](const void* p)
+            { release(elementSize, (jadaq::buffer<E>*)p); });
+        }
+    };
+
+    /* Declared before the sinks so they outlive the buffers still queued */
+    Pool<Data::ListElement422> list422;
+    Pool<Data::ListElement8222> list8222;
+    Pool<Data::WaveformElement<Data::ListElement422> > waveform422;
+    Pool<Data::WaveformElement<Data::ListElement8222> > waveform8222;
+    std::vector<std::unique_ptr<Sink> > sinks;
+    bool networkSink = false;
+
+    Pool<Data::ListElement422>& pool(const jadaq::buffer<Data::ListElement422>*) { return list422; }
+    Pool<Data::ListElement8222>& pool(const jadaq::buffer<Data::ListElement8222>*) { return list8222; }
+    Pool<Data::WaveformElement<Data::ListElement422> >& pool(const jadaq::buffer<Data::WaveformElement<Data::ListElement422> >*)
+    { return waveform422; }
+    Pool<Data::WaveformElement<Data::ListElement8222> >& pool(const jadaq::buffer<Data::WaveformElement<Data::ListElement8222> >*)
+    { return waveform8222; }
+
+    void push(const Item& item)
+    {
+        for (std::unique_ptr<Sink>& sink: sinks)
+        {
+            Item copy = item;
+            sink->push(std::move(copy));
+        }
+    }
+
+public:
+    DataWriterFanOut() = default;
+
+    ~DataWriterFanOut()
+    {
+        /* Drain and join the sinks before the pools go */
+        sinks.clear();
+    }
+
+    /* Add a sink - takes ownership of dataWriter. Add all sinks before the first data arrives */
+    template <typename DW>
+    void add(const std::string& name, DW* dataWriter, const Settings& settings)
+    {
+        if (dataWriter->network())
+        {
+            /* A network writer fills in the header of the shared buffer */
+            if (networkSink)
+            {
+                delete dataWriter;
+                throw std::invalid_argument("DataWriterFanOut: only one network output is supported");
+            }
+            networkSink = true;
+        }
+        sinks.emplace_back(new Sink());
+        Sink& sink = *sinks.back();
+        sink.name = name;
+        sink.writer = dataWriter;
+        sink.settings = settings;
+        sink.settings.depth = std::max(settings.depth, (size_t)1);
+        sink.highWater = std::min(std::max((size_t)std::ceil(settings.highWater*sink.settings.depth), (size_t)1),
+                                  sink.settings.depth);
+        sink.thread = std::thread(&Sink::loop, &sink);
+    }
+
+    /* A line per sink, for the periodic statistics */
+    void printStats(std::ostream& os)
+    {
+        os << std::setw(15) << "OUTPUT" << std::setw(12) << "Buffers" << std::setw(12) << "Queued" <<
+           std::setw(12) << "HighWater" << std::setw(12) << "Dropped" << std::setw(12) << "Downsampled" <<
+           std::setw(12) << "Spilled" << std::setw(12) << "Replayed" << std::endl;
+        for (std::unique_ptr<Sink>& sink: sinks)
+        {
+            std::lock_guard<std::mutex> lock(sink->mutex);
+            const Stats& stats = sink->stats;
+            os << std::setw(15) << sink->name << std::setw(12) << stats.buffers << std::setw(12) <<
+               sink->queue.size() << std::setw(12) << stats.highWater << std::setw(12) << stats.dropped <<
+               std::setw(12) << stats.downsampled << std::setw(12) << stats.spilled << std::setw(12) <<
+               stats.replayed << std::endl;
+        }
+        os << std::endl;
+    }
+
+    void addDigitizer(uint32_t digitizerID)
+    {
+        Item item{Item::Digitizer, digitizerID, 0, 0, nullptr, ""};
+        push(item);
+    }
+
+    void addDataType(uint32_t digitizerID, uint16_t elementType, size_t elementSize)
+    {
+        Item item{Item::DataType, digitizerID, elementType, elementSize, nullptr, ""};
+        push(item);
+    }
+
+    void setStartTime(uint32_t digitizerID, const Data::StartTime& start)
+    {
+        Item item{Item::Start, digitizerID, 0, 0, nullptr, "", start};
+        push(item);
+    }
+
+    /* The DataHandler leaves room for the network header if any sink needs it */
+    bool network() const { return networkSink; }
+
+    void split(const std::string& id)
+    {
+        Item item{Item::Split, 0, 0, 0, nullptr, id};
+        push(item);
+    }
+
+    template <typename E>
+    void operator()(const jadaq::buffer<E>* buffer, uint32_t digitizerID, uint64_t globalTimeStamp)
+    {
+        if (buffer->size() < 1)
+            return;
+        Item item{Item::Elements, digitizerID, E::type(), globalTimeStamp, pool(buffer).copy(buffer), "",
+                  Data::StartTime(), buffer->size()};
+        push(item);
+    }
+};
+
+#endif //JADAQ_DATAWRITERFANOUT_HPP
@@ -18,7 +18,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  * @section DESCRIPTION
- * Write data to HDF5 file
+ * Write data to HDF5 file - the file layout is described in README.md.
+ * Data is staged in memory and written a whole chunk at a time, compressed
+ * in parallel by a ChunkCompressor when enabled. In SWMR mode a flush thread
+ * makes the staged data visible to readers every flushInterval seconds.
+ * Files are split on request or by size or event count, with the next file
+ * opened ahead by a file thread, which also closes the old one. File space
+ * and cache properties come from Settings::tuning, the HDF5 defaults unless
+ * a profile is chosen.
  *
  */
 
@@ -29,63 +36,588 @@
 #include <mutex>
 #include <map>
 #include <vector>
+#include <memory>
 #include <set>
+#include <tuple>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
 #include <cassert>
+#include <sys/stat.h>
 #include <H5Cpp.h>
-#include <H5PacketTable.h>
 #include "DataFormat.hpp"
 #include "container.hpp"
+#include "ChunkCompressor.hpp"
+#include "trace.hpp"
 
 class DataWriterHDF5
 {
+public:
+    static constexpr const size_t defaultChunkSize = 1<<20; // Bytes per chunk
+    static constexpr const size_t indexChunk = 4096;        // Index entries per chunk
+    /* File space and cache properties of the files written */
+    struct Tuning
+    {
+        bool latestFormat;      // Latest file format - needs HDF5 1.10 or newer to read
+        hsize_t pageSize;       // File space page size for paged aggregation, 0 for the HDF5 default strategy
+        size_t pageBuffer;      // Page buffer bytes with paged aggregation, 0 for none - not used with SWMR
+        size_t metadataCache;   // Initial and maximum metadata cache bytes, 0 for the HDF5 default
+        hsize_t alignment;      // Align objects of alignThreshold bytes or more - 0 for the file system block size, 1 for none
+        hsize_t alignThreshold;
+        size_t chunkCache;      // Raw data chunk cache bytes per data set, 0 for the HDF5 default of 1 MB
+        /* The HDF5 defaults */
+        Tuning()
+                : latestFormat(false)
+                , pageSize(0)
+                , pageBuffer(0)
+                , metadataCache(0)
+                , alignment(1)
+                , alignThreshold(1)
+                , chunkCache(0) {}
+        /* For high rate writing. Data is written a whole chunk at a time, so the chunk cache is kept smaller
+         * than a chunk: the chunks go straight to the file instead of through the cache, which would copy
+         * them and flush them all on close. The page buffer costs more than it saves on a local disk, so it is
+         * left for parallel file systems where small metadata writes are expensive */
+        static Tuning throughput()
+        {
+            Tuning tuning;
+            tuning.latestFormat = true;
+            tuning.pageSize = 64<<10;
+            tuning.metadataCache = 32<<20;
+            tuning.alignment = 0;
+            tuning.alignThreshold = 64<<10;
+            tuning.chunkCache = 64<<10;
+            return tuning;
+        }
+        static Tuning profile(const std::string& name)
+        {
+            if (name == "default")
+                return Tuning();
+            if (name == "throughput")
+                return throughput();
+            throw std::invalid_argument("Unknown HDF5 profile: " + name);
+        }
+    };
+    struct Settings
+    {
+        ChunkCompressor::Settings compression;
+        Tuning tuning;
+        bool columnar;
+        size_t chunkSize;
+        bool swmr;
+        float flushInterval;  // Seconds between SWMR flushes, 0 if the owner calls flush()
+        uint64_t splitBytes;  // Start a new file after this much element data, 0 for no limit
+        uint64_t splitEvents; // Start a new file after this many events, 0 for no limit
+        bool preopen;         // Open the next file ahead of time - set it when splitting in any way
+        std::function<std::string()> nextFileID; // ID of the next file when splitting by bytes or events
+        /* Not default member initializers - Settings() is a default argument inside DataWriterHDF5 */
+        Settings()
+                : columnar(false)
+                , chunkSize(defaultChunkSize)
+                , swmr(false)
+                , flushInterval(1.0f)
+                , splitBytes(0)
+                , splitEvents(0)
+                , preopen(false) {}
+    };
+    struct __attribute__ ((__packed__)) IndexEntry
+    {
+        uint64_t globalTime;
+        uint64_t first;
+        uint64_t count;
+    };
+    static_assert(std::is_pod<IndexEntry>::value, "IndexEntry must be POD");
+    static H5::CompType indexType()
+    {
+        H5::CompType datatype(sizeof(IndexEntry));
+        datatype.insertMember("globalTime", HOFFSET(IndexEntry, globalTime), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("first", HOFFSET(IndexEntry, first), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("count", HOFFSET(IndexEntry, count), H5::PredType::NATIVE_UINT64);
+        return datatype;
+    }
+    static H5::CompType startType()
+    {
+        H5::CompType datatype(sizeof(Data::StartTime));
+        datatype.insertMember("issued", HOFFSET(Data::StartTime, issued), H5::PredType::NATIVE_INT64);
+        datatype.insertMember("offset", HOFFSET(Data::StartTime, offset), H5::PredType::NATIVE_INT64);
+        datatype.insertMember("epoch", HOFFSET(Data::StartTime, epoch), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("window", HOFFSET(Data::StartTime, window), H5::PredType::NATIVE_UINT32);
+        datatype.insertMember("mode", HOFFSET(Data::StartTime, mode), H5::PredType::NATIVE_UINT8);
+        return datatype;
+    }
+    struct __attribute__ ((__packed__)) BlockEntry
+    {
+        uint64_t first;        // Row of the first element
+        uint64_t count;
+        uint64_t minTime;      // Element time
+        uint64_t maxTime;
+        uint64_t channelMask;  // See channelBit
+    };
+    static_assert(std::is_pod<BlockEntry>::value, "BlockEntry must be POD");
+    static H5::CompType blockType()
+    {
+        H5::CompType datatype(sizeof(BlockEntry));
+        datatype.insertMember("first", HOFFSET(BlockEntry, first), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("count", HOFFSET(BlockEntry, count), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("minTime", HOFFSET(BlockEntry, minTime), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("maxTime", HOFFSET(BlockEntry, maxTime), H5::PredType::NATIVE_UINT64);
+        datatype.insertMember("channelMask", HOFFSET(BlockEntry, channelMask), H5::PredType::NATIVE_UINT64);
+        return datatype;
+    }
+    /* Channels above 63 share the top bit */
+    static uint64_t channelBit(uint16_t channel) { return (uint64_t)1 << std::min(channel, (uint16_t)63); }
+
+    /* Data set names */
+    static std::string name(const Data::ListElement422&) { return "List422"; }
+    static std::string name(const Data::ListElement8222&) { return "List8222"; }
+    template <typename L>
+    static std::string name(const Data::WaveformElement<L>& element)
+    { return "Waveform" + name(element.listElement).substr(4) + "_" + std::to_string(element.waveform.num_samples); }
+    static std::string indexName(const std::string& name) { return name + "_index"; }
+    static std::string blocksName(const std::string& name) { return name + "_blocks"; }
+
 private:
-    struct DigitizerInfo
+    static uint64_t time(const Data::ListElement422& element) { return element.time; }
+    static uint64_t time(const Data::ListElement8222& element) { return element.time; }
+    template <typename L>
+    static uint64_t time(const Data::WaveformElement<L>& element) { return time(element.listElement); }
+    static uint16_t channel(const Data::ListElement422& element) { return element.channel; }
+    static uint16_t channel(const Data::ListElement8222& element) { return element.channel; }
+    template <typename L>
+    static uint16_t channel(const Data::WaveformElement<L>& element) { return channel(element.listElement); }
+
+    /* Write n elements to dataset from element first, extending it as needed - it never shrinks */
+    static void writeAt(H5::DataSet& dataset, const H5::DataType& datatype, hsize_t first, hsize_t n, const void* data)
     {
-        FL_PacketTable* previous = nullptr;
-        FL_PacketTable* current = nullptr;
-        H5::Group* group = nullptr;
-        uint64_t currentTimeStamp = 0;
-        FL_PacketTable*& getTable(uint64_t timeStamp)
-        {
-            if (timeStamp == currentTimeStamp)
-                return current;
-            else if(timeStamp < currentTimeStamp)
-                return previous;
-            else {
-                if (previous)
-                    delete(previous);
-                previous = current;
-                currentTimeStamp = timeStamp;
-                current = nullptr;
-                return current;
+        H5::DataSpace fileSpace = dataset.getSpace();
+        hsize_t size = 0;
+        fileSpace.getSimpleExtentDims(&size);
+        if (first + n > size)
+        {
+            size = first + n;
+            dataset.extend(&size);
+            fileSpace = dataset.getSpace();
+        }
+        fileSpace.selectHyperslab(H5S_SELECT_SET, &n, &first);
+        H5::DataSpace memSpace(1, &n);
+        dataset.write(data, datatype, memSpace, fileSpace);
+    }
+
+    /* An extensible data set with the elements we have not written yet */
+    struct Table
+    {
+        H5::DataSet dataset;
+        H5::DataType datatype;
+        size_t elementSize;
+        hsize_t written = 0;       // Elements written to file
+        std::vector<char> staged;  // Elements not yet written
+        size_t stagedElements() const { return staged.size()/elementSize; }
+        hsize_t size() const { return written + stagedElements(); }
+        /* Write the first n staged elements */
+        void write(hsize_t n)
+        {
+            if (n == 0)
+                return;
+            writeAt(dataset, datatype, written, n, staged.data());
+            staged.erase(staged.begin(), staged.begin() + n*elementSize);
+            written += n;
+        }
+        /* Write the staged elements without consuming them, so readers can see them. They are written again later */
+        void publish()
+        {
+            if (!staged.empty())
+                writeAt(dataset, datatype, written, stagedElements(), staged.data());
+        }
+        /* Stage a single entry - written every indexChunk entries */
+        void append(const void* entry)
+        {
+            if (stagedElements() >= indexChunk)
+            {
+                write(stagedElements());
+            }
+            const char* e = (const char*)entry;
+            staged.insert(staged.end(), e, e + elementSize);
+        }
+    };
+    /* One field of the elements in the columnar layout */
+    struct Column
+    {
+        H5::DataSet dataset;
+        H5::DataType datatype;
+        size_t offset;  // Of the field in the element
+        size_t size;
+        /* Copy the field out of n elements */
+        void gather(const char* elements, size_t n, size_t elementSize, char* out) const
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                memcpy(out + i*size, elements + i*elementSize + offset, size);
+            }
+        }
+    };
+    struct DataTable
+    {
+        Table data;
+        Table index;
+        Table blocks;
+        BlockEntry block{0, 0, 0, 0, 0}; // The block being filled
+        hsize_t chunk; // Elements per chunk in data and per block
+        std::vector<Column> columns; // Columnar layout if not empty - data.dataset is not used then
+        IndexEntry* lastEntry()
+        {
+            if (index.staged.empty())
+                return nullptr;
+            return (IndexEntry*)(index.staged.data() + index.staged.size() - sizeof(IndexEntry));
+        }
+        void addToBlock(uint64_t time, uint16_t channel)
+        {
+            if (block.count == 0)
+            {
+                block.minTime = block.maxTime = time;
+                block.channelMask = 0;
+            }
+            block.minTime = std::min(block.minTime, time);
+            block.maxTime = std::max(block.maxTime, time);
+            block.channelMask |= channelBit(channel);
+            if (++block.count == chunk)
+            {
+                finishBlock();
             }
         }
+        void finishBlock()
+        {
+            if (block.count == 0)
+                return;
+            blocks.append(&block);
+            block.first += block.count;
+            block.count = 0;
+        }
+    };
+    struct DigitizerInfo
+    {
+        H5::Group group;
+        Table starts;  // SWMR mode only - created with the group, elementSize 0 otherwise
+        /* Keyed by element type and size - waveforms with different lengths go in different data sets */
+        std::map<std::pair<uint16_t, size_t>, DataTable> tables;
+    };
+    struct File
+    {
+        std::string filename;
+        H5::H5File* h5 = nullptr;
+        std::map<uint32_t, DigitizerInfo> digitizerInfo;
+        bool swmrStarted = false;
+        uint64_t bytes = 0;   // Element data written
+        uint64_t events = 0;
     };
+    typedef std::tuple<uint32_t, uint16_t, size_t> DataType; // digitizerID, element type and size
+
     const std::string& pathname;
     const std::string& basename;
+    const Settings settings;
 
-    H5::H5File* file = nullptr;
-    H5::Group* root = nullptr;
     std::mutex mutex;
-    std::map<uint32_t, DigitizerInfo> digitizerInfo;
+    std::unique_ptr<ChunkCompressor> compressor;
+    std::unique_ptr<File> file;  // Where data goes now
+    std::unique_ptr<File> next;  // Opened ahead of time when splitting
+    std::deque<std::unique_ptr<File> > retired; // To be closed by the file thread
+    std::set<DataType> dataTypes;  // Announced with addDataType
+    std::set<DataType> rejected;   // Seen after SWMR writing started
+    std::map<uint32_t, std::vector<Data::StartTime> > startTimes;  // By digitizerID, for every file of the run
+    bool stop = false;
+    std::condition_variable flusherWake;
+    std::thread flusher;
+    std::condition_variable filesWake;
+    std::thread files;
 
-    DigitizerInfo& getDigitizerInfo(uint32_t digitizerID)
+    /* The HDF5 library is not thread safe, so all writers and their compressors share a lock */
+    static std::mutex& hdf5Mutex()
     {
-        auto itr = digitizerInfo.find(digitizerID);
-        if (itr != digitizerInfo.end())
+        static std::mutex hdf5;
+        return hdf5;
+    }
+
+    std::string filename(const std::string& id) const { return pathname + basename + id + ".h5"; }
+
+    DigitizerInfo& getDigitizerInfo(File& f, uint32_t digitizerID)
+    {
+        auto itr = f.digitizerInfo.find(digitizerID);
+        if (itr != f.digitizerInfo.end())
         {
             return itr->second;
         } else {
-            DigitizerInfo info;
-            info.group = new H5::Group(file->createGroup(std::to_string(digitizerID)));
-            digitizerInfo[digitizerID] = info;
-            return digitizerInfo[digitizerID];
+            DigitizerInfo& info = f.digitizerInfo[digitizerID];
+            info.group = f.h5->createGroup(std::to_string(digitizerID));
+            if (settings.swmr)
+            {
+                info.starts.datatype = startType();
+                info.starts.elementSize = sizeof(Data::StartTime);
+                info.starts.dataset = createDataSet(info.group, "starts", info.starts.datatype, indexChunk);
+            }
+            return info;
+        }
+    }
+
+    H5::DataSet createDataSet(H5::Group& group, const std::string& name, const H5::DataType& datatype, hsize_t chunk,
+                              bool compressed = false, bool shuffle = false)
+    {
+        try {
+            hsize_t size = 0;
+            hsize_t maxSize = H5S_UNLIMITED;
+            H5::DataSpace space(1, &size, &maxSize);
+            H5::DSetCreatPropList properties;
+            properties.setChunk(1, &chunk);
+            if (compressed)
+            {
+                ChunkCompressor::setFilter(properties, settings.compression.filter, settings.compression.level, shuffle);
+            }
+            return group.createDataSet(name, datatype, space, properties);
+        } catch (H5::Exception& e)
+        {
+            std::cerr << "ERROR: DataWriterHDF5 can not create data set \"" << name << "\": " << e.getDetailMsg() <<
+                      std::endl;
+            throw;
+        }
+    }
+
+    template <typename E>
+    DataTable& getTable(DigitizerInfo& info, const E& element, size_t elementSize)
+    {
+        std::pair<uint16_t, size_t> key(E::type(), elementSize);
+        auto itr = info.tables.find(key);
+        if (itr != info.tables.end())
+        {
+            return itr->second;
+        }
+        DataTable& table = info.tables[key];
+        std::string dataName = name(element);
+        table.chunk = std::max((size_t)1, settings.chunkSize/elementSize);
+        table.data.datatype = element.h5type();
+        table.data.elementSize = elementSize;
+        if (settings.columnar && !(E::type() & Data::WaveformBase))
+        {
+            H5::Group group = info.group.createGroup(dataName);
+            H5::CompType datatype = element.h5type();
+            for (int i = 0; i < datatype.getNmembers(); ++i)
+            {
+                Column column;
+                column.datatype = datatype.getMemberDataType(i);
+                column.offset = datatype.getMemberOffset(i);
+                column.size = column.datatype.getSize();
+                column.dataset = createDataSet(group, datatype.getMemberName(i), column.datatype, table.chunk,
+                                               compressor != nullptr, true);
+                table.columns.push_back(column);
+            }
+        } else
+        {
+            table.data.dataset = createDataSet(info.group, dataName, table.data.datatype, table.chunk, compressor != nullptr);
+        }
+        table.data.staged.reserve(table.chunk*elementSize);
+        table.index.datatype = indexType();
+        table.index.elementSize = sizeof(IndexEntry);
+        table.index.dataset = createDataSet(info.group, indexName(dataName), table.index.datatype, indexChunk);
+        table.blocks.datatype = blockType();
+        table.blocks.elementSize = sizeof(BlockEntry);
+        table.blocks.dataset = createDataSet(info.group, blocksName(dataName), table.blocks.datatype, indexChunk);
+        return table;
+    }
+
+    template <typename L>
+    static Data::WaveformElement<L> waveformElement(size_t elementSize)
+    {
+        Data::WaveformElement<L> element;
+        element.waveform.num_samples = (elementSize - L::size() - Waveform::size(0))/sizeof(uint16_t);
+        return element;
+    }
+
+    void createTable(File& f, const DataType& dataType)
+    {
+        DigitizerInfo& info = getDigitizerInfo(f, std::get<0>(dataType));
+        const size_t elementSize = std::get<2>(dataType);
+        switch (std::get<1>(dataType))
+        {
+            case Data::List422:
+                getTable(info, Data::ListElement422(), elementSize);
+                break;
+            case Data::List8222:
+                getTable(info, Data::ListElement8222(), elementSize);
+                break;
+            case Data::Waveform422:
+                getTable(info, waveformElement<Data::ListElement422>(elementSize), elementSize);
+                break;
+            case Data::Waveform8222:
+                getTable(info, waveformElement<Data::ListElement8222>(elementSize), elementSize);
+                break;
+            default:
+                std::cerr << "ERROR: DataWriterHDF5 unknown element type " << std::get<1>(dataType) << std::endl;
+        }
+    }
+
+    /* No data sets can be added once SWMR writing has started */
+    bool reject(const DataType& dataType)
+    {
+        if (!file->swmrStarted)
+            return false;
+        auto itr = file->digitizerInfo.find(std::get<0>(dataType));
+        if (itr != file->digitizerInfo.end() &&
+            itr->second.tables.count(std::make_pair(std::get<1>(dataType), std::get<2>(dataType))))
+            return false;
+        if (rejected.insert(dataType).second)
+        {
+            std::cerr << "ERROR: DataWriterHDF5 can not add data sets in SWMR mode - dropping element type " <<
+                      std::get<1>(dataType) << " from digitizer " << std::get<0>(dataType) << std::endl;
+        }
+        return true;
+    }
+
+    /* Write the first n staged data elements */
+    void writeData(DataTable& table, hsize_t n)
+    {
+        Table& data = table.data;
+        if (table.columns.empty() || n == 0)
+        {
+            data.write(n);
+            return;
+        }
+        std::vector<char> values;
+        for (Column& column: table.columns)
+        {
+            values.resize(n*column.size);
+            column.gather(data.staged.data(), n, data.elementSize, values.data());
+            writeAt(column.dataset, column.datatype, data.written, n, values.data());
+        }
+        data.staged.erase(data.staged.begin(), data.staged.begin() + n*data.elementSize);
+        data.written += n;
+    }
+
+    /* Compress and write n elements as the chunk starting at element offset - padded if it is not full */
+    void submitChunk(DataTable& table, const char* elements, hsize_t n, hsize_t offset)
+    {
+        const size_t elementSize = table.data.elementSize;
+        if (table.columns.empty())
+        {
+            std::vector<char> chunk(table.chunk*elementSize, 0);
+            memcpy(chunk.data(), elements, n*elementSize);
+            compressor->submit(table.data.dataset.getId(), offset, offset + n, std::move(chunk));
+        } else
+        {
+            for (const Column& column: table.columns)
+            {
+                std::vector<char> chunk(table.chunk*column.size, 0);
+                column.gather(elements, n, elementSize, chunk.data());
+                compressor->submit(column.dataset.getId(), offset, offset + n, std::move(chunk), column.size);
+            }
+        }
+    }
+
+    /* Hand whole chunks of staged data to the compressor - and the last partial one if final */
+    void compressChunks(DataTable& table, bool final)
+    {
+        Table& data = table.data;
+        const size_t chunkBytes = table.chunk*data.elementSize;
+        size_t used = 0;
+        while (data.staged.size() - used >= chunkBytes || (final && data.staged.size() > used))
+        {
+            size_t n = std::min(chunkBytes, data.staged.size() - used)/data.elementSize;
+            submitChunk(table, data.staged.data() + used, n, data.written);
+            data.written += n;
+            used += n*data.elementSize;
+        }
+        data.staged.erase(data.staged.begin(), data.staged.begin() + used);
+    }
+
+    /* Make everything staged in the current file visible to SWMR readers without consuming it */
+    void publish()
+    {
+        if (compressor)
+        {
+            for (auto &itr: file->digitizerInfo)
+            {
+                for (auto& t: itr.second.tables)
+                {
+                    DataTable& table = t.second;
+                    if (table.data.stagedElements() > 0)
+                        submitChunk(table, table.data.staged.data(), table.data.stagedElements(), table.data.written);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+        for (auto &itr: file->digitizerInfo)
+        {
+            for (auto& t: itr.second.tables)
+            {
+                DataTable& table = t.second;
+                const hsize_t n = table.data.stagedElements();
+                if (!compressor && n > 0)
+                {
+                    if (table.columns.empty())
+                    {
+                        table.data.publish();
+                    } else
+                    {
+                        std::vector<char> values;
+                        for (Column& column: table.columns)
+                        {
+                            values.resize(n*column.size);
+                            column.gather(table.data.staged.data(), n, table.data.elementSize, values.data());
+                            writeAt(column.dataset, column.datatype, table.data.written, n, values.data());
+                        }
+                    }
+                }
+                table.index.publish();
+                /* Include the block being filled */
+                const char* block = (const char*)&table.block;
+                if (table.block.count > 0)
+                    table.blocks.staged.insert(table.blocks.staged.end(), block, block + sizeof(BlockEntry));
+                table.blocks.publish();
+                if (table.block.count > 0)
+                    table.blocks.staged.resize(table.blocks.staged.size() - sizeof(BlockEntry));
+                if (table.columns.empty())
+                {
+                    H5Dflush(table.data.dataset.getId());
+                }
+                for (Column& column: table.columns)
+                {
+                    H5Dflush(column.dataset.getId());
+                }
+                H5Dflush(table.index.dataset.getId());
+                H5Dflush(table.blocks.dataset.getId());
+            }
         }
     }
-    void writeAttribute(std::string name, H5::DataSet& dataset, const H5::PredType& type, const void* data) const
+
+    void flushLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        const auto interval = std::chrono::duration<float>(settings.flushInterval);
+        while (!stop)
+        {
+            flusherWake.wait_for(lock, interval);
+            if (stop || !file->swmrStarted)
+                continue;
+            try {
+                publish();
+            } catch (H5::Exception& e)
+            {
+                std::cerr << "ERROR: DataWriterHDF5 SWMR flush failed: " << e.getDetailMsg() << std::endl;
+            }
+        }
+    }
+
+    /* A scalar, or an array with count entries if count > 0 */
+    void writeAttribute(std::string name, H5::H5Object& object, const H5::PredType& type, const void* data,
+                        hsize_t count = 0) const
     {
         try {
-            H5::Attribute a = dataset.createAttribute(name, type, H5::DataSpace(H5S_SCALAR));
+            if (object.attrExists(name))
+                object.removeAttr(name);
+            H5::Attribute a = object.createAttribute(name, type, count > 0 ? H5::DataSpace(1, &count) :
+                                                                 H5::DataSpace(H5S_SCALAR));
             a.write(type,data);
             a.close();
         } catch (H5::Exception& e)
@@ -95,72 +627,355 @@ private:
         }
     }
 
-    void open(const std::string& id)
+    /* Attributes of the digitizer group, and the starts data set in SWMR mode - called with the HDF5 lock.
+     * Once SWMR writing started only the data set can take new entries
+     */
+    void writeStartTimes(File& f, uint32_t digitizerID, const std::vector<Data::StartTime>& starts)
     {
-        std::string filename = pathname + basename + id + ".h5";
+        if (starts.empty())
+            return;
+        if (f.swmrStarted)
+        {
+            auto itr = f.digitizerInfo.find(digitizerID);
+            if (itr == f.digitizerInfo.end() || itr->second.starts.elementSize == 0)
+            {
+                std::cerr << "WARNING: DataWriterHDF5 can not record start " << starts.size() << " of digitizer " <<
+                          digitizerID << " (epoch " << starts.back().epoch << ") in " << f.filename <<
+                          " - SWMR writing has started" << std::endl;
+                return;
+            }
+            Table& table = itr->second.starts;
+            writeAt(table.dataset, table.datatype, 0, starts.size(), starts.data());
+            H5Dflush(table.dataset.getId());
+            return;
+        }
+        DigitizerInfo& info = getDigitizerInfo(f, digitizerID);
+        if (info.starts.elementSize > 0)
+        {
+            writeAt(info.starts.dataset, info.starts.datatype, 0, starts.size(), starts.data());
+        }
+        H5::Group& group = info.group;
+        std::vector<int64_t> issued, offset;
+        std::vector<uint64_t> epoch;
+        std::vector<uint32_t> window;
+        std::vector<uint8_t> mode;
+        for (const Data::StartTime& start: starts)
+        {
+            issued.push_back(start.issued);
+            offset.push_back(start.offset);
+            epoch.push_back(start.epoch);
+            window.push_back(start.window);
+            mode.push_back(start.mode);
+        }
+        const hsize_t count = starts.size();
+        writeAttribute("startIssued", group, H5::PredType::NATIVE_INT64, issued.data(), count);
+        writeAttribute("startOffset", group, H5::PredType::NATIVE_INT64, offset.data(), count);
+        writeAttribute("startEpoch", group, H5::PredType::NATIVE_UINT64, epoch.data(), count);
+        writeAttribute("startWindow", group, H5::PredType::NATIVE_UINT32, window.data(), count);
+        writeAttribute("startMode", group, H5::PredType::NATIVE_UINT8, mode.data(), count);
+    }
+
+    /* Block size of the file system we write to - the stripe size on parallel file systems */
+    hsize_t blockSize() const
+    {
+        struct stat st;
+        if (stat(pathname.empty() ? "." : pathname.c_str(), &st) == 0 && st.st_blksize > 0)
+            return st.st_blksize;
+        return 1;
+    }
+
+    void tune(H5::FileCreatPropList& create, H5::FileAccPropList& access) const
+    {
+        const Tuning& tuning = settings.tuning;
+        if (settings.swmr || tuning.latestFormat)
+        {
+            access.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+        }
+        if (tuning.pageSize > 0)
+        {
+            H5Pset_file_space_strategy(create.getId(), H5F_FSPACE_STRATEGY_PAGE, false, 1);
+            H5Pset_file_space_page_size(create.getId(), tuning.pageSize);
+            /* HDF5 does not support the page buffer with SWMR */
+            if (tuning.pageBuffer > 0 && !settings.swmr)
+            {
+                H5Pset_page_buffer_size(access.getId(), std::max<size_t>(tuning.pageBuffer, tuning.pageSize), 0, 0);
+            }
+        }
+        if (tuning.metadataCache > 0)
+        {
+            H5AC_cache_config_t config;
+            config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+            H5Pget_mdc_config(access.getId(), &config);
+            config.set_initial_size = true;
+            config.initial_size = tuning.metadataCache;
+            config.max_size = std::max(config.max_size, tuning.metadataCache);
+            config.min_size = std::min(config.min_size, tuning.metadataCache);
+            H5Pset_mdc_config(access.getId(), &config);
+        }
+        const hsize_t alignment = tuning.alignment > 0 ? tuning.alignment : blockSize();
+        if (alignment > 1)
+        {
+            access.setAlignment(tuning.alignThreshold, alignment);
+        }
+        if (tuning.chunkCache > 0)
+        {
+            /* Fully written chunks go first */
+            access.setCache(0, 521, tuning.chunkCache, 1.0);
+        }
+    }
+
+    /* Create a file with the data sets for types and the start times - takes the HDF5 lock */
+    std::unique_ptr<File> open(const std::string& filename, const std::set<DataType>& types,
+                               const std::map<uint32_t, std::vector<Data::StartTime> >& starts)
+    {
+        std::unique_ptr<File> f(new File);
+        f->filename = filename;
+        std::lock_guard<std::mutex> hdf5(hdf5Mutex());
         try
         {
-            assert(file == nullptr);
-            file = new H5::H5File(filename, H5F_ACC_TRUNC);
-            assert(root == nullptr);
-            root = new H5::Group(file->openGroup("/"));
+            H5::FileCreatPropList create;
+            H5::FileAccPropList access;
+            tune(create, access);
+            f->h5 = new H5::H5File(filename, H5F_ACC_TRUNC, create, access);
+            for (const DataType& dataType: types)
+            {
+                createTable(*f, dataType);
+            }
+            for (const auto& start: starts)
+            {
+                writeStartTimes(*f, start.first, start.second);
+            }
         } catch (H5::Exception& e)
         {
             std::cerr << "ERROR: could not open/create HDF5-file \"" << filename <<  "\":" << e.getDetailMsg() << std::endl;
             throw;
         }
+        return f;
+    }
+
+    /* Write everything staged and close the file - must not hold the HDF5 lock */
+    void close(File& f)
+    {
+        assert(f.h5);
+        if (compressor)
+        {
+            for (auto &itr: f.digitizerInfo)
+            {
+                for (auto& t: itr.second.tables)
+                {
+                    compressChunks(t.second, true);
+                }
+            }
+            compressor->flush();
+        }
+        std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+        for (auto &itr: f.digitizerInfo)
+        {
+            for (auto& t: itr.second.tables)
+            {
+                DataTable& table = t.second;
+                writeData(table, table.data.stagedElements());
+                table.index.write(table.index.stagedElements());
+                table.finishBlock();
+                table.blocks.write(table.blocks.stagedElements());
+            }
+        }
+        f.digitizerInfo.clear();
+        f.h5->close();
+        delete f.h5;
+        f.h5 = nullptr;
     }
 
-    void close()
+    /* Switch to the next file - called with mutex held. Closing the old file and opening the one after
+     * is left to the file thread, so this is a pointer swap and a rename when the next file is ready */
+    void rotate(const std::string& id)
     {
-        assert(file);
-        for (auto &itr: digitizerInfo)
+        std::unique_ptr<File> old = std::move(file);
+        if (next)
+        {
+            file = std::move(next);
+            const std::string name = filename(id);
+            if (std::rename(file->filename.c_str(), name.c_str()) == 0)
+            {
+                file->filename = name;
+            } else
+            {
+                std::cerr << "ERROR: could not rename \"" << file->filename << "\" to \"" << name << "\": " <<
+                          strerror(errno) << std::endl;
+            }
+        } else
         {
-            if (itr.second.current)
-                delete itr.second.current;
-            if (itr.second.previous)
-                delete itr.second.previous;
-            if (itr.second.group)
-                delete itr.second.group;
+            file = open(filename(id), dataTypes, startTimes);
+        }
+        retired.push_back(std::move(old));
+        filesWake.notify_all();
+    }
+
+    bool full() const
+    {
+        return (settings.splitBytes > 0 && file->bytes >= settings.splitBytes) ||
+               (settings.splitEvents > 0 && file->events >= settings.splitEvents);
+    }
+
+    /* Close retired files and open the next one ahead of time */
+    void fileLoop()
+    {
+        trace::name("HDF5 files");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            filesWake.wait(lock, [this]() { return stop || !retired.empty() || (settings.preopen && !next); });
+            try {
+                if (!retired.empty())
+                {
+                    std::unique_ptr<File> old = std::move(retired.front());
+                    retired.pop_front();
+                    lock.unlock();
+                    close(*old);
+                    lock.lock();
+                } else if (stop)
+                {
+                    break;
+                } else
+                {
+                    const std::string name = file->filename + ".next";
+                    std::set<DataType> types = dataTypes;
+                    std::map<uint32_t, std::vector<Data::StartTime> > starts = startTimes;
+                    lock.unlock();
+                    std::unique_ptr<File> f = open(name, types, starts);
+                    lock.lock();
+                    /* Types and starts announced while we were busy */
+                    std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+                    for (const DataType& dataType: dataTypes)
+                    {
+                        createTable(*f, dataType);
+                    }
+                    for (const auto& start: startTimes)
+                    {
+                        writeStartTimes(*f, start.first, start.second);
+                    }
+                    next = std::move(f);
+                }
+            } catch (H5::Exception& e)
+            {
+                std::cerr << "ERROR: DataWriterHDF5 file thread: " << e.getDetailMsg() << std::endl;
+                if (!lock.owns_lock())
+                    lock.lock();
+                if (settings.preopen && !next && !stop)
+                    filesWake.wait_for(lock, std::chrono::seconds(1)); // Do not spin on a broken file system
+            }
         }
-        digitizerInfo.clear();
-        root->close();
-        delete root;
-        root = nullptr;
-        file->close();
-        delete file;
-        file = nullptr;
     }
 
 public:
 
-    DataWriterHDF5(const std::string& pathname_, const std::string& basename_, const std::string&& id)
+    DataWriterHDF5(const std::string& pathname_, const std::string& basename_, const std::string&& id,
+                   const Settings& settings_ = Settings())
             : pathname(pathname_)
             , basename(basename_)
+            , settings(settings_)
     {
-        open(id);
+        if ((settings.splitBytes > 0 || settings.splitEvents > 0) && !settings.nextFileID)
+        {
+            throw std::invalid_argument("DataWriterHDF5: splitting by size or events needs Settings::nextFileID");
+        }
+        if (settings.compression.filter != ChunkCompressor::None)
+        {
+            compressor.reset(new ChunkCompressor(settings.compression, hdf5Mutex()));
+        }
+        file = open(filename(id), dataTypes, startTimes);
+        files = std::thread(&DataWriterHDF5::fileLoop, this);
+        if (settings.swmr && settings.flushInterval > 0.0f)
+        {
+            flusher = std::thread(&DataWriterHDF5::flushLoop, this);
+        }
     }
 
 
     ~DataWriterHDF5()
     {
         mutex.lock(); // Wait if someone is still writing data
-        close();
+        stop = true;
+        mutex.unlock();
+        flusherWake.notify_all();
+        filesWake.notify_all();
+        if (flusher.joinable())
+        {
+            flusher.join();
+        }
+        files.join();
+        mutex.lock();
+        close(*file);
+        if (next)
+        {
+            close(*next);
+            std::remove(next->filename.c_str());
+        }
         mutex.unlock();
     }
 
+    /* Make the data written so far visible to SWMR readers */
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stop || !settings.swmr || !file->swmrStarted)
+            return;
+        try {
+            publish();
+        } catch (H5::Exception& e)
+        {
+            std::cerr << "ERROR: DataWriterHDF5 SWMR flush failed: " << e.getDetailMsg() << std::endl;
+        }
+    }
+
     void split(const std::string& id)
     {
         mutex.lock();
-        close();
-        open(id);
+        rotate(id);
+        mutex.unlock();
+    }
+
+    void addDataType(uint32_t digitizerID, uint16_t elementType, size_t elementSize)
+    {
+        mutex.lock();
+        DataType dataType(digitizerID, elementType, elementSize);
+        dataTypes.insert(dataType);
+        if (!reject(dataType))
+        {
+            std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+            createTable(*file, dataType);
+            if (next)
+                createTable(*next, dataType);
+        }
         mutex.unlock();
     }
 
     void addDigitizer(uint32_t digitizerID)
     {
         mutex.lock();
-        getDigitizerInfo(digitizerID);
+        if (!file->swmrStarted || file->digitizerInfo.count(digitizerID))
+        {
+            std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+            getDigitizerInfo(*file, digitizerID);
+        }
+        mutex.unlock();
+    }
+
+    void setStartTime(uint32_t digitizerID, const Data::StartTime& start)
+    {
+        mutex.lock();
+        std::vector<Data::StartTime>& starts = startTimes[digitizerID];
+        starts.push_back(start);
+        try {
+            std::lock_guard<std::mutex> hdf5(hdf5Mutex());
+            writeStartTimes(*file, digitizerID, starts);
+            if (next)
+                writeStartTimes(*next, digitizerID, starts);
+        } catch (H5::Exception& e)
+        {
+            std::cerr << "ERROR: DataWriterHDF5 can not record the start of digitizer " << digitizerID << ": " <<
+                      e.getDetailMsg() << std::endl;
+        }
         mutex.unlock();
     }
 
@@ -171,20 +986,60 @@ public:
     {
         if (buffer->size() < 1)
             return;
+        const size_t elementSize = (buffer->data_size() - buffer->header_size())/buffer->size();
         mutex.lock();
-        DigitizerInfo& info = getDigitizerInfo(digitizerID);
-        FL_PacketTable*& table = info.getTable(globalTimeStamp);
-        if (table == nullptr)
+        if (reject(DataType(digitizerID, E::type(), elementSize)))
         {
-            table = new FL_PacketTable(info.group->getId(), std::to_string(globalTimeStamp).c_str(),
-            buffer->begin()->h5type().getId(),buffer->size()); // TODO find a suitable chunk size - last argument
+            mutex.unlock();
+            return;
         }
-        if (table->AppendPackets(buffer->size(),(void*)buffer->data())) // Fuck this is the worst interface ever!
+        try {
+            std::unique_lock<std::mutex> hdf5(hdf5Mutex());
+            if (settings.swmr && !file->swmrStarted)
+            {
+                if (H5Fstart_swmr_write(file->h5->getId()) < 0)
+                    std::cerr << "ERROR: DataWriterHDF5 could not start SWMR writing" << std::endl;
+                file->swmrStarted = true;
+            }
+            DigitizerInfo& info = getDigitizerInfo(*file, digitizerID);
+            DataTable& table = getTable(info, *buffer->begin(), elementSize);
+            /* Extend the last index entry if this continues it */
+            IndexEntry* last = table.lastEntry();
+            if (last && last->globalTime == globalTimeStamp && last->first + last->count == table.data.size())
+            {
+                last->count += buffer->size();
+            } else
+            {
+                IndexEntry entry{globalTimeStamp, table.data.size(), buffer->size()};
+                table.index.append(&entry);
+            }
+            for (const E& element: *buffer)
+            {
+                table.addToBlock(time(element), channel(element));
+            }
+            const char* elements = buffer->data() + buffer->header_size();
+            table.data.staged.insert(table.data.staged.end(), elements, elements + buffer->size()*elementSize);
+            file->bytes += buffer->size()*elementSize;
+            file->events += buffer->size();
+            if (compressor)
+            {
+                hdf5.unlock(); // The compressor needs it to write
+                compressChunks(table, false);
+            } else
+            {
+                size_t chunks = table.data.stagedElements()/table.chunk;
+                writeData(table, chunks*table.chunk);
+                hdf5.unlock();
+            }
+            if (full())
+            {
+                rotate(settings.nextFileID());
+            }
+        } catch (H5::Exception& e)
         {
-            std::cerr << "Error while writing to HDF5 file: " <<
+            std::cerr << "Error while writing to HDF5 file: " << e.getDetailMsg() <<
                       "\n\t " << "HDF5::write( " << digitizerID << ", " << globalTimeStamp <<
                       ", " << buffer->size() << " )" << std::endl;
-
         }
         mutex.unlock();
     }
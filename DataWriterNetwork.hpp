@@ -30,6 +30,7 @@
 #include <boost/asio.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/bind.hpp>
+#include <map>
 #include "DataFormat.hpp"
 #include "container.hpp"
 
@@ -42,6 +43,7 @@ private:
     boost::asio::io_service ioService;
     udp::endpoint remoteEndpoint;
     udp::socket *socket = nullptr;
+    std::map<uint32_t, uint32_t> sequence; // Next package sequence number for each digitizer
 
 public:
     DataWriterNetwork(const std::string& address, const std::string& port, uint64_t runID_)
@@ -63,11 +65,18 @@ public:
 
     void addDigitizer(uint32_t digitizerID)
     {
+        /* Keep counting if it is added again, or the receiver would throw away the rest as expired */
+        sequence.emplace(digitizerID, 0);
         // TODO: This is where we will send the configuration over TCP
     }
 
     static bool network() { return true; }
 
+    void addDataType(uint32_t, uint16_t, size_t) {}
+
+    /* Not part of the network protocol */
+    void setStartTime(uint32_t, const Data::StartTime&) {}
+
     void split(const std::string&) {}
 
     template <typename E>
@@ -80,6 +89,7 @@ public:
         header->version = Data::currentVersion;
         header->elementType = E::type();
         header->numElements = (uint16_t)buffer->size();
+        header->sequence = sequence[digitizerID]++;
         socket->send_to(boost::asio::buffer(buffer->data(), buffer->data_size()), remoteEndpoint);
     }
 };
@@ -19,43 +19,117 @@
  *
  * @section DESCRIPTION
  * Write data to plain text file
+ * Elements are formatted with formatOn into a preallocated buffer, which
+ * is written with a single write() per call. The text is the same as the
+ * elements' printOn gives.
  *
  */
 
 #ifndef JADAQ_DATAHANDLERTEXT_HPP
 #define JADAQ_DATAHANDLERTEXT_HPP
 
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
 #include <iomanip>
 #include <mutex>
+#include <vector>
 #include <cassert>
 #include "DataFormat.hpp"
+#include "TextFormat.hpp"
 #include "container.hpp"
 
 class DataWriterText
 {
 private:
+    static constexpr const size_t bufferSize = 4<<20;
+
     const std::string& pathname;
     const std::string& basename;
 
-    std::fstream* file = nullptr;
+    int file = -1;
+    std::vector<char> text;
+    char* next = nullptr;   // End of the text in the buffer
     std::mutex mutex;
 
+    /* Room for the line of any element: no field takes more than three characters per byte plus a separator */
+    static size_t maxLineSize(size_t elementSize) { return 4*elementSize + 64; }
+
+    void reserve(size_t size)
+    {
+        if ((size_t)(text.data() + text.size() - next) < size)
+        {
+            flush();
+            if (text.size() < size)
+            {
+                text.resize(size);
+                next = text.data();
+            }
+        }
+    }
+
+    void append(const std::string& s)
+    {
+        reserve(s.size());
+        memcpy(next, s.data(), s.size());
+        next += s.size();
+    }
+
+    void flush()
+    {
+        const char* data = text.data();
+        while (data < next)
+        {
+            ssize_t n = ::write(file, data, next - data);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << "ERROR: could not write text data file: " << strerror(errno) << std::endl;
+                break;
+            }
+            data += n;
+        }
+        next = text.data();
+    }
+
     void open(const std::string& id)
     {
         std::string filename = pathname + basename + id + ".txt";
-        file = new std::fstream(filename,std::fstream::out);
-        if (!file->is_open())
+        file = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (file < 0)
         {
             throw std::runtime_error("Could not open text data file: \"" + filename + "\"");
         }
-        *file << "# runID: " << id << std::endl;
+        append("# runID: " + id + "\n");
+        flush();
     }
 
     void close()
     {
-        assert(file);
-        file->close();
+        assert(file >= 0);
+        flush();
+        ::close(file);
+        file = -1;
+    }
+
+    /* The column heading line for E */
+    template <typename E>
+    static const std::string& header()
+    {
+        static const std::string header = []() -> std::string
+        {
+            const uint32_t digitizer = 0;
+            std::ostringstream os;
+            os << "#" << PRINTH(digitizer) << " ";
+            E::headerOn(os);
+            os << "\n";
+            return os.str();
+        }();
+        return header;
     }
 
 public:
@@ -63,6 +137,8 @@ public:
     DataWriterText(const std::string& pathname_, const std::string& basename_, const std::string&& id)
             : pathname(pathname_)
             , basename(basename_)
+            , text(bufferSize)
+            , next(text.data())
     {
         open(id);
     }
@@ -78,7 +154,21 @@ public:
     void addDigitizer(uint32_t digitizerID)
     {
         mutex.lock();
-        *file << "# digitizerID: " << digitizerID << std::endl;
+        append("# digitizerID: " + std::to_string(digitizerID) + "\n");
+        flush();
+        mutex.unlock();
+    }
+
+    void addDataType(uint32_t, uint16_t, size_t) {}
+
+    void setStartTime(uint32_t digitizerID, const Data::StartTime& start)
+    {
+        mutex.lock();
+        append("# digitizerID: " + std::to_string(digitizerID) + " started: " + std::to_string(start.issued) +
+               " offset: " + std::to_string(start.offset) + " epoch: " + std::to_string(start.epoch) +
+               " window: " + std::to_string(start.window) +
+               " mode: " + std::to_string(start.mode) + "\n");
+        flush();
         mutex.unlock();
     }
 
@@ -96,13 +186,32 @@ public:
     void operator()(const jadaq::buffer<E>* buffer, uint32_t digitizer, uint64_t globalTimeStamp)
     {
         mutex.lock();
-        *file << "#" << PRINTH(digitizer) << " ";
-        E::headerOn(*file);
-        *file << std::endl << "@" << globalTimeStamp << std::endl;
+        append(header<E>());
+        reserve(32);
+        *next++ = '@';
+        next = jadaq::formatDecimal(next, globalTimeStamp, 0);
+        *next++ = '\n';
+        const size_t lineSize = maxLineSize((buffer->data_size() - buffer->header_size())/std::max(buffer->size(), (size_t)1));
+        /* A local end pointer, as the compiler must assume writes through char* can change next */
+        char* out = next;
+        char* end = text.data() + text.size();
         for(const E& element: *buffer)
         {
-            *file << " " << PRINTD(digitizer) << " " << element << "\n";
+            if ((size_t)(end - out) < lineSize)
+            {
+                next = out;
+                reserve(lineSize);
+                out = next;
+                end = text.data() + text.size();
+            }
+            *out++ = ' ';
+            out = FORMATD(out, digitizer);
+            *out++ = ' ';
+            out = element.formatOn(out);
+            *out++ = '\n';
         }
+        next = out;
+        flush();
         mutex.unlock();
     }
 };
@@ -30,6 +30,10 @@
 #include <chrono>
 #include <thread>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <cstdio>
 
 
 #define MAX_GROUPS 8
@@ -271,6 +275,8 @@ std::string Digitizer::get(FunctionID functionID)
 
 void Digitizer::set(FunctionID functionID, int index, std::string value)
 {
+    digitizer->clearRegisterCache();
+    releaseReadoutBuffer();
     try
     {
         backOffRepeat<void>([this,&functionID,&index,&value](){ return set_(digitizer,functionID,index,value); });
@@ -284,11 +290,137 @@ void Digitizer::set(FunctionID functionID, int index, std::string value)
     {
         manipulatedRegisters.insert(index);
     }
+    shadow[std::make_pair(functionID, registerIndex(functionID, index))] = value;
+    if (broadcast(functionID))
+    {
+        shadow.erase(std::make_pair(functionID, -1));
+    }
 }
 
 void Digitizer::set(FunctionID functionID, std::string value)
 {
-        backOffRepeat<void>([this, &functionID, &value]() { return set_(digitizer, functionID, value); });
+    digitizer->clearRegisterCache();
+    releaseReadoutBuffer();
+    backOffRepeat<void>([this, &functionID, &value]() { return set_(digitizer, functionID, value); });
+    shadow[std::make_pair(functionID, -1)] = value;
+    if (broadcast(functionID))
+    {
+        for (int group = 0; group < (int)groups(); ++group)
+        {
+            shadow[std::make_pair(functionID, group)] = value;
+        }
+    }
+}
+
+int Digitizer::registerIndex(FunctionID functionID, int index) const
+{
+    /* The QDC firmware has one aggregate size for the board - the channel is ignored */
+    if ((int)firmware == CAEN_DGTZ_DPPFirmware_QDC && functionID == NumEventsPerAggregate)
+        return -1;
+    return index;
+}
+
+bool Digitizer::broadcast(FunctionID functionID) const
+{
+    if ((int)firmware != CAEN_DGTZ_DPPFirmware_QDC)
+        return false;
+    switch (functionID)
+    {
+        case DPPGateWidth:
+        case DPPGateOffset:
+        case DPPFixedBaseline:
+        case DPPAlgorithmControl:
+        case DPPTriggerHoldOffWidth:
+        case DPPShapedTriggerWidth:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Digitizer::applied(FunctionID functionID, const std::string& value) const
+{
+    auto it = shadow.find(std::make_pair(functionID, -1));
+    return it != shadow.end() && it->second == value;
+}
+
+bool Digitizer::applied(FunctionID functionID, int index, const std::string& value) const
+{
+    auto it = shadow.find(std::make_pair(functionID, registerIndex(functionID, index)));
+    return it != shadow.end() && it->second == value;
+}
+
+/* File format: "token <n>" followed by "<setting> <index> <value>" lines */
+bool Digitizer::loadShadow(const std::string& filename)
+{
+    shadow.clear();
+    std::ifstream file(filename);
+    if (!file.good())
+        return false;
+    std::string key;
+    uint32_t token = 0;
+    file >> key >> token;
+    if (key != "token" || token == 0 || digitizer->getScratch() != token)
+        return false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string name;
+        int index;
+        if (!(fields >> name >> index))
+            continue;
+        std::string value;
+        std::getline(fields >> std::ws, value);
+        try {
+            shadow[std::make_pair(functionID(name), index)] = value;
+        } catch (std::invalid_argument&)
+        {
+            shadow.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Digitizer::saveShadow(const std::string& filename)
+{
+    static std::random_device random;
+    uint32_t token;
+    do {
+        token = random();
+    } while (token == 0);
+    const std::string tmp = filename + ".tmp";
+    {
+        std::ofstream file(tmp);
+        file << "token " << token << std::endl;
+        for (const auto& entry: shadow)
+        {
+            file << to_string(entry.first.first) << " " << entry.first.second << " " << entry.second << std::endl;
+        }
+        if (!file.good())
+        {
+            std::cerr << "WARNING: could not save register shadow " << filename << std::endl;
+            return;
+        }
+    }
+    digitizer->setScratch(token);
+    if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "WARNING: could not save register shadow " << filename << std::endl;
+    }
+}
+
+void Digitizer::invalidateShadow()
+{
+    digitizer->setScratch(0);
+}
+
+void Digitizer::prefetchRegisters()
+{
+    std::vector<uint32_t> registers = digitizer->getterRegisters();
+    registers.insert(registers.end(), manipulatedRegisters.begin(), manipulatedRegisters.end());
+    digitizer->prefetchRegisters(registers);
 }
 
 Digitizer::Digitizer(CAEN_DGTZ_ConnectionType linkType_, int linkNum_, int conetNode_, uint32_t VMEBaseAddress_)
@@ -302,14 +434,71 @@ Digitizer::Digitizer(CAEN_DGTZ_ConnectionType linkType_, int linkNum_, int conet
     id = digitizer->serialNumber();
 }
 
-void Digitizer::initialize(DataWriter& dataWriter)
+void Digitizer::prepare()
 {
-    boardConfiguration = digitizer->getBoardConfiguration();
-    DEBUG(std::cout << "Prepare readout buffer for digitizer " << name() << std::endl;)
+    if (readoutBuffer.data != nullptr)
+        return;
     readoutBuffer = digitizer->mallocReadoutBuffer();
     uint32_t groups = this->groups();
+    delete[] acqWindowSize;
     acqWindowSize = new uint32_t[groups];
+    if ((int)firmware != CAEN_DGTZ_DPPFirmware_QDC)
+        return; // initialize tells what is not supported
+    prefetchRegisters();
+    try {
+        boardConfiguration = digitizer->getBoardConfiguration();
+        caen::Digitizer740DPP::BoardConfiguration bc{boardConfiguration};
+        extras = bc.extras();
+        waveforms = bc.waveform() ? digitizer->getRecordLength(0) : 0;
+        for (uint32_t i = 0; i < groups; ++i)
+        {
+            acqWindowSize[i] = std::max({digitizer->getRecordLength(i)*bc.waveform(),
+                                         digitizer->getDPPPreTriggerSize(i) + digitizer->getDPPTriggerHoldOffWidth(i),
+                                         digitizer->getDPPGateWidth(i) - digitizer->getDPPGateOffset(i)+ digitizer->getDPPPreTriggerSize(i)
+                                        }) * 2; // Lets be conservative :P
+        }
+    } catch (...) {
+        clearRegisterCache();
+        releaseReadoutBuffer();
+        throw;
+    }
+    clearRegisterCache();
+}
+
+void Digitizer::initialize(DataWriter& dataWriter)
+{
+    stats = Stats();
+    /* Only here - a digitizer resumed after a recovery is still known to the writers */
     dataWriter.addDigitizer(serial());
+    handleData(dataWriter, 0);
+}
+
+void Digitizer::reopen()
+{
+    /* The old handle may be useless - let go of what it holds without asking the board */
+    dataHandler.release();
+    if (readoutBuffer.data != nullptr)
+    {
+        try {
+            digitizer->freeReadoutBuffer(readoutBuffer);
+        } catch (caen::Error&) {}
+        readoutBuffer = caen::ReadoutBuffer();
+    }
+    shadow.clear();
+    digitizer->reopen(linkType, linkNum, conetNode, VMEBaseAddress);
+}
+
+void Digitizer::resume(DataWriter& dataWriter, uint64_t epoch)
+{
+    handleData(dataWriter, epoch);
+    arm();
+    stats.recoveries += 1;
+}
+
+void Digitizer::handleData(DataWriter& dataWriter, uint64_t epoch)
+{
+    prepare();
+    uint32_t groups = this->groups();
     switch ((int)firmware) //Cast to int as long as CAEN_DGTZ_DPPFirmware_QDC is not part of the enumeration
     {
         case CAEN_DGTZ_DPPFirmware_PHA:
@@ -326,31 +515,19 @@ void Digitizer::initialize(DataWriter& dataWriter)
             break;
         case CAEN_DGTZ_DPPFirmware_QDC:
         {
-            caen::Digitizer740DPP::BoardConfiguration bc{boardConfiguration};
-            extras = bc.extras();
-            if (bc.waveform())
-                waveforms = digitizer->getRecordLength(0);
-            for (uint32_t i = 0; i < groups; ++i)
-            {
-                acqWindowSize[i] = std::max({digitizer->getRecordLength(i)*bc.waveform(),
-                                             digitizer->getDPPPreTriggerSize(i) + digitizer->getDPPTriggerHoldOffWidth(i),
-                                             digitizer->getDPPGateWidth(i) - digitizer->getDPPGateOffset(i)+ digitizer->getDPPPreTriggerSize(i)
-                                            }) * 2; // Lets be conservative :P
-            }
-
             if (waveforms)
             {
                 if (extras)
-                    dataHandler.initialize<Data::WaveformElement<Data::ListElement8222> >(dataWriter,serial(),groups,waveforms,acqWindowSize);
+                    dataHandler.initialize<Data::WaveformElement<Data::ListElement8222> >(dataWriter,serial(),groups,waveforms,acqWindowSize,epoch);
                 else
-                    dataHandler.initialize<Data::WaveformElement<Data::ListElement422> >(dataWriter,serial(),groups,waveforms,acqWindowSize);
+                    dataHandler.initialize<Data::WaveformElement<Data::ListElement422> >(dataWriter,serial(),groups,waveforms,acqWindowSize,epoch);
             }
             else if (extras)
             {
-                dataHandler.initialize<Data::ListElement8222>(dataWriter,serial(),groups,waveforms,acqWindowSize);
+                dataHandler.initialize<Data::ListElement8222>(dataWriter,serial(),groups,waveforms,acqWindowSize,epoch);
             } else
             {
-                dataHandler.initialize<Data::ListElement422>(dataWriter,serial(),groups,waveforms,acqWindowSize);
+                dataHandler.initialize<Data::ListElement422>(dataWriter,serial(),groups,waveforms,acqWindowSize,epoch);
             }
             break;
         }
@@ -363,10 +540,18 @@ void Digitizer::initialize(DataWriter& dataWriter)
 }
 
 
+void Digitizer::releaseReadoutBuffer()
+{
+    if (readoutBuffer.data != nullptr)
+    {
+        digitizer->freeReadoutBuffer(readoutBuffer);
+        readoutBuffer = caen::ReadoutBuffer();
+    }
+}
+
 void Digitizer::close()
 {
-    DEBUG(std::cout << "Closing digitizer " << name() << std::endl;)
-    digitizer->freeReadoutBuffer(readoutBuffer);
+    releaseReadoutBuffer();
     if (digitizer)
     {
         delete digitizer;
@@ -381,25 +566,36 @@ bool Digitizer::ready()
 }
 
 
-void Digitizer::startAcquisition()
+void Digitizer::arm()
 {
     while (!ready())
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    digitizer->startAcquisition();
+    /* Nothing left over from a previous run */
+    digitizer->clearData();
+    startMode_ = digitizer->getAcquisitionControl() & 0x3;
+    /* The run bit arms a board that is started by a signal */
+    if (startMode_ != 0)
+        digitizer->startAcquisition();
+}
+
+void Digitizer::startAcquisition()
+{
+    arm();
+    if (startMode_ == 0)
+        start();
 }
 
 
 void Digitizer::acquisition()
 {
-    DEBUG(std::cout << "Read at most " << readoutBuffer.size << "b data from " << name() << std::endl;)
+    trace::emit(trace::ReadBegin, serial());
     /* We use slave terminated mode like in the sample from CAEN Digitizer library docs. */
     digitizer->readData(readoutBuffer,CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT);
     uint32_t bytesRead = readoutBuffer.dataSize;
-    DEBUG(std::cout << "Read " << bytesRead << "b of acquired data" << std::endl;)
+    trace::emit(trace::ReadEnd, serial(), bytesRead);
 
     /* NOTE: check and skip if there's no actual events to handle */
     if (bytesRead < 1) {
-        DEBUG(std::cout << "No data to read - skip further handling." << std::endl;)
         return;
     }
     stats.bytesRead += bytesRead;
@@ -419,9 +615,11 @@ void Digitizer::acquisition()
             break;
         case CAEN_DGTZ_DPPFirmware_QDC:
         {
+            trace::emit(trace::DecodeBegin, serial(), bytesRead);
             DPPQDCEventIterator iterator{readoutBuffer};
             size_t events = dataHandler(iterator);
             stats.eventsFound += events;
+            trace::emit(trace::DecodeEnd, serial(), events);
             break;
         }
         case CAEN_DGTZ_NotDPPFirmware:
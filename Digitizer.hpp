@@ -32,6 +32,7 @@
 #include "caen.hpp"
 
 #include <string>
+#include <map>
 #include <unordered_map>
 #include <chrono>
 #include <thread>
@@ -49,7 +50,11 @@ public:
     {
         long bytesRead = 0;
         long eventsFound = 0;
+        long recoveries = 0;  // Times the digitizer was brought back after an error
+        long downtime = 0;    // ms lost to errors
     };
+    /* The value last applied for each setting and register index (-1 for the whole board) since the last reset */
+    typedef std::map<std::pair<FunctionID,int>, std::string> Shadow;
 
 private:
     caen::Digitizer* digitizer = nullptr;
@@ -63,6 +68,10 @@ private:
     std::set<uint32_t> manipulatedRegisters;
     caen::ReadoutBuffer readoutBuffer;
     Stats stats;
+    Shadow shadow;
+    uint8_t startMode_ = 0;
+    void releaseReadoutBuffer();
+    void handleData(DataWriter& dataWriter, uint64_t epoch);
 public:
     /* Connection parameters */
     const CAEN_DGTZ_ConnectionType linkType;
@@ -86,13 +95,47 @@ public:
     std::string get(FunctionID functionID, int index);
     void acquisition();
     const std::set<uint32_t>& getRegisters() { return manipulatedRegisters; }
+    /* Read the registers behind get() in one batch - get() uses the values read until the next set() */
+    void prefetchRegisters();
+    void clearRegisterCache() { digitizer->clearRegisterCache(); }
     bool ready();
+    /* Wait until the board is ready and clear what is left from before. A board started by hardware - S-IN,
+     * first trigger or LVDS - is armed as well and starts on the signal */
+    void arm();
+    /* Start mode from Acquisition Control bits [1:0] as read by arm: 0 software, 1 S-IN, 2 first trigger, 3 LVDS */
+    uint8_t startMode() const { return startMode_; }
+    /* Start an armed board in software start mode */
+    void start() { digitizer->startAcquisition(); }
     void startAcquisition();
     const Stats& getStats() const { return stats; }
     // TODO: Sould we do somthing different than expose these functions?
     void stopAcquisition() { digitizer->stopAcquisition(); }
-    void reset() { digitizer->reset(); }
+    void reset() { digitizer->clearRegisterCache(); digitizer->reset(); shadow.clear(); }
+    const Shadow& getShadow() const { return shadow; }
+    /* The shadow index of a setting - settings that map to one register share it */
+    int registerIndex(FunctionID functionID, int index) const;
+    /* The setting for every group goes to one broadcast register */
+    bool broadcast(FunctionID functionID) const;
+    /* The value is already applied */
+    bool applied(FunctionID functionID, const std::string& value) const;
+    bool applied(FunctionID functionID, int index, const std::string& value) const;
+    /* Load the shadow saved by saveShadow - only trusted if the board still holds its token. Returns trusted */
+    bool loadShadow(const std::string& filename);
+    /* Tag the board with a new token and save the shadow with it */
+    void saveShadow(const std::string& filename);
+    /* Remove the token from the board e.g. before changing settings */
+    void invalidateShadow();
+    /* Allocate the readout buffer and read the settings it is sized from. Kept until a setting changes */
+    void prepare();
     void initialize(DataWriter& dataWriter);
+    /* Open the link again after an error. The settings are gone from the shadow - configure the digitizer
+     * again, then resume */
+    void reopen();
+    /* Arm the digitizer again in the middle of a run. The data that follows has globalTime epoch */
+    void resume(DataWriter& dataWriter, uint64_t epoch);
+    void addDowntime(long msecs) { stats.downtime += msecs; }
+    /* Flush the data of the run and let go of the DataWriter given to initialize */
+    void finish() { dataHandler.release(); }
 };
 
 
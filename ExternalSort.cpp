@@ -0,0 +1,343 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * External merge sort of list elements by time with channel as tie-break
+ *
+ */
+
+#include "ExternalSort.hpp"
+#include <cstring>
+#include <cerrno>
+#include <queue>
+#include <stdexcept>
+#include <unistd.h>
+
+static_assert(offsetof(Data::ListElement422, time) == 0 && offsetof(Data::ListElement422, channel) == 4,
+              "ExternalSort::Layout does not match Data::ListElement422");
+static_assert(offsetof(Data::ListElement8222, time) == 0 && offsetof(Data::ListElement8222, channel) == 8,
+              "ExternalSort::Layout does not match Data::ListElement8222");
+static_assert(offsetof(Data::WaveformElement<Data::ListElement422>, listElement) == 0 &&
+              offsetof(Data::WaveformElement<Data::ListElement8222>, listElement) == 0,
+              "ExternalSort::Layout expects the list element first in Data::WaveformElement");
+
+constexpr const size_t ExternalSort::outputElements;
+
+ExternalSort::Layout::Layout(uint16_t elementType)
+{
+    switch (elementType & ~Data::WaveformBase)
+    {
+        case Data::List422:
+            timeSize = sizeof(Data::ListElement422::time_t);
+            break;
+        case Data::List8222:
+            timeSize = sizeof(Data::ListElement8222::time_t);
+            break;
+        default:
+            throw std::invalid_argument("ExternalSort: unknown element type " + std::to_string(elementType));
+    }
+    channelOffset = timeSize;
+}
+
+uint64_t ExternalSort::Layout::time(const char* element) const
+{
+    if (timeSize == sizeof(uint32_t))
+    {
+        uint32_t time;
+        memcpy(&time, element, sizeof(time));
+        return time;
+    }
+    uint64_t time;
+    memcpy(&time, element, sizeof(time));
+    return time;
+}
+
+uint16_t ExternalSort::Layout::channel(const char* element) const
+{
+    uint16_t channel;
+    memcpy(&channel, element + channelOffset, sizeof(channel));
+    return channel;
+}
+
+ExternalSort::ExternalSort(size_t memoryLimit_, const std::string& directory_)
+        : memoryLimit(memoryLimit_)
+        , directory(directory_) {}
+
+ExternalSort::~ExternalSort()
+{
+    for (auto& g: groups)
+    {
+        for (Run& run: g.second.runs)
+        {
+            fclose(run.file);
+        }
+    }
+}
+
+/*
+ * LSD radix sort on the bytes of channel and then time, which gives the same order as ListElement::operator<.
+ * Only small (time, channel, index) items are moved around during the passes; the elements themselves are
+ * moved once at the end, which matters for waveforms.
+ */
+void ExternalSort::sort(char* elements, size_t n, size_t elementSize, uint16_t elementType, std::vector<char>& scratch)
+{
+    if (n < 2)
+    {
+        return;
+    }
+    struct Item
+    {
+        uint64_t time;
+        uint16_t channel;
+        uint32_t index;
+    };
+    Layout layout(elementType);
+    std::vector<Item> items(n);
+    bool sorted = true;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const char* element = elements + i*elementSize;
+        Item& item = items[i];
+        item.time = layout.time(element);
+        item.channel = layout.channel(element);
+        item.index = (uint32_t)i;
+        if (i > 0 && (item.time < items[i-1].time || (item.time == items[i-1].time && item.channel < items[i-1].channel)))
+        {
+            sorted = false;
+        }
+    }
+    /* Data from a single digitizer group is often in order already */
+    if (sorted)
+    {
+        return;
+    }
+    std::vector<Item> other(n);
+    const size_t digits = sizeof(uint16_t) + layout.timeSize;
+    for (size_t d = 0; d < digits; ++d)
+    {
+        size_t count[256] = {0};
+        auto digit = [d](const Item& item) -> uint8_t
+        {
+            return (uint8_t)(d < sizeof(uint16_t) ? item.channel >> (8*d) : item.time >> (8*(d-sizeof(uint16_t))));
+        };
+        for (const Item& item: items)
+        {
+            count[digit(item)] += 1;
+        }
+        if (count[digit(items[0])] == n)
+        {
+            continue; // Same byte everywhere - nothing to do for this pass
+        }
+        size_t offset = 0;
+        for (size_t& c: count)
+        {
+            size_t tmp = c;
+            c = offset;
+            offset += tmp;
+        }
+        for (const Item& item: items)
+        {
+            other[count[digit(item)]++] = item;
+        }
+        items.swap(other);
+    }
+    scratch.resize(n*elementSize);
+    for (size_t i = 0; i < n; ++i)
+    {
+        memcpy(scratch.data() + i*elementSize, elements + items[i].index*elementSize, elementSize);
+    }
+    memcpy(elements, scratch.data(), n*elementSize);
+}
+
+FILE* ExternalSort::tempFile()
+{
+    std::string name = directory + "/jadaq-sort-XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not create temporary sort file in \"" + directory + "\": " + strerror(errno));
+    }
+    unlink(path.data()); // The file is removed as soon as we close it
+    FILE* file = fdopen(fd, "w+b");
+    if (file == nullptr)
+    {
+        close(fd);
+        throw std::runtime_error("Could not open temporary sort file: " + std::string(strerror(errno)));
+    }
+    return file;
+}
+
+void ExternalSort::spill(Group& group)
+{
+    size_t n = group.pending.size()/group.elementSize;
+    sort(group.pending.data(), n, group.elementSize, group.elementType, scratch);
+    FILE* file = tempFile();
+    if (fwrite(group.pending.data(), group.elementSize, n, file) != n)
+    {
+        fclose(file);
+        throw std::runtime_error("Could not write temporary sort file: " + std::string(strerror(errno)));
+    }
+    group.runs.push_back(Run{file, n});
+    stats.spills += 1;
+    stats.spillBytes += group.pending.size();
+    memory -= group.pending.size();
+    std::vector<char>().swap(group.pending);
+}
+
+void ExternalSort::add(const Key& key, uint16_t elementType, size_t elementSize, const char* elements, size_t n)
+{
+    Group& group = groups[key];
+    if (group.elementSize == 0)
+    {
+        group.elementType = elementType;
+        group.elementSize = elementSize;
+    }
+    if (group.elementType != elementType || group.elementSize != elementSize)
+    {
+        throw std::invalid_argument("ExternalSort: element type changed within a group");
+    }
+    group.pending.insert(group.pending.end(), elements, elements + n*elementSize);
+    memory += n*elementSize;
+    while (memory > memoryLimit)
+    {
+        Group* largest = nullptr;
+        for (auto& g: groups)
+        {
+            if (largest == nullptr || g.second.pending.size() > largest->pending.size())
+                largest = &g.second;
+        }
+        spill(*largest);
+    }
+}
+
+void ExternalSort::finish(const Key& key, const Output& output)
+{
+    auto itr = groups.find(key);
+    if (itr == groups.end())
+    {
+        return;
+    }
+    Group& group = itr->second;
+    size_t n = group.pending.size()/group.elementSize;
+    sort(group.pending.data(), n, group.elementSize, group.elementType, scratch);
+    if (group.runs.empty())
+    {
+        for (size_t i = 0; i < n; i += outputElements)
+        {
+            output(group.pending.data() + i*group.elementSize, std::min(outputElements, n-i));
+        }
+    }
+    else
+    {
+        merge(group, output);
+    }
+    memory -= group.pending.size();
+    groups.erase(itr);
+}
+
+/* k-way merge of the runs on file and the pending elements in memory */
+void ExternalSort::merge(Group& group, const Output& output)
+{
+    const size_t elementSize = group.elementSize;
+    const size_t readElements = std::max((size_t)1, (size_t)(1<<20)/elementSize);
+    struct Reader
+    {
+        FILE* file;
+        size_t remaining;  // Elements left on file
+        std::vector<char> buffer;
+        size_t count;      // Elements in buffer
+        size_t next;
+    };
+    std::vector<Reader> readers;
+    for (Run& run: group.runs)
+    {
+        rewind(run.file);
+        readers.push_back(Reader{run.file, run.elements, {}, 0, 0});
+    }
+    /* The pending elements were added last, so they go last to keep the order stable for equal keys */
+    size_t pending = group.pending.size();
+    readers.push_back(Reader{nullptr, 0, std::move(group.pending), pending/elementSize, 0});
+    group.pending.clear();
+    memory -= pending;
+    auto fill = [&](Reader& reader) -> bool
+    {
+        if (reader.file == nullptr || reader.remaining == 0)
+            return false;
+        size_t n = std::min(reader.remaining, readElements);
+        reader.buffer.resize(n*elementSize);
+        if (fread(reader.buffer.data(), elementSize, n, reader.file) != n)
+        {
+            throw std::runtime_error("Could not read temporary sort file: " + std::string(strerror(errno)));
+        }
+        reader.remaining -= n;
+        reader.count = n;
+        reader.next = 0;
+        return true;
+    };
+    Layout layout(group.elementType);
+    struct Head
+    {
+        uint64_t time;
+        uint16_t channel;
+        size_t reader;
+        bool operator> (const Head& rhs) const
+        {
+            return time > rhs.time || (time == rhs.time && (channel > rhs.channel ||
+                   (channel == rhs.channel && reader > rhs.reader)));
+        }
+    };
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+    auto push = [&](size_t r)
+    {
+        const char* element = readers[r].buffer.data() + readers[r].next*elementSize;
+        heads.push(Head{layout.time(element), layout.channel(element), r});
+    };
+    for (size_t r = 0; r < readers.size(); ++r)
+    {
+        if (readers[r].count > 0 || fill(readers[r]))
+            push(r);
+    }
+    std::vector<char> out(outputElements*elementSize);
+    size_t outCount = 0;
+    while (!heads.empty())
+    {
+        size_t r = heads.top().reader;
+        heads.pop();
+        Reader& reader = readers[r];
+        memcpy(out.data() + outCount*elementSize, reader.buffer.data() + reader.next*elementSize, elementSize);
+        if (++outCount == outputElements)
+        {
+            output(out.data(), outCount);
+            outCount = 0;
+        }
+        if (++reader.next < reader.count || fill(reader))
+            push(r);
+    }
+    if (outCount > 0)
+    {
+        output(out.data(), outCount);
+    }
+    for (Run& run: group.runs)
+    {
+        fclose(run.file);
+    }
+    group.runs.clear();
+}
@@ -0,0 +1,103 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * External merge sort of list elements by time with channel as tie-break
+ * - the same order as ListElement::operator<. Elements are collected in
+ * groups, radix sorted in memory and spilled to temporary files as sorted
+ * runs when the memory limit is reached. When a group is finished all its
+ * runs are merged and streamed to the output.
+ * Elements are handled as raw bytes so any of the element types in Data
+ * can be sorted - including waveforms of any length.
+ *
+ */
+
+#ifndef JADAQ_EXTERNALSORT_HPP
+#define JADAQ_EXTERNALSORT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include "DataFormat.hpp"
+
+class ExternalSort
+{
+public:
+    /* Groups are identified by digitizerID and globalTime */
+    typedef std::pair<uint32_t, uint64_t> Key;
+    /* Receives the sorted elements of a group in chunks of at most outputElements elements */
+    typedef std::function<void(const char* elements, size_t n)> Output;
+    struct Stats
+    {
+        uint64_t spills = 0;      // Sorted runs written to file
+        uint64_t spillBytes = 0;  // Bytes written to file
+    };
+    static constexpr const size_t defaultMemoryLimit = 256<<20;
+    static constexpr const char* defaultDirectory = "/tmp";
+    static constexpr const size_t outputElements = 4096;
+
+    ExternalSort(size_t memoryLimit = defaultMemoryLimit, const std::string& directory = defaultDirectory);
+    ~ExternalSort();
+    void add(const Key& key, uint16_t elementType, size_t elementSize, const char* elements, size_t n);
+    /* Sort and hand on all elements added for key */
+    void finish(const Key& key, const Output& output);
+    size_t memoryUsed() const { return memory; }
+    const Stats& getStats() const { return stats; }
+
+    /* Sort elements in place by time and channel */
+    static void sort(char* elements, size_t n, size_t elementSize, uint16_t elementType, std::vector<char>& scratch);
+
+private:
+    /* Where to find time and channel in the element - the same for waveforms as for their list element */
+    struct Layout
+    {
+        size_t timeSize;
+        size_t channelOffset;
+        explicit Layout(uint16_t elementType);
+        uint64_t time(const char* element) const;
+        uint16_t channel(const char* element) const;
+    };
+    struct Run
+    {
+        FILE* file;
+        size_t elements;
+    };
+    struct Group
+    {
+        uint16_t elementType;
+        size_t elementSize;
+        std::vector<char> pending;  // Unsorted elements not yet spilled
+        std::vector<Run> runs;
+    };
+    const size_t memoryLimit;
+    const std::string directory;
+    std::map<Key, Group> groups;
+    size_t memory = 0;
+    Stats stats;
+    std::vector<char> scratch;
+    FILE* tempFile();
+    void spill(Group& group);
+    void merge(Group& group, const Output& output);
+};
+
+#endif //JADAQ_EXTERNALSORT_HPP
@@ -23,19 +23,30 @@
  */
 
 #include "NetworkReceive.hpp"
-#include "DataWriterText.hpp"
+#include <cstring>
+#include <cerrno>
 
-NetworkReceive::NetworkReceive(std::string address, std::string port)
+NetworkReceive::NetworkReceive(std::string address, std::string port, WriterFactory factory,
+                               size_t threads, size_t writers_, int receiveBufferSize, size_t sortMemory_,
+                               const std::string& sortDirectory_, uint32_t flushAge)
+        : writerFactory(factory)
+        , writers(writers_ > 0 ? writers_ : 1)
+        , sortMemory(sortMemory_)
+        , sortDirectory(sortDirectory_)
 {
     try
     {
+        udp::endpoint endpoint;
         /* Bind to any address if not explicitly provided */
         if (address == listenAll || address == "") {
             endpoint = udp::endpoint(udp::v4(), std::stoi(port));
         } else {
             endpoint = udp::endpoint(boost::asio::ip::address::from_string(address), std::stoi(port));
         }
-        socket = new udp::socket(ioService, endpoint);
+        for (size_t i = 0; i < std::max(threads, (size_t)1); ++i)
+        {
+            receivers.emplace_back(new Receiver(ioService, endpoint, defaultBatch, receiveBufferSize, flushAge));
+        }
     }
     catch (std::exception& e)
     {
@@ -44,92 +55,601 @@ NetworkReceive::NetworkReceive(std::string address, std::string port)
     }
 }
 
-void NetworkReceive::newDataWriter(uuid newID)
+NetworkReceive::~NetworkReceive() = default;
+
+size_t NetworkReceive::Buffer::elementSizeOf(const Data::Header* header, size_t size)
 {
-    for (auto& db: dataBuffers)
+    size_t payload = size - sizeof(Data::Header);
+    if (header->numElements == 0 || payload % header->numElements != 0)
     {
-        uint32_t digitizerID = db.first;
-        jadaq::vector<Data::ListElement422>& buffer = db.second;
-        dataWriter(&buffer,digitizerID,currentTimestamp);
+        return 0;
+    }
+    size_t elementSize = payload / header->numElements;
+    size_t expected = 0;
+    switch (header->elementType)
+    {
+        case Data::List422:
+            expected = Data::ListElement422::size();
+            break;
+        case Data::List8222:
+            expected = Data::ListElement8222::size();
+            break;
+        case Data::Waveform422:
+            typedef Data::WaveformElement<Data::ListElement422> Waveform422;
+            if (elementSize >= Waveform422::size(0))
+                expected = Waveform422::size(((const Waveform422*)(header+1))->waveform.num_samples);
+            break;
+        case Data::Waveform8222:
+            typedef Data::WaveformElement<Data::ListElement8222> Waveform8222;
+            if (elementSize >= Waveform8222::size(0))
+                expected = Waveform8222::size(((const Waveform8222*)(header+1))->waveform.num_samples);
+            break;
+        default:
+            break;
     }
-    dataBuffers.clear();
-    runID = newID;
-    dataWriter = new DataWriterText(runID);
+    return (elementSize == expected) ? elementSize : 0;
+}
 
+bool NetworkReceive::Buffer::known(uint16_t elementType)
+{
+    switch (elementType)
+    {
+        case Data::List422:
+        case Data::List8222:
+        case Data::Waveform422:
+        case Data::Waveform8222:
+            return true;
+        default:
+            return false;
+    }
 }
 
-void NetworkReceive::newTimeStamp(uint64_t timeStamp)
+NetworkReceive::Buffer* NetworkReceive::Buffer::create(uint16_t elementType, size_t elementSize)
 {
-    for (auto& db: dataBuffers)
+    switch (elementType)
     {
-        uint32_t digitizerID = db.first;
-        jadaq::vector<Data::ListElement422>& buffer = db.second;
-        dataWriter(&buffer,digitizerID,currentTimestamp);
-        buffer.clear();
+        case Data::List422:
+            return new TypedBuffer<Data::ListElement422>(elementSize);
+        case Data::List8222:
+            return new TypedBuffer<Data::ListElement8222>(elementSize);
+        case Data::Waveform422:
+            return new TypedBuffer<Data::WaveformElement<Data::ListElement422> >(elementSize);
+        case Data::Waveform8222:
+            return new TypedBuffer<Data::WaveformElement<Data::ListElement8222> >(elementSize);
+        default:
+            throw std::invalid_argument("Unknown element type: " + std::to_string(elementType));
     }
-    currentTimestamp = timeStamp;
 }
 
+NetworkReceive::Receiver::Receiver(boost::asio::io_service& ioService, const udp::endpoint& endpoint, size_t batch_,
+                                   int receiveBufferSize, uint32_t flushAge_)
+        : socket(ioService)
+        , batch(batch_)
+        , slab(batch_*Data::maxBufferSize)
+        , iovecs(batch_)
+        , messages(batch_)
+        , flushAge(flushAge_)
+{
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+    socket.open(endpoint.protocol());
+    socket.set_option(reuse_port(true));
+    int fd = socket.native_handle();
+    /* SO_RCVBUFFORCE lets a privileged user go beyond net.core.rmem_max */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &receiveBufferSize, sizeof(receiveBufferSize)) != 0)
+    {
+        socket.set_option(udp::socket::receive_buffer_size(receiveBufferSize));
+    }
+    udp::socket::receive_buffer_size actual;
+    socket.get_option(actual);
+    if (actual.value()/2 < receiveBufferSize) // Linux reports twice the size asked for
+    {
+        std::cerr << "WARNING: UDP receive buffer limited to " << actual.value()/2 << " bytes (asked for " <<
+                  receiveBufferSize << "). Raise net.core.rmem_max to avoid package loss." << std::endl;
+    }
+    /* Wake up regularly to check for interrupts */
+    struct timeval timeout{0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    socket.bind(endpoint);
+    for (size_t i = 0; i < batch; ++i)
+    {
+        iovecs[i].iov_base = slab.data() + i*Data::maxBufferSize;
+        iovecs[i].iov_len = Data::maxBufferSize;
+        memset(&messages[i], 0, sizeof(struct mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+}
 
-void NetworkReceive::run(volatile sig_atomic_t* interrupt)
+NetworkReceive::Receiver::~Receiver()
 {
-    while(true)
+    Block block;
+    while (full.pop(block))
     {
-        size_t receivedBytes;
-        udp::endpoint remoteEndpoint;
-        try
+        delete block.buffer;
+    }
+    Buffer* buffer;
+    while (empty.pop(buffer))
+    {
+        delete buffer;
+    }
+    for (Buffer* b: spare)
+    {
+        delete b;
+    }
+    for (auto& source: sources)
+    {
+        delete source->previous.buffer;
+        delete source->current.buffer;
+        delete source->late.buffer;
+    }
+}
+
+NetworkReceive::Buffer* NetworkReceive::Receiver::getBuffer(uint16_t elementType, size_t elementSize)
+{
+    Buffer* buffer;
+    while (empty.pop(buffer))
+    {
+        spare.push_back(buffer);
+    }
+    for (auto itr = spare.rbegin(); itr != spare.rend(); ++itr)
+    {
+        buffer = *itr;
+        if (buffer->elementType == elementType && buffer->elementSize == elementSize)
         {
-            receivedBytes = socket->receive_from(boost::asio::buffer((receiveBuffer.data()), Data::maxBufferSize), remoteEndpoint);
+            spare.erase(std::next(itr).base());
+            return buffer;
         }
-        catch (boost::system::system_error& error)
+    }
+    /* Do not hang on to buffers of a type no one is sending any more */
+    if (spare.size() > queueSize)
+    {
+        delete spare.front();
+        spare.erase(spare.begin());
+    }
+    return Buffer::create(elementType, elementSize);
+}
+
+NetworkReceive::Source* NetworkReceive::Receiver::getSource(uint32_t digitizerID)
+{
+    uint32_t slot = routing.find(digitizerID);
+    if (slot != routing.none)
+    {
+        return sources[slot].get();
+    }
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    slot = routing.insert(digitizerID);
+    if (slot == routing.none)
+    {
+        return nullptr;
+    }
+    if (slot == sources.size())
+    {
+        sources.emplace_back(new Source);
+    }
+    Source& source = *sources[slot];
+    source.reorderWindow.reset();
+    source.digitizerID = digitizerID;
+    source.touched = 0;
+    for (Block* block: {&source.previous, &source.current, &source.late})
+    {
+        block->digitizerID = digitizerID;
+        block->globalTime = 0;
+        block->partial = false;
+    }
+    return &source;
+}
+
+/* Get buffers for the element type of the digitizer - on the first package or if it was reconfigured */
+void NetworkReceive::Receiver::setType(Source& source, const Data::Header* header, size_t elementSize)
+{
+    for (Block* block: {&source.previous, &source.current, &source.late})
+    {
+        if (block->buffer)
         {
-            std::cerr << "ERROR receiving UDP package: " << error.what() << std::endl;
+            submit(*block);
+            spare.push_back(block->buffer);
+        }
+        block->buffer = getBuffer(header->elementType, elementSize);
+    }
+}
+
+/*
+ * Hand a block over to the writer and continue with an empty buffer. The writer is told when the last block for
+ * a globalTime is handed on, even if it is empty, so it knows when everything is there to be sorted.
+ */
+void NetworkReceive::Receiver::submit(Block& block, bool last)
+{
+    if (block.buffer->empty() && !(last && block.partial))
+    {
+        return;
+    }
+    block.runID = runID.value();
+    block.last = last;
+    uint16_t elementType = block.buffer->elementType;
+    size_t elementSize = block.buffer->elementSize;
+    while (!full.push(block))
+    {
+        stalls.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::yield();
+    }
+    block.partial = !last;
+    block.buffer = getBuffer(elementType, elementSize);
+}
+
+void NetworkReceive::Receiver::append(Block& block, const Data::Header* header, size_t elementSize)
+{
+    const char* elements = (const char*)(header+1);
+    size_t n = header->numElements;
+    while (true)
+    {
+        size_t appended = block.buffer->append(elements, n);
+        n -= appended;
+        if (n == 0)
             break;
+        elements += appended*elementSize;
+        submit(block, false);
+    }
+}
+
+/*
+ * Put a package, handed on in sequence order by the reorder window, into the block matching its globalTime.
+ * Like DataHandler we keep the previous block open so packages from just before a new block was started
+ * still end up in the right place.
+ */
+void NetworkReceive::Receiver::store(Source& source, const Data::Header* header, size_t size)
+{
+    if (header->numElements == 0)
+    {
+        return;
+    }
+    size_t elementSize = (size - sizeof(Data::Header))/header->numElements;
+    Buffer* buffer = source.current.buffer;
+    if (buffer == nullptr || buffer->elementType != header->elementType || buffer->elementSize != elementSize)
+    {
+        setType(source, header, elementSize);
+    }
+    source.touched = now;
+    uint64_t globalTime = header->globalTime;
+    if (globalTime == source.current.globalTime)
+    {
+        append(source.current, header, elementSize);
+    }
+    else if (globalTime > source.current.globalTime)
+    {
+        submit(source.previous);
+        std::swap(source.previous, source.current);
+        source.current.globalTime = globalTime;
+        append(source.current, header, elementSize);
+    }
+    else if (globalTime == source.previous.globalTime)
+    {
+        append(source.previous, header, elementSize);
+    }
+    else
+    {
+        source.late.globalTime = globalTime;
+        append(source.late, header, elementSize);
+        submit(source.late);
+    }
+}
+
+/* Hand on everything held for source - packages still missing in the reorder window are given up on */
+void NetworkReceive::Receiver::flush(Source& source)
+{
+    source.reorderWindow.flush([this, &source](const Data::Header* header, size_t size)
+                               { store(source, header, size); });
+    if (source.current.buffer)
+    {
+        submit(source.previous);
+        submit(source.current);
+    }
+    source.touched = 0;
+}
+
+void NetworkReceive::Receiver::flush()
+{
+    for (size_t slot = 0; slot < routing.size(); ++slot)
+    {
+        flush(*sources[slot]);
+    }
+}
+
+/* Hand on the data from digitizers that have gone quiet, so it does not wait for the next globalTime */
+void NetworkReceive::Receiver::checkAge()
+{
+    if (now - lastAgeCheck < flushAge/2)
+    {
+        return;
+    }
+    lastAgeCheck = now;
+    for (size_t slot = 0; slot < routing.size(); ++slot)
+    {
+        Source& source = *sources[slot];
+        if (source.touched != 0 && now - source.touched >= flushAge)
+        {
+            flush(source);
         }
-        if (receivedBytes >= sizeof(Data::Header))
+    }
+}
+
+/* Count a malformed package. At most one a second is reported, so a bad sender cannot flood the log */
+bool NetworkReceive::Receiver::reject()
+{
+    invalid.fetch_add(1, std::memory_order_relaxed);
+    if (lastReject != 0 && now - lastReject < 1000)
+    {
+        ++unreported;
+        return false;
+    }
+    if (unreported > 0)
+    {
+        std::cerr << "WARNING: " << unreported << " more invalid packages since the last report" << std::endl;
+    }
+    lastReject = now;
+    unreported = 0;
+    return true;
+}
+
+void NetworkReceive::Receiver::handle(const char* package, size_t size)
+{
+    packages.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size < sizeof(Data::Header))
+    {
+        if (reject())
+            std::cerr << "ERROR receiving UDP package: package too small" << std::endl;
+        return;
+    }
+    const Data::Header* header = (const Data::Header*)package;
+    if (header->version != Data::currentVersion)
+    {
+        uint8_t* version = (uint8_t*)&(header->version);
+        if (reject())
+            std::cerr << "ERROR UDP data version unsupported: " << (int)version[0] << "," << (int)version[1] << std::endl;
+        return;
+    }
+    /* Anything we could not store is dropped here, before it can reach a buffer on a worker thread */
+    if (!Buffer::known(header->elementType))
+    {
+        if (reject())
+            std::cerr << "ERROR receiving UDP package: unknown element type " << header->elementType << std::endl;
+        return;
+    }
+    if (header->numElements != 0 && Buffer::elementSizeOf(header, size) == 0)
+    {
+        if (reject())
+            std::cerr << "ERROR receiving UDP package: package size does not match header (element type " <<
+                      header->elementType << ")" << std::endl;
+        return;
+    }
+    uuid id(header->runID);
+    if (id != runID)
+    {
+        /* New run: hand on everything from the old one and start over. Sources are reused as they are */
+        flush();
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        routing.clear();
+        runID = id;
+    }
+    Source* source = getSource(header->digitizerID);
+    if (source == nullptr)
+    {
+        std::cerr << "ERROR receiving UDP package: more than " << maxDigitizers << " digitizers" << std::endl;
+        return;
+    }
+    source->reorderWindow.insert(header, size, [this, source](const Data::Header* h, size_t s)
+                                 { store(*source, h, s); });
+    /* Also when the package is held back in the window, so a digitizer going quiet after a gap gets flushed */
+    source->touched = now;
+}
+
+void NetworkReceive::Receiver::run(volatile sig_atomic_t* interrupt)
+{
+    while (!*interrupt)
+    {
+        int n = recvmmsg(socket.native_handle(), messages.data(), (unsigned int)batch, MSG_WAITFORONE, nullptr);
+        now = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (n < 0)
         {
-            Data::Header* header = (Data::Header*) receiveBuffer.data();
-            if (header->version != Data::currentVersion)
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
             {
-                uint8_t* version = (uint8_t*)&(header->version);
-                std::cerr << "ERROR UDP data version unsupported: " << version[0] << "," << version[1] << std::endl;
-                continue;
+                std::cerr << "ERROR receiving UDP package: " << strerror(errno) << std::endl;
+                break;
             }
-            if (header->elementType != Data::List422)
-            {
-                std::cerr << "ERROR UDP element type unsupported: " << std::endl;
-                continue;
-            }
-            receiveBuffer.setElements(); //set number of elements from information in header
-            uuid id(header->runID);
-            if (id != runID)
-            {
-                newDataWriter(id);
-            }
-            if (header->globalTime == currentTimestamp)
-            {
-                uint32_t digitizerID = header->digitizerID;
-                dataBuffers[digitizerID].insert(receiveBuffer.begin(),receiveBuffer.end());
-            }
-            else if (header->globalTime > currentTimestamp)
-            {
-                newTimeStamp(header->globalTime);
-                uint32_t digitizerID = header->digitizerID;
-                dataBuffers[digitizerID].insert(receiveBuffer.begin(),receiveBuffer.end());
-            }
-            else
+            n = 0;
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            handle((const char*)iovecs[i].iov_base, messages[i].msg_len);
+        }
+        checkAge();
+    }
+    flush();
+    done = true;
+}
+
+void NetworkReceive::Receiver::printStats(std::ostream& os, ReorderWindow::Stats& total)
+{
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    for (size_t slot = 0; slot < routing.size(); ++slot)
+    {
+        const Source& source = *sources[slot];
+        const ReorderWindow::Stats stats = source.reorderWindow.getStats();
+        os << std::setw(15) << source.digitizerID << ": " << PRINTD(stats.packages) << PRINTD(stats.lost) <<
+           PRINTD(stats.duplicate) << PRINTD(stats.late) << PRINTD(stats.expired) << PRINTD(stats.resyncs) << std::endl;
+        total.packages += stats.packages;
+        total.lost += stats.lost;
+        total.duplicate += stats.duplicate;
+        total.late += stats.late;
+        total.expired += stats.expired;
+        total.resyncs += stats.resyncs;
+    }
+}
+
+std::shared_ptr<DataWriter> NetworkReceive::getOutput(uint64_t runID)
+{
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::shared_ptr<DataWriter> output = outputs[runID].lock();
+    if (!output)
+    {
+        output = std::make_shared<DataWriter>();
+        writerFactory(*output, uuid(runID));
+        outputs[runID] = output;
+    }
+    for (auto itr = outputs.begin(); itr != outputs.end(); )
+    {
+        if (itr->second.expired())
+            itr = outputs.erase(itr);
+        else
+            ++itr;
+    }
+    return output;
+}
+
+/* Writer thread: write the blocks from every writers'th receiver */
+void NetworkReceive::write(size_t writer)
+{
+    /* The output each receiver is currently writing to */
+    struct Output
+    {
+        std::shared_ptr<DataWriter> writer;
+        uint64_t runID = 0;
+        std::set<uint32_t> digitizers; // Digitizers added to writer
+    };
+    std::vector<Output> outputs(receivers.size());
+    std::unique_ptr<ExternalSort> sorter;
+    std::unique_ptr<Buffer> sorted;
+    uint64_t spills = 0;
+    if (sortMemory > 0)
+    {
+        sorter.reset(new ExternalSort(sortMemory/writers, sortDirectory));
+    }
+    while (true)
+    {
+        bool idle = true;
+        bool finished = true;
+        for (size_t r = writer; r < receivers.size(); r += writers)
+        {
+            Receiver& receiver = *receivers[r];
+            Output& out = outputs[r];
+            bool done = receiver.done; // Read before emptying the queue so we do not miss the last blocks
+            Block block;
+            while (receiver.full.pop(block))
             {
-                std::cerr << "Warning: skipping old timestamp." << std::endl;
+                idle = false;
+                if (!out.writer || block.runID != out.runID)
+                {
+                    out.writer = getOutput(block.runID);
+                    out.runID = block.runID;
+                    out.digitizers.clear();
+                }
+                if (out.digitizers.insert(block.digitizerID).second)
+                {
+                    out.writer->addDigitizer(block.digitizerID);
+                }
+                Buffer* buffer = block.buffer;
+                if (sorter)
+                {
+                    ExternalSort::Key key(block.digitizerID, block.globalTime);
+                    if (!buffer->empty())
+                    {
+                        sorter->add(key, buffer->elementType, buffer->elementSize, buffer->elements(), buffer->size());
+                    }
+                    if (block.last)
+                    {
+                        if (!sorted || sorted->elementType != buffer->elementType ||
+                            sorted->elementSize != buffer->elementSize)
+                        {
+                            sorted.reset(Buffer::create(buffer->elementType, buffer->elementSize));
+                        }
+                        sorter->finish(key, [&](const char* elements, size_t n)
+                        {
+                            sorted->clear();
+                            sorted->append(elements, n);
+                            sorted->write(*out.writer, block.digitizerID, block.globalTime);
+                        });
+                        uint64_t total = sorter->getStats().spills;
+                        sortSpills.fetch_add(total - spills, std::memory_order_relaxed);
+                        spills = total;
+                    }
+                }
+                else if (!buffer->empty())
+                {
+                    buffer->write(*out.writer, block.digitizerID, block.globalTime);
+                }
+                buffer->clear();
+                if (!receiver.empty.push(block.buffer))
+                {
+                    delete block.buffer;
+                }
             }
-
-        } else {
-            std::cerr << "ERROR receiving UDP package: package too small" << std::endl;
+            finished = finished && done;
         }
-        if(*interrupt)
-        {
-            std::cout << "Caught interrupt - stop data server and clean up." << std::endl;
+        if (finished)
             break;
-        }
+        if (idle)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void NetworkReceive::printStats(std::ostream& os)
+{
+    ReorderWindow::Stats total;
+    os << std::setw(15) << "DIGITIZER" << "  " << PRINTHS(total.packages,"Packages") << PRINTHS(total.lost,"Lost") <<
+       PRINTHS(total.duplicate,"Duplicate") << PRINTHS(total.late,"Late") << PRINTHS(total.expired,"Expired") <<
+       PRINTHS(total.resyncs,"Resyncs") << std::endl;
+    uint64_t bytes = 0;
+    uint64_t stalls = 0;
+    uint64_t invalid = 0;
+    for (auto& receiver: receivers)
+    {
+        receiver->printStats(os, total);
+        bytes += receiver->bytes.load(std::memory_order_relaxed);
+        stalls += receiver->stalls.load(std::memory_order_relaxed);
+        invalid += receiver->invalid.load(std::memory_order_relaxed);
+    }
+    os << std::setw(15) << "TOTAL" << ": " << PRINTD(total.packages) << PRINTD(total.lost) <<
+       PRINTD(total.duplicate) << PRINTD(total.late) << PRINTD(total.expired) <<
+       PRINTD(total.resyncs) << std::endl;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - statsTime).count();
+    os << "Received " << bytes << " bytes in " << receivers.size() << " thread(s)";
+    if (statsBytes > 0)
+    {
+        os << " - " << (bytes - statsBytes)*8/seconds/1e9 << " Gbit/s";
+    }
+    os << ", " << stalls << " writer stalls";
+    if (invalid > 0)
+    {
+        os << ", " << invalid << " invalid packages dropped";
+    }
+    if (sortMemory > 0)
+    {
+        os << ", " << sortSpills.load(std::memory_order_relaxed) << " sort spills";
+    }
+    os << "." << std::endl << std::endl;
+    statsTime = now;
+    statsBytes = bytes;
+}
+
+void NetworkReceive::run(volatile sig_atomic_t* interrupt)
+{
+    statsTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& receiver: receivers)
+    {
+        Receiver* r = receiver.get();
+        threads.emplace_back([r, interrupt]() { r->run(interrupt); });
+    }
+    for (size_t w = 0; w < writers; ++w)
+    {
+        threads.emplace_back([this, w]() { write(w); });
+    }
+    for (std::thread& thread: threads)
+    {
+        thread.join();
     }
-    newTimeStamp(-1);
+    std::lock_guard<std::mutex> lock(outputMutex);
+    outputs.clear();
 }
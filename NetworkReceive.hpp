@@ -18,7 +18,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  * @section DESCRIPTION
- * Receive jadaq data over the network and hand off to a DataHandler
+ * Receive jadaq data over the network and hand off to a DataWriter
+ * A number of receive threads each bind their own SO_REUSEPORT socket and
+ * read packages in batches with recvmmsg. The kernel hashes each sender to
+ * one socket, so every receive thread owns the state for its digitizers and
+ * hands full blocks to the writer threads through lock free queues.
+ * Digitizers get a slot in a flat routing table on first sight, and the
+ * data for a slot is handed on when a block is full, when its globalTime
+ * moves on or when it has been sitting idle for flushAge ms.
+ * All element types in Data are accepted - the element size is worked out
+ * from each package so waveforms of any length can be received.
  *
  */
 
@@ -28,8 +37,22 @@
 #include <boost/asio.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/bind.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <sys/socket.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
 #include "DataHandler.hpp"
 #include "DataFormat.hpp"
+#include "ReorderWindow.hpp"
+#include "ExternalSort.hpp"
+#include "RoutingTable.hpp"
 #include "uuid.hpp"
 
 using boost::asio::ip::udp;
@@ -37,22 +60,151 @@ using boost::asio::ip::udp;
 class NetworkReceive
 {
 public:
-    NetworkReceive(std::string address, std::string port);
-    ~NetworkReceive() = default;
+    /* Called to set up the DataWriter for each new run */
+    typedef std::function<void(DataWriter&, const uuid&)> WriterFactory;
+    static constexpr const size_t defaultThreads = 1;
+    static constexpr const size_t defaultWriters = 1;
+    static constexpr const size_t defaultBatch = 64;             // Packages per recvmmsg call
+    static constexpr const int defaultReceiveBufferSize = 64<<20; // SO_RCVBUF in bytes
+    static constexpr const uint32_t defaultFlushAge = 100;       // Hand on data idle for this many ms
+    static constexpr const size_t maxDigitizers = 256;           // Per receive thread
+    NetworkReceive(std::string address, std::string port, WriterFactory factory,
+                   size_t threads = defaultThreads, size_t writers = defaultWriters,
+                   int receiveBufferSize = defaultReceiveBufferSize, size_t sortMemory = 0,
+                   const std::string& sortDirectory = ExternalSort::defaultDirectory,
+                   uint32_t flushAge = defaultFlushAge);
+    ~NetworkReceive();
     void run(volatile sig_atomic_t* interrupt);
+    void printStats(std::ostream& os);
     static constexpr const char* listenAll = "*";
 private:
+    static constexpr const size_t queueSize = 1024;  // Blocks in flight between a receiver and its writer
+    static constexpr const size_t blockElements = 4096;
+    static_assert(ExternalSort::outputElements <= blockElements, "Sorted output must fit in a block");
+    /* Buffer holding elements of any of the types in Data. Like DataHandler the element type is hidden behind
+     * an interface, so the receivers can handle whatever the digitizers send without knowing the type.
+     */
+    class Buffer
+    {
+    public:
+        const uint16_t elementType;
+        const size_t elementSize;
+        Buffer(uint16_t type, size_t size)
+                : elementType(type)
+                , elementSize(size) {}
+        virtual ~Buffer() = default;
+        virtual size_t append(const char* elements, size_t n) = 0;
+        virtual bool empty() const = 0;
+        virtual void clear() = 0;
+        virtual const char* elements() const = 0;
+        virtual size_t size() const = 0;
+        virtual void write(DataWriter& dataWriter, uint32_t digitizerID, uint64_t globalTime) = 0;
+        /* Size of the elements in package, 0 if the package is not valid */
+        static size_t elementSizeOf(const Data::Header* header, size_t size);
+        static bool known(uint16_t elementType);
+        static Buffer* create(uint16_t elementType, size_t elementSize);
+    };
+    template <typename E>
+    class TypedBuffer: public Buffer
+    {
+    private:
+        jadaq::buffer<E> buffer;
+    public:
+        TypedBuffer(size_t elementSize)
+                : Buffer(E::type(), elementSize)
+                , buffer(blockElements*elementSize, elementSize) {}
+        size_t append(const char* elements, size_t n) override
+        { return buffer.append(elements, n); }
+        bool empty() const override
+        { return buffer.empty(); }
+        void clear() override
+        { buffer.clear(); }
+        const char* elements() const override
+        { return buffer.data() + buffer.header_size(); }
+        size_t size() const override
+        { return buffer.size(); }
+        void write(DataWriter& dataWriter, uint32_t digitizerID, uint64_t globalTime) override
+        { dataWriter(&buffer, digitizerID, globalTime); }
+    };
+    struct Block
+    {
+        Buffer* buffer = nullptr;
+        uint64_t globalTime = 0;
+        uint64_t runID = 0;
+        uint32_t digitizerID = 0;
+        bool last = false;     // Last block for digitizerID and globalTime
+        bool partial = false;  // Blocks for this globalTime were handed on already
+    };
+    /* Everything we keep track of for each digitizer sending to us */
+    struct Source
+    {
+        ReorderWindow reorderWindow;
+        Block previous;
+        Block current;
+        Block late;  // For packages older than both previous and current
+        uint32_t digitizerID = 0;
+        uint64_t touched = 0; // When data last came in, 0 if nothing is waiting to be handed on
+    };
+    /* A receive thread with its own socket and its own set of digitizers */
+    class Receiver
+    {
+    private:
+        udp::socket socket;
+        const size_t batch;
+        std::vector<char> slab;             // batch preallocated packages
+        std::vector<struct iovec> iovecs;
+        std::vector<struct mmsghdr> messages;
+        const uint32_t flushAge;
+        uuid runID{0};
+        uint64_t now = 0;         // Time of the current batch of packages in ms
+        uint64_t lastAgeCheck = 0;
+        uint64_t lastReject = 0;  // When a malformed package was last reported
+        uint64_t unreported = 0;  // Malformed packages since then
+        RoutingTable<maxDigitizers> routing;
+        /* Sources by slot in the routing table. Kept across runs so each is only allocated once */
+        std::vector<std::unique_ptr<Source> > sources;
+        std::mutex sourcesMutex; // Guard sources against printStats while new digitizers are added
+        std::vector<Buffer*> spare; // Empty buffers back from the writer not yet reused
+        Source* getSource(uint32_t digitizerID);
+        Buffer* getBuffer(uint16_t elementType, size_t elementSize);
+        void setType(Source& source, const Data::Header* header, size_t elementSize);
+        void handle(const char* package, size_t size);
+        bool reject();
+        void store(Source& source, const Data::Header* header, size_t size);
+        void append(Block& block, const Data::Header* header, size_t elementSize);
+        void submit(Block& block, bool last = true);
+        void flush(Source& source);
+        void flush();
+        void checkAge();
+    public:
+        boost::lockfree::spsc_queue<Block> full{queueSize};
+        boost::lockfree::spsc_queue<Buffer*> empty{queueSize};
+        std::atomic<bool> done{false};
+        /* Written by the receive thread only, read by printStats */
+        std::atomic<uint64_t> packages{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> stalls{0};  // Times we had to wait for a writer to catch up
+        std::atomic<uint64_t> invalid{0}; // Packages dropped as malformed
+        Receiver(boost::asio::io_service& ioService, const udp::endpoint& endpoint, size_t batch, int receiveBufferSize,
+                 uint32_t flushAge);
+        ~Receiver();
+        void run(volatile sig_atomic_t* interrupt);
+        void printStats(std::ostream& os, ReorderWindow::Stats& total);
+    };
     boost::asio::io_service ioService;
-    udp::endpoint endpoint;
-    udp::socket *socket = nullptr;
-    jadaq::buffer<Data::ListElement422> receiveBuffer;
-    const size_t bufferSize = Data::maxBufferSize;
-    uuid runID{0};
-    uint64_t currentTimestamp = 0;
-    DataWriter dataWriter;
-    std::map<uint32_t ,jadaq::buffer<Data::ListElement422> > dataBuffers;
-    void newDataWriter(uuid newID);
-    void newTimeStamp(uint64_t timeStamp);
+    WriterFactory writerFactory;
+    std::vector<std::unique_ptr<Receiver> > receivers;
+    const size_t writers;
+    const size_t sortMemory;  // Memory for sorting in each writer thread, no sorting if 0
+    const std::string sortDirectory;
+    std::atomic<uint64_t> sortSpills{0};
+    std::mutex outputMutex;
+    /* Receivers may briefly be in different runs, so the writer for a run lives until no one writes to it */
+    std::map<uint64_t, std::weak_ptr<DataWriter> > outputs;
+    std::chrono::steady_clock::time_point statsTime;
+    uint64_t statsBytes = 0;
+    std::shared_ptr<DataWriter> getOutput(uint64_t runID);
+    void write(size_t writer);
 };
 
 
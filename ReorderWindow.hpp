@@ -0,0 +1,272 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Bounded reorder window for the per digitizer package sequence numbers
+ * in the network protocol. Packages are handed on in sequence order, gaps
+ * are given up on when the window is exceeded and all irregularities are
+ * counted. A jump far ahead is given up on in one step, and a run of
+ * packages far behind - a sender that started over - moves the window
+ * back to them.
+ *
+ */
+
+#ifndef JADAQ_REORDERWINDOW_HPP
+#define JADAQ_REORDERWINDOW_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "DataFormat.hpp"
+
+class ReorderWindow
+{
+public:
+    struct Stats
+    {
+        uint64_t packages = 0;  // Packages received
+        uint64_t lost = 0;      // Sequence numbers given up on and not (yet) seen
+        uint64_t duplicate = 0; // Packages with a sequence number already seen
+        uint64_t late = 0;      // Packages arriving after being counted as lost - still handed on
+        uint64_t expired = 0;   // Packages too old to tell if they are duplicates - thrown away
+        uint64_t resyncs = 0;   // Times the sender was followed back to an older sequence number
+    };
+    static constexpr const size_t defaultWindow = 64;
+    /* Expired packages in a row, each close to the one before, taken to mean the sender started over */
+    static constexpr const uint32_t resyncAfter = 16;
+private:
+    enum State: uint8_t
+    {
+        Unknown,
+        Delivered,
+        Skipped
+    };
+    const uint32_t window;
+    const size_t packageSize;
+    bool started = false;
+    uint32_t next = 0;            // Sequence number we are waiting for
+    std::vector<char> storage;    // window packages indexed by sequence%window
+    std::vector<size_t> held;     // Size of the held package in each slot, 0 if empty
+    std::vector<uint8_t> history; // State of the window sequence numbers before next
+    uint32_t expiredRun = 0;      // Expired packages in a row
+    uint32_t lastExpired = 0;
+    /* Written by the receive thread only, read by the stats thread */
+    struct Counters
+    {
+        std::atomic<uint64_t> packages{0};
+        std::atomic<uint64_t> lost{0};
+        std::atomic<uint64_t> duplicate{0};
+        std::atomic<uint64_t> late{0};
+        std::atomic<uint64_t> expired{0};
+        std::atomic<uint64_t> resyncs{0};
+    } stats;
+
+    /* Single writer, so no read-modify-write needed */
+    static void count(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    { counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    char* slot(uint32_t sequence)
+    { return storage.data() + (sequence%window)*packageSize; }
+
+    /* Move past next - handing on the package if we have it */
+    template <typename F>
+    void skip(F& deliver)
+    {
+        size_t& size = held[next%window];
+        if (size)
+        {
+            deliver((const Data::Header*)slot(next), size);
+            history[next%window] = Delivered;
+            size = 0;
+        } else
+        {
+            count(stats.lost);
+            history[next%window] = Skipped;
+        }
+        ++next;
+    }
+
+    /* Move next to target more than a window ahead without stepping through every sequence number in between */
+    template <typename F>
+    void jump(uint32_t target, F& deliver)
+    {
+        /* Whatever is held is within a window of next */
+        for (uint32_t i = 0; i < window && next != target; ++i)
+        {
+            skip(deliver);
+        }
+        const uint32_t rest = target - next;
+        count(stats.lost, rest);
+        for (uint32_t i = rest > window ? rest - window : 0; i < rest; ++i)
+        {
+            history[(next + i)%window] = Skipped;
+        }
+        next = target;
+    }
+
+    /* Treat an expired package. Returns true if the window was moved back to it */
+    template <typename F>
+    bool expire(uint32_t sequence, F& deliver)
+    {
+        expiredRun = (expiredRun > 0 && (uint32_t)(sequence - lastExpired) < window) ? expiredRun + 1 : 1;
+        lastExpired = sequence;
+        if (expiredRun < resyncAfter)
+        {
+            count(stats.expired);
+            return false;
+        }
+        /* The sender restarted or jumped: hand on what is held and follow it from here */
+        flush(deliver);
+        std::fill(history.begin(), history.end(), (uint8_t)Unknown);
+        next = sequence;
+        expiredRun = 0;
+        count(stats.resyncs);
+        return true;
+    }
+
+    template <typename F>
+    void drain(F& deliver)
+    {
+        while (held[next%window])
+        {
+            skip(deliver);
+        }
+    }
+
+public:
+    explicit ReorderWindow(size_t window_ = defaultWindow, size_t packageSize_ = Data::maxBufferSize)
+            : window((uint32_t)window_)
+            , packageSize(packageSize_)
+            , storage(window_*packageSize_)
+            , held(window_,0)
+            , history(window_,Unknown) {}
+
+    /* Insert a received package. deliver(const Data::Header*, size_t) is called for each package that is
+     * ready to be handed on, which may be zero, one or many packages.
+     */
+    template <typename F>
+    void insert(const Data::Header* header, size_t size, F&& deliver)
+    {
+        uint32_t sequence = header->sequence;
+        count(stats.packages);
+        if (!started)
+        {
+            // The sender counts from zero, so close to zero we assume we just missed the first few
+            next = (sequence < window) ? 0 : sequence;
+            started = true;
+        }
+        int32_t distance = (int32_t)(sequence - next);
+        if (distance < 0 && (uint32_t)(next - sequence) > window)
+        {
+            /* Too old to tell - unless the sender started over */
+            if (!expire(sequence, deliver))
+                return;
+            distance = 0;
+        }
+        expiredRun = 0;
+        if (distance < 0)
+        {
+            uint8_t& state = history[sequence%window];
+            if (state == Skipped)
+            {
+                count(stats.lost, (uint64_t)-1);
+                count(stats.late);
+                state = Delivered;
+                deliver(header, size);
+            } else if (state == Delivered)
+            {
+                count(stats.duplicate);
+            } else
+            {
+                count(stats.expired);
+            }
+            return;
+        }
+        if (distance == 0 && held[next%window] == 0)
+        {
+            // Fast path: the package we were waiting for - no need to copy it
+            deliver(header, size);
+            history[next%window] = Delivered;
+            ++next;
+            drain(deliver);
+            return;
+        }
+        if ((uint32_t)(sequence - next) >= window)
+        {
+            jump(sequence - window + 1, deliver);
+        }
+        size_t& heldSize = held[sequence%window];
+        if (heldSize)
+        {
+            count(stats.duplicate);
+            return;
+        }
+        assert(size <= packageSize);
+        memcpy(slot(sequence), header, size);
+        heldSize = size;
+        drain(deliver);
+    }
+
+    /* Hand on every held package, counting the gaps in between as lost */
+    template <typename F>
+    void flush(F&& deliver)
+    {
+        uint32_t last = next;
+        for (uint32_t i = 0; i < window; ++i)
+        {
+            if (held[(next+i)%window])
+                last = next+i+1;
+        }
+        while (next != last)
+        {
+            skip(deliver);
+        }
+    }
+
+    /* Start over as if nothing was received, e.g. for a new run */
+    void reset()
+    {
+        started = false;
+        next = 0;
+        expiredRun = 0;
+        std::fill(held.begin(), held.end(), 0);
+        std::fill(history.begin(), history.end(), (uint8_t)Unknown);
+        for (std::atomic<uint64_t>* counter: {&stats.packages, &stats.lost, &stats.duplicate, &stats.late,
+                                               &stats.expired, &stats.resyncs})
+            counter->store(0, std::memory_order_relaxed);
+    }
+
+    /* A snapshot - safe to take from another thread */
+    Stats getStats() const
+    {
+        Stats snapshot;
+        snapshot.packages = stats.packages.load(std::memory_order_relaxed);
+        snapshot.lost = stats.lost.load(std::memory_order_relaxed);
+        snapshot.duplicate = stats.duplicate.load(std::memory_order_relaxed);
+        snapshot.late = stats.late.load(std::memory_order_relaxed);
+        snapshot.expired = stats.expired.load(std::memory_order_relaxed);
+        snapshot.resyncs = stats.resyncs.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+};
+
+#endif //JADAQ_REORDERWINDOW_HPP
@@ -0,0 +1,101 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Maps digitizerIDs to dense slot numbers handed out in order of first
+ * sight. A fixed size open addressing table, so lookups are O(1) and
+ * nothing is ever allocated. Consecutive packages are usually from the
+ * same digitizer so the last lookup is cached.
+ *
+ */
+
+#ifndef JADAQ_ROUTINGTABLE_HPP
+#define JADAQ_ROUTINGTABLE_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+template <size_t maxSlots>
+class RoutingTable
+{
+public:
+    static constexpr const uint32_t none = UINT32_MAX;
+private:
+    static constexpr const size_t capacity = 2*maxSlots; // Keep the load factor at or below 1/2
+    static_assert((capacity & (capacity-1)) == 0, "RoutingTable size must be a power of two");
+    struct Entry
+    {
+        uint32_t digitizerID;
+        uint32_t slot;
+    };
+    Entry entries[capacity];
+    uint32_t slots = 0;
+    Entry last{0, none};
+
+    static size_t hash(uint32_t digitizerID)
+    { return (digitizerID * 2654435761u) & (capacity-1); }
+
+public:
+    RoutingTable() { clear(); }
+
+    /* Slot for digitizerID or none if it has not been seen */
+    uint32_t find(uint32_t digitizerID)
+    {
+        if (last.slot != none && last.digitizerID == digitizerID)
+            return last.slot;
+        for (size_t i = hash(digitizerID); entries[i].slot != none; i = (i+1) & (capacity-1))
+        {
+            if (entries[i].digitizerID == digitizerID)
+            {
+                last = entries[i];
+                return last.slot;
+            }
+        }
+        return none;
+    }
+
+    /* Give digitizerID the next free slot. Returns none if the table is full */
+    uint32_t insert(uint32_t digitizerID)
+    {
+        if (slots == maxSlots)
+            return none;
+        size_t i = hash(digitizerID);
+        while (entries[i].slot != none)
+        {
+            i = (i+1) & (capacity-1);
+        }
+        entries[i] = Entry{digitizerID, slots++};
+        last = entries[i];
+        return last.slot;
+    }
+
+    size_t size() const { return slots; }
+
+    void clear()
+    {
+        for (Entry& entry: entries)
+        {
+            entry.slot = none;
+        }
+        slots = 0;
+        last.slot = none;
+    }
+};
+
+#endif //JADAQ_ROUTINGTABLE_HPP
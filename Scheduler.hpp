@@ -0,0 +1,282 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * One thread for all the delayed and periodic tasks of a run - time limit,
+ * file splits, statistics, SWMR flushes, watchdog - kept in a hashed timer
+ * wheel. The thread only wakes when a task is due. A periodic task is due
+ * at fixed multiples of its period from when it was added, so it does not
+ * drift however long it takes, and periods missed entirely are skipped
+ * rather than run back to back.
+ * Tasks working on the state of the acquisition thread, like the writers,
+ * are handed to that thread instead and run when it calls poll() between
+ * two blocks of data, so they need no locking.
+ *
+ */
+
+#ifndef JADAQ_SCHEDULER_HPP
+#define JADAQ_SCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "trace.hpp"
+
+class Scheduler
+{
+public:
+    enum Where
+    {
+        Background,  // On the scheduler thread
+        Acquisition  // On the thread calling poll()
+    };
+    typedef std::function<void()> Task;
+    typedef uint64_t ID;
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    struct Entry
+    {
+        ID id;
+        uint64_t due;     // Tick
+        uint64_t period;  // Ticks, 0 if the task runs once
+        Where where;
+        std::shared_ptr<Task> task;
+    };
+    static constexpr const size_t slots = 1024;
+    const Clock::duration tick;
+    const Clock::time_point origin;
+    std::vector<std::vector<Entry> > wheel;
+    uint64_t current = 0;  // The last tick handled
+    ID ids = 0;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::mutex running;    // Held by the thread while it runs tasks, so cancel can wait for them
+    /* Due on the acquisition thread */
+    std::mutex handOver;
+    std::vector<std::shared_ptr<Task> > pending;
+    std::atomic<bool> handedOver{false};
+    std::atomic<int64_t> polled;  // Ticks
+    std::thread thread;
+
+    uint64_t now() const
+    { return (Clock::now() - origin)/tick; }
+
+    void insert(const Entry& entry)
+    {
+        wheel[entry.due % slots].push_back(entry);
+        wake.notify_one();
+    }
+
+    /* The first tick with something due, looking at most a turn of the wheel ahead */
+    uint64_t next() const
+    {
+        for (uint64_t t = current + 1; t <= current + slots; ++t)
+        {
+            for (const Entry& entry: wheel[t % slots])
+            {
+                if (entry.due <= t)
+                    return t;
+            }
+        }
+        return current + slots;
+    }
+
+    /* Take what is due up to tick until, rescheduling the periodic tasks */
+    std::vector<Entry> advance(uint64_t until)
+    {
+        std::vector<Entry> due;
+        std::vector<Entry> again;
+        for (; current < until; )
+        {
+            std::vector<Entry>& slot = wheel[++current % slots];
+            for (size_t i = 0; i < slot.size(); )
+            {
+                if (slot[i].due > current)
+                {
+                    ++i;
+                    continue;
+                }
+                due.push_back(slot[i]);
+                if (slot[i].period > 0)
+                {
+                    Entry entry = slot[i];
+                    entry.due += entry.period*((until - entry.due)/entry.period + 1);
+                    again.push_back(entry);
+                }
+                slot[i] = slot.back();
+                slot.pop_back();
+            }
+        }
+        for (const Entry& entry: again)
+            wheel[entry.due % slots].push_back(entry);
+        return due;
+    }
+
+    void loop()
+    {
+        trace::name("scheduler");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop)
+        {
+            const uint64_t target = next();
+            if (wake.wait_until(lock, origin + tick*target) == std::cv_status::no_timeout)
+                continue;  // Something was added or cancelled
+            const std::vector<Entry> due = advance(std::max(target, now()));
+            if (due.empty())
+                continue;
+            /* Taken before letting go of the wheel, so a cancel or clear in between waits for these */
+            std::unique_lock<std::mutex> busy(running);
+            lock.unlock();
+            for (const Entry& entry: due)
+            {
+                if (entry.where == Background)
+                {
+                    try {
+                        (*entry.task)();
+                    } catch (std::exception& e) {
+                        std::cerr << "ERROR: scheduled task failed: " << e.what() << std::endl;
+                    }
+                    continue;
+                }
+                std::lock_guard<std::mutex> handing(handOver);
+                /* Still waiting from the last period if the acquisition thread is busy */
+                if (std::find(pending.begin(), pending.end(), entry.task) == pending.end())
+                    pending.push_back(entry.task);
+                handedOver = true;
+            }
+            busy.unlock();
+            lock.lock();
+        }
+    }
+
+    ID add(float seconds, Task&& task, Where where, bool repeat)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t ticks = std::max<int64_t>(std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<float>(seconds))/tick, 1);
+        insert(Entry{++ids, std::max(now(), current) + ticks, repeat ? ticks : 0, where,
+                     std::make_shared<Task>(std::move(task))});
+        return ids;
+    }
+
+public:
+    explicit Scheduler(std::chrono::milliseconds tick_ = std::chrono::milliseconds(1))
+            : tick(tick_)
+            , origin(Clock::now())
+            , wheel(slots)
+            , polled(0)
+    {
+        thread = std::thread(&Scheduler::loop, this);
+    }
+
+    ~Scheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /* Run task once in seconds */
+    ID after(float seconds, Task task, Where where = Background)
+    { return add(seconds, std::move(task), where, false); }
+
+    /* Run task every seconds */
+    ID every(float seconds, Task task, Where where = Background)
+    { return add(seconds, std::move(task), where, true); }
+
+    /* When this returns the task is not running and will not run again. Not from a task */
+    void cancel(ID id)
+    {
+        std::shared_ptr<Task> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::vector<Entry>& slot: wheel)
+            {
+                for (size_t i = 0; i < slot.size(); ++i)
+                {
+                    if (slot[i].id != id)
+                        continue;
+                    task = slot[i].task;
+                    slot[i] = slot.back();
+                    slot.pop_back();
+                    break;
+                }
+            }
+            wake.notify_one();
+        }
+        std::lock_guard<std::mutex> busy(running);
+        std::lock_guard<std::mutex> handing(handOver);
+        pending.erase(std::remove(pending.begin(), pending.end(), task), pending.end());
+    }
+
+    /* Cancel every task */
+    void clear()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::vector<Entry>& slot: wheel)
+                slot.clear();
+            wake.notify_one();
+        }
+        std::lock_guard<std::mutex> busy(running);
+        std::lock_guard<std::mutex> handing(handOver);
+        pending.clear();
+        handedOver = false;
+    }
+
+    /* Run the tasks handed to the acquisition thread - call it between blocks of data */
+    size_t poll()
+    {
+        polled = now();
+        if (!handedOver)
+            return 0;
+        std::vector<std::shared_ptr<Task> > tasks;
+        {
+            std::lock_guard<std::mutex> handing(handOver);
+            tasks.swap(pending);
+            handedOver = false;
+        }
+        for (std::shared_ptr<Task>& task: tasks)
+            (*task)();
+        return tasks.size();
+    }
+
+    /* Time since the acquisition thread last called poll() */
+    Clock::duration idle() const
+    { return tick*(now() - std::min<uint64_t>(polled, now())); }
+};
+
+#endif //JADAQ_SCHEDULER_HPP
@@ -0,0 +1,94 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Fast formatting of numbers into a char buffer - the same text as
+ * std::ostream with std::setw gives, without the stream overhead.
+ *
+ */
+
+#ifndef JADAQ_TEXTFORMAT_HPP
+#define JADAQ_TEXTFORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+/* Like PRINTD(V) but into the buffer at OUT - gives the end of the text */
+#define FORMATD(OUT,V) jadaq::formatDecimal(OUT, V, MAX(sizeof(V)*3,sizeof(#V)))
+
+namespace jadaq
+{
+    static const char digitPairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+    template <typename U>
+    static inline size_t decimalDigits(U value)
+    {
+        size_t n = 1;
+        while (value >= 10000)
+        {
+            value /= 10000;
+            n += 4;
+        }
+        return n + (value >= 10) + (value >= 100) + (value >= 1000);
+    }
+
+    /* Write value right aligned in width characters, or as many as it takes. The digits go straight into
+     * place two at a time from the right. When width holds any value of T, as in FORMATD where it is a
+     * constant, there is no need to count the digits first. Values that fit are formatted with 32 bit
+     * arithmetic, which divides faster */
+    template <typename T>
+    static inline char* formatDecimal(char* out, T value, size_t width)
+    {
+        static_assert(std::is_unsigned<T>::value, "formatDecimal is for unsigned values");
+        typedef typename std::conditional<sizeof(T) <= sizeof(uint32_t), uint32_t, uint64_t>::type U;
+        U v = value;
+        char* end;
+        if (width >= (size_t)std::numeric_limits<T>::digits10 + 1)
+        {
+            memset(out, ' ', width);
+            end = out + width;
+        } else
+        {
+            const size_t n = decimalDigits(v);
+            end = out + std::max(n, width);
+            memset(out, ' ', end - out - n);
+        }
+        char* first = end;
+        while (v >= 100)
+        {
+            first -= 2;
+            memcpy(first, digitPairs + 2*(v%100), 2);
+            v /= 100;
+        }
+        if (v >= 10)
+        {
+            first -= 2;
+            memcpy(first, digitPairs + 2*v, 2);
+        } else
+        {
+            *--first = (char)('0' + v);
+        }
+        return end;
+    }
+} // namespace jadaq
+
+#endif //JADAQ_TEXTFORMAT_HPP
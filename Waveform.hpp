@@ -10,6 +10,7 @@
 #include <H5Cpp.h>
 #include <iomanip>
 #include "DPPQCDEvent.hpp"
+#include "TextFormat.hpp"
 
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #define PRINTD(V) std::setw(MAX(sizeof(V)*3,sizeof(#V))) << V
@@ -26,6 +27,12 @@
         {
             os << PRINTD(start) << " " << PRINTD(end);
         }
+        /* Same text as printOn into out - gives the end of it */
+        char* formatOn(char* out) const
+        {
+            out = FORMATD(out, start); *out++ = ' ';
+            return FORMATD(out, end);
+        }
         static void insertMembers(H5::CompType& datatype, size_t offset)
         {
             datatype.insertMember("start", HOFFSET(Interval, start) + offset, H5::PredType::NATIVE_UINT16);
@@ -66,6 +73,20 @@
                 os << " " <<  std::setw(5) << samples[i];
             }
         }
+        char* formatOn(char* out) const
+        {
+            out = FORMATD(out, num_samples); *out++ = ' ';
+            out = FORMATD(out, trigger); *out++ = ' ';
+            out = gate.formatOn(out); *out++ = ' ';
+            out = holdoff.formatOn(out); *out++ = ' ';
+            out = overthreshold.formatOn(out);
+            for (uint16_t i = 0; i < num_samples; ++i)
+            {
+                *out++ = ' ';
+                out = jadaq::formatDecimal(out, samples[i], 5);
+            }
+            return out;
+        }
         static void headerOn(std::ostream& os)
         {
             os << PRINTH(num_samples) << " " << PRINTH(trigger) << " " << PRINTH(gate) << " " << PRINTH(holdoff) <<
@@ -78,7 +99,7 @@
             datatype.insertMember("gate", HOFFSET(Waveform, gate) + offset, Interval::h5type());
             datatype.insertMember("holdoff", HOFFSET(Waveform, holdoff) + offset, Interval::h5type());
             datatype.insertMember("overthreshold", HOFFSET(Waveform, overthreshold) + offset, Interval::h5type());
-            static const hsize_t n[1] = {num_samples};
+            const hsize_t n[1] = {num_samples};
             datatype.insertMember("samples", HOFFSET(Waveform, samples) + offset, H5::ArrayType(H5::PredType::NATIVE_UINT16,1,n));
         }
         static size_t size(size_t samples) { return sizeof(Waveform) + sizeof(uint16_t)*samples; }
@@ -0,0 +1,149 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Convert binary list files written by DataWriterBinary to HDF5 files
+ * as DataWriterHDF5 would have written them during acquisition.
+ *
+ */
+
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <memory>
+
+#include "DataFormat.hpp"
+#include "DataReaderBinary.hpp"
+#include "DataWriterHDF5.hpp"
+
+void usageHelp(char *name)
+{
+    std::cout << "Usage: " << name << " [<options>] <input_file>..." << std::endl;
+    std::cout << "Where <options> can be:" << std::endl;
+    std::cout << "--columnar / -c          write list data with a data set per field." << std::endl;
+    std::cout << "--compress / -z FILTER   compress with FILTER: none, deflate, lz4 or zstd (default is none)." << std::endl;
+    std::cout << std::endl << "Converts each jadaq binary list file <name>.bin to <name>.h5." << std::endl;
+}
+
+template <typename E>
+static void write(DataWriterHDF5& writer, const DataReaderBinary::Block& block)
+{
+    jadaq::buffer<E> buffer(block.size()*block.elementSize(), block.elementSize());
+    buffer.append(block.data(), block.size());
+    writer(&buffer, block.digitizerID(), block.globalTime());
+}
+
+static size_t convert(const std::string& input, const DataWriterHDF5::Settings& settings)
+{
+    DataReaderBinary reader(input);
+    std::string basename = input;
+    if (basename.size() > 4 && basename.compare(basename.size() - 4, 4, ".bin") == 0)
+        basename.resize(basename.size() - 4);
+    const std::string path;
+    size_t elements = 0;
+    DataWriterHDF5 writer(path, basename, "", settings);
+    for (const DataReaderBinary::Block& block: reader)
+    {
+        switch (block.elementType())
+        {
+            case Data::List422:
+                write<Data::ListElement422>(writer, block);
+                break;
+            case Data::List8222:
+                write<Data::ListElement8222>(writer, block);
+                break;
+            case Data::Waveform422:
+                write<Data::WaveformElement<Data::ListElement422> >(writer, block);
+                break;
+            case Data::Waveform8222:
+                write<Data::WaveformElement<Data::ListElement8222> >(writer, block);
+                break;
+            default:
+                std::cerr << "WARNING: skipping block with unknown element type " << block.elementType() << std::endl;
+                continue;
+        }
+        elements += block.size();
+    }
+    return elements;
+}
+
+int main(int argc, char **argv) {
+    const char* const short_opts = "chz:";
+    const option long_opts[] = {
+        {"columnar", 0, nullptr, 'c'},
+        {"compress", 1, nullptr, 'z'},
+        {"help", 0, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    DataWriterHDF5::Settings settings;
+
+    /* Parse command line options */
+    while (true) {
+        const auto opt = getopt_long(argc, argv, short_opts, long_opts, nullptr);
+        if (-1 == opt)
+            break;
+
+        switch (opt) {
+        case 'c':
+            settings.columnar = true;
+            break;
+        case 'z':
+            try {
+                settings.compression.filter = ChunkCompressor::filter(optarg);
+            } catch (std::invalid_argument& e) {
+                std::cerr << e.what() << std::endl;
+                exit(1);
+            }
+            break;
+        case 'h': // -h or --help
+        case '?': // Unrecognized option
+        default:
+            usageHelp(argv[0]);
+            exit(0);
+            break;
+        }
+    }
+
+    if (argc - optind < 1) {
+        usageHelp(argv[0]);
+        exit(1);
+    }
+    if (!ChunkCompressor::available(settings.compression.filter)) {
+        std::cerr << ChunkCompressor::name(settings.compression.filter) << " compression is not available" << std::endl;
+        exit(1);
+    }
+
+    int result = 0;
+    for (int i = optind; i < argc; ++i)
+    {
+        try {
+            size_t elements = convert(argv[i], settings);
+            std::cout << argv[i] << ": " << elements << " elements" << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            result = 1;
+        } catch (H5::Exception& e) {
+            std::cerr << "ERROR: " << argv[i] << ": " << e.getDetailMsg() << std::endl;
+            result = 1;
+        }
+    }
+    return result;
+}
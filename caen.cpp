@@ -23,11 +23,14 @@
  * Convenient wrapping of the official CAEN Digitizer library functions
  * and some additional functionality otherwise only exposed through low-level
  * register access.
- * This file just does the runtime initialization of a digitizer.
+ * This file does the runtime initialization of a digitizer and the
+ * batched register reads.
  *
  */
 
 #include "caen.hpp"
+#include <dlfcn.h>
+#include <algorithm>
 namespace caen {
 
     /** Convenience helper to detect and instantiate most specific
@@ -60,4 +63,57 @@ namespace caen {
         }
     }
 
+    void Digitizer::reopen(CAEN_DGTZ_ConnectionType linkType, int linkNum, int conetNode, uint32_t VMEBaseAddress)
+    {
+        registerCache_.clear();
+        try {
+            close(handle_);
+        } catch (Error&) {} // Closed with the link
+        int handle = openRawDigitizer(linkType, linkNum, conetNode, VMEBaseAddress);
+        CAEN_DGTZ_BoardInfo_t boardInfo;
+        try {
+            boardInfo = getRawDigitizerBoardInfo(handle);
+        } catch (Error&) {
+            close(handle);
+            throw;
+        }
+        if (boardInfo.SerialNumber != boardInfo_.SerialNumber || boardInfo.FamilyCode != boardInfo_.FamilyCode)
+        {
+            close(handle);
+            throw std::runtime_error("Found digitizer " + std::to_string(boardInfo.SerialNumber) + " in place of " +
+                                     std::to_string(boardInfo_.SerialNumber));
+        }
+        handle_ = handle;
+        boardInfo_ = boardInfo;
+    }
+
+    /* CAENComm is loaded by CAENDigitizer - look it up like debugCAENComm does rather than linking it */
+    typedef int (*CAENComm_MultiRead32)(int handle, uint32_t *Address, int nCycles, uint32_t *data, int *ErrorCode);
+    /* Read cycles per multi read */
+    static const size_t multiReadCycles = 64;
+
+    void Digitizer::prefetchRegisters(const std::vector<uint32_t>& addresses)
+    {
+        static const CAENComm_MultiRead32 multiRead32 = (CAENComm_MultiRead32)dlsym(RTLD_DEFAULT, "CAENComm_MultiRead32");
+        registerCache_.clear();
+        if (multiRead32 == nullptr)
+            return;
+        std::vector<uint32_t> address(addresses);
+        std::sort(address.begin(), address.end());
+        address.erase(std::unique(address.begin(), address.end()), address.end());
+        std::vector<uint32_t> data(address.size());
+        std::vector<int> error(address.size(), -1);
+        for (size_t first = 0; first < address.size(); first += multiReadCycles)
+        {
+            const int n = (int)std::min(multiReadCycles, address.size() - first);
+            /* A cycle that failed is left for the getter to read and report */
+            multiRead32(commHandle(), &address[first], n, &data[first], &error[first]);
+            for (size_t i = first; i < first + n; ++i)
+            {
+                if (error[i] == 0)
+                    registerCache_[address[i]] = data[i];
+            }
+        }
+    }
+
 } // namespace caen
@@ -38,6 +38,7 @@
 #include <cassert>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <tuple>
 #include <boost/any.hpp>
@@ -496,6 +497,23 @@ namespace caen {
         virtual uint32_t filterBoardConfigurationUnsetMask(uint32_t mask)
         { return mask; }
 
+        /* Register values read by prefetchRegisters */
+        std::unordered_map<uint32_t, uint32_t> registerCache_;
+
+        CAEN_DGTZ_ErrorCode readRegisterCached(uint32_t address, uint32_t* value)
+        {
+            if (!registerCache_.empty())
+            {
+                auto it = registerCache_.find(address);
+                if (it != registerCache_.end())
+                {
+                    *value = it->second;
+                    return CAEN_DGTZ_Success;
+                }
+            }
+            return CAEN_DGTZ_ReadRegister(handle_, address, value);
+        }
+
     public:
     public:
 
@@ -539,11 +557,22 @@ namespace caen {
         static void close(int handle)
         { closeRawDigitizer(handle); }
 
+        /**
+         * @brief Open the digitizer again at the same address.
+         *
+         * Closes the handle and opens a new one, e.g. after a link error
+         * left the handle useless. It must still be the same board.
+         */
+        void reopen(CAEN_DGTZ_ConnectionType linkType, int linkNum, int conetNode, uint32_t VMEBaseAddress);
+
         /**
          * @brief Destroy Digitizer instance.
          */
         virtual ~Digitizer()
-        { close(handle_); }
+        {
+            /* The handle may be gone with the link */
+            try { close(handle_); } catch (Error&) {}
+        }
 
         /* Information functions */
         const std::string modelName() const
@@ -609,10 +638,23 @@ namespace caen {
         uint32_t readRegister(uint32_t address)
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, address, &value));
+            errorHandler(readRegisterCached(address, &value));
             return value;
         }
 
+        /* Batched register reads: read the registers with as few bus transactions as the link
+         * allows (CAENComm multi read cycles) and let readRegister and the register getters
+         * use the values read until clearRegisterCache. Nothing must be written in between.
+         * Without multi read support nothing is cached and the registers are read one by one */
+        void prefetchRegisters(const std::vector<uint32_t>& addresses);
+
+        void clearRegisterCache()
+        { registerCache_.clear(); }
+
+        /* The registers read by the register getters */
+        virtual std::vector<uint32_t> getterRegisters()
+        { return std::vector<uint32_t>(); }
+
         /* Utility functions */
         void reset()
         { errorHandler(CAEN_DGTZ_Reset(handle_)); }
@@ -1393,6 +1435,17 @@ namespace caen {
         Digitizer740(int handle, CAEN_DGTZ_BoardInfo_t boardInfo) : Digitizer(handle,boardInfo) {}
 
     public:
+        std::vector<uint32_t> getterRegisters() override
+        {
+            std::vector<uint32_t> registers{0x8000, 0x8100, 0x8104, 0x810C, 0x8110, 0x811C, 0x8124, 0x814C, 0x8168,
+                                            0x8170, 0xEF00, 0xEF04, 0xEF20};
+            for (uint32_t group = 0; group < groups(); ++group)
+            {
+                registers.push_back(0x108C | group<<8);
+            }
+            return registers;
+        }
+
         class BoardConfiguration
         {
         private:
@@ -1469,7 +1522,7 @@ namespace caen {
             uint32_t mask;
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x108C | group<<8, &mask));
+            errorHandler(readRegisterCached(0x108C | group<<8, &mask));
             return mask;
         }
 
@@ -1501,7 +1554,7 @@ namespace caen {
         uint32_t getBoardConfiguration() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8000, &mask));
+            errorHandler(readRegisterCached(0x8000, &mask));
             return mask;
         }
         /**
@@ -1557,7 +1610,7 @@ namespace caen {
         uint32_t getAcquisitionControl() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8100, &mask));
+            errorHandler(readRegisterCached(0x8100, &mask));
             return mask;
         }
         /**
@@ -1591,7 +1644,7 @@ namespace caen {
         uint32_t getAcquisitionStatus() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8104, &mask));
+            errorHandler(readRegisterCached(0x8104, &mask));
             return mask;
         }
 
@@ -1614,7 +1667,7 @@ namespace caen {
         uint32_t getGlobalTriggerMask() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x810C, &mask));
+            errorHandler(readRegisterCached(0x810C, &mask));
             return mask;
         }
         /**
@@ -1650,7 +1703,7 @@ namespace caen {
         uint32_t getFrontPanelTRGOUTEnableMask() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8110, &mask));
+            errorHandler(readRegisterCached(0x8110, &mask));
             return mask;
         }
         /**
@@ -1689,7 +1742,7 @@ namespace caen {
         uint32_t getFrontPanelIOControl() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x811C, &mask));
+            errorHandler(readRegisterCached(0x811C, &mask));
             return mask;
         }
         /**
@@ -1732,7 +1785,7 @@ namespace caen {
         uint32_t getROCFPGAFirmwareRevision() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8124, &mask));
+            errorHandler(readRegisterCached(0x8124, &mask));
             return mask;
         }
 
@@ -1758,7 +1811,7 @@ namespace caen {
         uint32_t getEventSize() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x814C, &value));
+            errorHandler(readRegisterCached(0x814C, &value));
             return value;
         }
 
@@ -1788,7 +1841,7 @@ namespace caen {
         uint32_t getFanSpeedControl() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8168, &mask));
+            errorHandler(readRegisterCached(0x8168, &mask));
             return mask;
         }
         /**
@@ -1838,7 +1891,7 @@ namespace caen {
          * Delay (in units of 8 ns).
          */
         uint32_t getRunStartStopDelay() override
-        { uint32_t delay; errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8170, &delay)); return delay; }
+        { uint32_t delay; errorHandler(readRegisterCached(0x8170, &delay)); return delay; }
         /**
          * @brief Set Run/Start/Stop Delay
          *
@@ -1889,7 +1942,7 @@ namespace caen {
         uint32_t getReadoutControl() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0xEF00, &mask));
+            errorHandler(readRegisterCached(0xEF00, &mask));
             return mask;
         }
         /**
@@ -1924,7 +1977,7 @@ namespace caen {
         uint32_t getReadoutStatus() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0xEF04, &mask));
+            errorHandler(readRegisterCached(0xEF04, &mask));
             return mask;
         }
         /**
@@ -1962,7 +2015,7 @@ namespace caen {
         uint32_t getScratch() override
         {
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0xEF20, &mask));
+            errorHandler(readRegisterCached(0xEF20, &mask));
             return mask;
         }
         /**
@@ -2022,6 +2075,23 @@ namespace caen {
         Digitizer740DPP(int handle, CAEN_DGTZ_BoardInfo_t boardInfo) : Digitizer740(handle, boardInfo) {}
 
     public:
+        std::vector<uint32_t> getterRegisters() override
+        {
+            std::vector<uint32_t> registers = Digitizer740::getterRegisters();
+            for (uint32_t reg: {0x800C, 0x8020, 0x8024, 0x8074, 0x8078, 0x817C, 0xEF1C})
+            {
+                registers.push_back(reg);
+            }
+            for (uint32_t group = 0; group < groups(); ++group)
+            {
+                for (uint32_t reg: {0x1024, 0x1030, 0x1034, 0x1038, 0x103C, 0x1040, 0x1074, 0x1078})
+                {
+                    registers.push_back(reg | group<<8);
+                }
+            }
+            return registers;
+        }
+
         class BoardConfiguration
         {
         private:
@@ -2065,7 +2135,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1030 | group<<8 , &value));
+            errorHandler(readRegisterCached(0x1030 | group<<8 , &value));
             return value;
         }
         /**
@@ -2110,7 +2180,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1034 | group<<8 , &value));
+            errorHandler(readRegisterCached(0x1034 | group<<8 , &value));
             return value;
         }
         /**
@@ -2161,7 +2231,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1038 | group<<8 , &value));
+            errorHandler(readRegisterCached(0x1038 | group<<8 , &value));
             return value;
         }
         /**
@@ -2218,7 +2288,7 @@ namespace caen {
             if (group >= groups() || group < 0)
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t samples;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x103C | group<<8 , &samples));
+            errorHandler(readRegisterCached(0x103C | group<<8 , &samples));
             return samples;
         }
         /**
@@ -2265,7 +2335,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t mask;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1040 | group<<8 , &mask));
+            errorHandler(readRegisterCached(0x1040 | group<<8 , &mask));
             return mask;
         }
         /**
@@ -2313,7 +2383,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1074 | group<<8 , &value));
+            errorHandler(readRegisterCached(0x1074 | group<<8 , &value));
             return value;
         }
         /**
@@ -2323,7 +2393,7 @@ namespace caen {
         uint32_t getDPPTriggerHoldOffWidth() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8074, &value));
+            errorHandler(readRegisterCached(0x8074, &value));
             return value;
         }
         /**
@@ -2379,7 +2449,7 @@ namespace caen {
             if (group >= groups())
                 errorHandler(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1078 | group<<8 , &value));
+            errorHandler(readRegisterCached(0x1078 | group<<8 , &value));
             return value;
         }
         */
@@ -2391,7 +2461,7 @@ namespace caen {
         uint32_t getDPPShapedTriggerWidth() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8078, &value));
+            errorHandler(readRegisterCached(0x8078, &value));
             return value;
         }
         */
@@ -2459,7 +2529,7 @@ namespace caen {
         uint32_t getDPPAggregateOrganization() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x800C, &value));
+            errorHandler(readRegisterCached(0x800C, &value));
             return value;
         }
         */
@@ -2486,7 +2556,7 @@ namespace caen {
         uint32_t getEventsPerAggregate() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8020, &value));
+            errorHandler(readRegisterCached(0x8020, &value));
             return value;
         }
         void setEventsPerAggregate(uint32_t value) override
@@ -2514,7 +2584,7 @@ namespace caen {
         DPPAcquisitionMode getDPPAcquisitionMode() override
         {
             uint32_t boardConf;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8000 , &boardConf));
+            errorHandler(readRegisterCached(0x8000 , &boardConf));
             DPPAcquisitionMode mode;
             if (boardConf & 1<<16)
                 mode.mode = CAEN_DGTZ_DPP_ACQ_MODE_Mixed;
@@ -2592,7 +2662,7 @@ namespace caen {
         uint32_t getDPPDisableExternalTrigger() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x817C, &value));
+            errorHandler(readRegisterCached(0x817C, &value));
             return value;
         }
         /**
@@ -2617,7 +2687,7 @@ namespace caen {
         uint32_t getDPPAggregateNumberPerBLT() override
         {
             uint32_t value;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0xEF1C, &value));
+            errorHandler(readRegisterCached(0xEF1C, &value));
             return value;
         }
         /**
@@ -2631,14 +2701,14 @@ namespace caen {
 
         uint32_t getRecordLength() override
         {
-            uint32_t size; errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x8024, &size)); return size<<3;
+            uint32_t size; errorHandler(readRegisterCached(0x8024, &size)); return size<<3;
         }
         uint32_t getRecordLength(uint32_t group) override
         {
             if (group > groups())
                 throw Error(CAEN_DGTZ_InvalidChannelNumber);
             uint32_t size;
-            errorHandler(CAEN_DGTZ_ReadRegister(handle_, 0x1024 | group<<8, &size));
+            errorHandler(readRegisterCached(0x1024 | group<<8, &size));
             return size<<3;
         }
         void setRecordLength(uint32_t size) override
@@ -125,7 +125,6 @@ namespace jadaq
         void push_back(const T& v)
         {
             check_length();
-            *next = v;
             memcpy(next, &v, element_size);
             next+=element_size;
         }
@@ -137,6 +136,17 @@ namespace jadaq
             next+=element_size;
         }
 
+        /* Append up to n elements from raw memory. Returns the number of elements actually appended */
+        size_t append(const char* src, size_t n)
+        {
+            size_t room = (data_end-next)/element_size;
+            if (n > room)
+                n = room;
+            memcpy(next, src, n*element_size);
+            next += n*element_size;
+            return n;
+        }
+
         void clear()
         { next = data_begin; }
 
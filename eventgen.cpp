@@ -21,25 +21,32 @@
  *
  * @section DESCRIPTION
  * A simple event generator sending out dummy digitizer event packages
- * on UDP for e.g. testing the hdf5writer.
+ * on UDP for e.g. load testing jadaq-ds. Each emulated digitizer sends
+ * from its own thread and socket with sendmmsg.
  *
  */
 
 #include <getopt.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <vector>
 #include <iostream>
 #include <string>
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
 
 #include "DataFormat.hpp"
+#include "DataHandler.hpp"
+#include "uuid.hpp"
+
+#define DEFAULT_UDP_SEND_ADDRESS "127.0.0.1"
 
 using boost::asio::ip::udp;
 
 /* Keep running marker and interrupt signal handler */
-static int interrupted = 0;
+static volatile sig_atomic_t interrupted = 0;
 static void interrupt_handler(int s)
 {
     interrupted = 1;
@@ -54,28 +61,156 @@ static void setup_interrupt_handler()
     sigaction(SIGTERM, &sigIntHandler, NULL);
 }
 
-void usageHelp(char *name) 
+static const size_t maxPayload = Data::maxBufferSize - sizeof(Data::Header);
+
+void usageHelp(char *name)
 {
     std::cout << "Usage: " << name << " [<options>]" << std::endl;
     std::cout << "Where <options> can be:" << std::endl;
     std::cout << "--address / -a ADDRESS   the UDP network address to send to (default is " << DEFAULT_UDP_SEND_ADDRESS << ")." << std::endl;
-    std::cout << "--port / -p PORT         the UDP network port to send to (default is " << DEFAULT_UDP_PORT << ")." << std::endl;
+    std::cout << "--port / -p PORT         the UDP network port to send to (default is " << Data::defaultDataPort << ")." << std::endl;
+    std::cout << "--digitizers / -d COUNT  the number of digitizers to emulate - one thread each (default is 1)." << std::endl;
+    std::cout << "--elements / -e COUNT    the number of list elements in each package (default is as many as fit)." << std::endl;
+    std::cout << "--format / -f FORMAT     the list element format 422 or 8222 (default is 422)." << std::endl;
+    std::cout << "--samples / -s COUNT     send waveforms with COUNT samples with each element (default is no waveforms)." << std::endl;
+    std::cout << "--batch / -b COUNT       the number of packages sent with each sendmmsg call (default is 32)." << std::endl;
+    std::cout << "--time / -t SECONDS      stop after SECONDS seconds (default is 10)." << std::endl;
     std::cout << std::endl << "Generates events and sends them out on the network " << std::endl;
-    std::cout << "as UDP packages for the provided destination. Use a broadcast " << std::endl;
-    std::cout << "address to target multiple listeners." << std::endl;
+    std::cout << "as UDP packages for the provided destination as fast as possible." << std::endl;
+}
+
+struct Sender
+{
+    uint32_t digitizerID;
+    uint64_t packages = 0;
+    uint64_t bytes = 0;
+};
+
+static void fill(Data::ListElement422& element, uint32_t time, uint16_t channel)
+{
+    element.time = time;
+    element.channel = channel;
+    element.charge = (uint16_t)(time*13);
+}
+
+static void fill(Data::ListElement8222& element, uint32_t time, uint16_t channel)
+{
+    element.time = time;
+    element.channel = channel;
+    element.charge = (uint16_t)(time*13);
+    element.baseline = (uint16_t)(time%1024);
+}
+
+template <typename L>
+static void fill(Data::WaveformElement<L>& element, uint32_t time, uint16_t channel)
+{
+    fill(element.listElement, time, channel);
+    Waveform& waveform = element.waveform;
+    waveform.trigger = waveform.num_samples/4;
+    waveform.gate = {waveform.trigger, (uint16_t)(waveform.num_samples/2)};
+    waveform.holdoff = {0, 0};
+    waveform.overthreshold = {waveform.trigger, waveform.gate.end};
+    for (uint16_t i = 0; i < waveform.num_samples; ++i)
+    {
+        waveform.samples[i] = (uint16_t)((i*(time+channel))%4096);
+    }
+}
+
+static void setSamples(Data::ListElement422&, uint16_t) {}
+static void setSamples(Data::ListElement8222&, uint16_t) {}
+template <typename L>
+static void setSamples(Data::WaveformElement<L>& element, uint16_t samples)
+{ element.waveform.num_samples = samples; }
+
+template <typename E>
+static void sendPackages(Sender& sender, const udp::endpoint& endpoint, uint64_t runID, size_t elements, size_t batch,
+                         uint16_t samples)
+{
+    boost::asio::io_service ioService;
+    udp::socket socket(ioService);
+    socket.open(udp::v4());
+    socket.connect(endpoint);
+    const size_t elementSize = E::size(samples);
+    elements = std::min(elements, maxPayload/elementSize);
+    const size_t packageSize = sizeof(Data::Header) + elements*elementSize;
+    std::vector<char> slab(batch*packageSize);
+    std::vector<struct iovec> iovecs(batch);
+    std::vector<struct mmsghdr> messages(batch);
+    for (size_t i = 0; i < batch; ++i)
+    {
+        iovecs[i].iov_base = slab.data() + i*packageSize;
+        iovecs[i].iov_len = packageSize;
+        memset(&messages[i], 0, sizeof(struct mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    uint32_t sequence = 0;
+    uint32_t time = 0;
+    while (!interrupted)
+    {
+        uint64_t globalTime = DataHandler::getTimeMsecs();
+        for (size_t i = 0; i < batch; ++i)
+        {
+            Data::Header* header = (Data::Header*)iovecs[i].iov_base;
+            header->runID = runID;
+            header->globalTime = globalTime;
+            header->digitizerID = sender.digitizerID;
+            header->elementType = E::type();
+            header->numElements = (uint16_t)elements;
+            header->version = Data::currentVersion;
+            header->sequence = sequence++;
+            char* element = (char*)(header+1);
+            for (size_t j = 0; j < elements; ++j)
+            {
+                E& e = *(E*)element;
+                setSamples(e, samples);
+                fill(e, time, (uint16_t)(j%64));
+                element += elementSize;
+                time += 7;
+            }
+        }
+        int sent = sendmmsg(socket.native_handle(), messages.data(), (unsigned int)batch, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ECONNREFUSED) // Nobody listening (yet)
+            {
+                sequence -= (uint32_t)batch;
+                continue;
+            }
+            std::cerr << "ERROR sending UDP package: " << strerror(errno) << std::endl;
+            break;
+        }
+        sequence -= (uint32_t)(batch - sent); // Resend what did not go out
+        sender.packages += sent;
+        sender.bytes += sent*packageSize;
+    }
 }
 
 int main(int argc, char **argv) {
-    const char* const short_opts = "a:hp:";
+    const char* const short_opts = "a:b:d:e:f:hp:s:t:";
     const option long_opts[] = {
         {"address", 1, nullptr, 'a'},
+        {"batch", 1, nullptr, 'b'},
+        {"digitizers", 1, nullptr, 'd'},
+        {"elements", 1, nullptr, 'e'},
+        {"format", 1, nullptr, 'f'},
         {"help", 0, nullptr, 'h'},
         {"port", 1, nullptr, 'p'},
+        {"samples", 1, nullptr, 's'},
+        {"time", 1, nullptr, 't'},
         {nullptr, 0, nullptr, 0}
     };
 
     /* Default option values */
-    std::string address = DEFAULT_UDP_SEND_ADDRESS, port = DEFAULT_UDP_PORT;
+    std::string address = DEFAULT_UDP_SEND_ADDRESS, port = Data::defaultDataPort;
+    size_t digitizers = 1;
+    size_t elements = maxPayload;
+    size_t batch = 32;
+    std::string format = "422";
+    uint16_t samples = 0;
+    float runTime = 10.0f;
 
     /* Parse command line options */
     while (true) {
@@ -87,9 +222,27 @@ int main(int argc, char **argv) {
         case 'a':
             address = std::string(optarg);
             break;
+        case 'b':
+            batch = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'd':
+            digitizers = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'e':
+            elements = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'f':
+            format = std::string(optarg);
+            break;
+        case 's':
+            samples = (uint16_t)std::stoul(optarg);
+            break;
         case 'p':
             port = std::string(optarg);
             break;
+        case 't':
+            runTime = std::stof(optarg);
+            break;
         case 'h': // -h or --help
         case '?': // Unrecognized option
         default:
@@ -105,127 +258,65 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    /* Helpers */
-    boost::asio::io_service io_service;
-    udp::endpoint receiver_endpoint;
-    udp::socket *socket = NULL;
-    /* NOTE: use a static buffer of MAXBUFSIZE bytes for sending */
-    char send_buf[MAXBUFSIZE];
-    Data::EventData *eventData;
-    Data::Meta *metadata;
-    Data::PackedEvents packedEvents;
-
-    uint32_t eventsSent = 0;
-    uint32_t eventIndex = 0, eventsTarget = 0;
-
-    /* For generated events */
-    std::string flavor;
-    std::string digitizer, digitizerModel;
-    uint16_t digitizerID = 0;
-    uint32_t channel = 0, charge = 0, localtime = 0;
-    uint64_t globaltime = 0, runstarttime = 0;
-    
-    std::cout << "Sending UDP packages to: " << address << ":" << port << std::endl;
-
-    /* Setup UDP sender */
+    typedef void (*SendFunction)(Sender&, const udp::endpoint&, uint64_t, size_t, size_t, uint16_t);
+    SendFunction sendFunction;
+    if (format == "422")
+        sendFunction = samples ? sendPackages<Data::WaveformElement<Data::ListElement422> > : sendPackages<Data::ListElement422>;
+    else if (format == "8222")
+        sendFunction = samples ? sendPackages<Data::WaveformElement<Data::ListElement8222> > : sendPackages<Data::ListElement8222>;
+    else {
+        std::cerr << "Unknown element format: " << format << std::endl;
+        exit(1);
+    }
+    if (Data::ListElement8222::size() + Waveform::size(samples) > maxPayload) {
+        std::cerr << "Too many samples for a single package: " << samples << std::endl;
+        exit(1);
+    }
+
+    udp::endpoint endpoint;
     try {
-        udp::resolver resolver(io_service);
+        boost::asio::io_service ioService;
+        udp::resolver resolver(ioService);
         udp::resolver::query query(udp::v4(), address.c_str(), port.c_str());
-        receiver_endpoint = *resolver.resolve(query);
-        socket = new udp::socket(io_service);
-        socket->open(udp::v4());
+        endpoint = *resolver.resolve(query);
     } catch (std::exception& e) {
         std::cerr << "ERROR in UDP connection setup to " << address << " : " << e.what() << std::endl;
         exit(1);
     }
 
-    /* Prepare and start event generator */
-    std::cout << "Setup event generator" << std::endl;
-
-    /* Set up interrupt handler and start handling acquired data */
+    std::cout << "Sending UDP packages to: " << address << ":" << port << " from " << digitizers <<
+              " digitizer(s) - Ctrl-C to interrupt" << std::endl;
     setup_interrupt_handler();
 
-    std::cout << "Running event generator loop - Ctrl-C to interrupt" << std::endl;
-    runstarttime = getTimeMsecs();
-    std::cout << "Run started at " << runstarttime << std::endl;
-
-    uint32_t throttleDown = 0;
-    bool keepRunning = true;
-    while(keepRunning) {
-        /* Continuously receive and dump data */
-        if (throttleDown > 0) {
-            /* NOTE: for running without hogging CPU if nothing to do */
-            std::this_thread::sleep_for(std::chrono::milliseconds(throttleDown));
-        }
-        try {
-            digitizerModel = "V1740D";
-            digitizerID = 137;
-            digitizer = "V1740D_137";
-            globaltime = getTimeMsecs();
-            flavor = "list";
-            eventsTarget = 1 + globaltime % 3;
-
-            /* Reset send buffer each time to prevent any stale data */
-            memset(send_buf, 0, MAXBUFSIZE);
-            eventData = Data::setupEventData((void *)send_buf, MAXBUFSIZE, eventsTarget, 0);
-
-            std::cout << "Prepared eventData " << eventData << " from send_buf " << (void *)send_buf << std::endl;
-
-            metadata = eventData->metadata;
-            /* NOTE: safe copy with explicit string termination */
-            strncpy(eventData->metadata->digitizerModel, digitizerModel.c_str(), MAXMODELSIZE);
-            eventData->metadata->digitizerModel[MAXMODELSIZE-1] = '\0';
-            eventData->metadata->digitizerID = digitizerID;
-            eventData->metadata->globalTime = globaltime;
-            eventData->metadata->runStartTime = runstarttime;
-
-            std::cout << "Prepared eventData has " << eventData->listEventsLength << " listEvents " << std::endl;
-
-            /* Loop generating variable number of events */
-            std::cout << "Generate " << eventsTarget << " fake events from " << digitizer << std::endl;
-
-            for (eventIndex = 0; eventIndex < eventsTarget; eventIndex++) {
-                /* Create a new dataset named after event index under
-                 * globaltime group if it doesn't exist already. */
-                channel = (eventIndex % 2) * 31;
-                localtime = (globaltime + eventIndex) & 0xFFFF;
-                charge = 242 + (localtime+eventIndex*13) % 100;
-                std::cout << "Filling event at " << globaltime << " from " << digitizer << " channel " << channel << " localtime " << localtime << " charge " << charge << std::endl;
-                //std::cout << "DEBUG: listEvents at " << eventData->listEvents << std::endl;
-                eventData->listEvents[eventIndex].localTime = localtime;
-                eventData->listEvents[eventIndex].extendTime = 0;
-                eventData->listEvents[eventIndex].adcValue = charge;
-                eventData->listEvents[eventIndex].channel = channel;
-            }
-
-            std::cout << "Packing event at " << globaltime << " from " << digitizer << " channel " << channel << " localtime " << localtime << " charge " << charge << std::endl;
-            packedEvents = Data::packEventData(eventData);
-            /* Send data to preconfigured receiver */
-            std::cout << "Sending packed event of " << packedEvents.dataSize << "b at " << globaltime << " from " << digitizer << " channel " << channel << " localtime " << localtime << " charge " << charge << std::endl;
-            socket->send_to(boost::asio::buffer((char*)(packedEvents.data), packedEvents.dataSize), receiver_endpoint);
-            eventsSent += eventsTarget;
-
-            /* TODO: make this delay command-line configurable? */
-            throttleDown = 1000;
-        } catch(std::exception& e) {
-            std::cerr << "unexpected exception during reception: " << e.what() << std::endl;
-            /* NOTE: throttle down on errors */
-            throttleDown = 2000;
-        }
-        if (interrupted) {
-            std::cout << "caught interrupt - stop file writer and clean up." << std::endl;
-            break;
-        }
+    uuid runID;
+    std::vector<Sender> senders(digitizers);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < digitizers; ++i)
+    {
+        senders[i].digitizerID = (uint32_t)(1000 + i);
+        threads.emplace_back(sendFunction, std::ref(senders[i]), endpoint, runID.value(), elements, batch, samples);
     }
+    while (!interrupted && std::chrono::steady_clock::now() - start < std::chrono::duration<float>(runTime))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    interrupted = 1;
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    /* Stop event generator and clean up */
-    std::cout << "Stop event generator and clean up" << std::endl;
-
-    /* Close UDP listener */
-    if (socket != NULL)
-        delete socket;
-
-    std::cout << "Shutting down." << std::endl;
+    uint64_t packages = 0, bytes = 0;
+    for (const Sender& sender: senders)
+    {
+        std::cout << "Digitizer " << sender.digitizerID << " sent " << sender.packages << " packages" << std::endl;
+        packages += sender.packages;
+        bytes += sender.bytes;
+    }
+    std::cout << "Sent " << packages << " packages, " << bytes << " bytes in " << seconds << " seconds: " <<
+              bytes*8/seconds/1e9 << " Gbit/s" << std::endl;
 
     return 0;
 }
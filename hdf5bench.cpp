@@ -0,0 +1,232 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Benchmark DataWriterHDF5 with the HDF5 default file properties against
+ * the throughput profile: write generated list data from a number of
+ * digitizers and report the write rate and how long closing the file takes.
+ *
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "DataFormat.hpp"
+#include "DataWriterHDF5.hpp"
+#include "container.hpp"
+
+void usageHelp(char *name)
+{
+    std::cout << "Usage: " << name << " [<options>]" << std::endl;
+    std::cout << "Where <options> can be:" << std::endl;
+    std::cout << "--path / -P PATH         the directory to write the test files in (default is the current directory)." << std::endl;
+    std::cout << "--digitizers / -d COUNT  the number of digitizers to emulate (default is 8)." << std::endl;
+    std::cout << "--size / -m MB           the amount of list data to write for each run (default is 512)." << std::endl;
+    std::cout << "--elements / -e COUNT    the number of list elements in each write (default is 4096)." << std::endl;
+    std::cout << "--repeat / -r COUNT      the number of runs with each profile (default is 3)." << std::endl;
+    std::cout << "--columnar / -c          write list data with the columnar layout." << std::endl;
+    std::cout << "--compress / -z FILTER   compress with FILTER: none, deflate, lz4 or zstd (default is none)." << std::endl;
+    std::cout << "--swmr / -s              write in SWMR mode." << std::endl;
+    std::cout << std::endl << "Writes the same data with the HDF5 default file properties and with the " << std::endl;
+    std::cout << "throughput profile and reports MB/s, close time and file size (the median of the runs)." << std::endl;
+}
+
+struct Result
+{
+    double seconds;  // Writing and closing
+    double close;
+    off_t fileSize;
+};
+
+static Result run(const std::string& path, const DataWriterHDF5::Settings& settings, size_t digitizers,
+                  uint64_t bytes, size_t elements)
+{
+    const std::string basename = "hdf5bench";
+    const std::string filename = path + basename + ".h5";
+    const size_t elementSize = Data::ListElement422::size();
+    std::vector<std::unique_ptr<jadaq::buffer<Data::ListElement422> > > buffers;
+    uint32_t time = 0;
+    for (size_t d = 0; d < digitizers; ++d)
+    {
+        buffers.emplace_back(new jadaq::buffer<Data::ListElement422>(elements*elementSize, elementSize));
+    }
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point closing;
+    {
+        DataWriterHDF5 writer(path, basename, "", settings);
+        for (size_t d = 0; d < digitizers; ++d)
+        {
+            writer.addDataType((uint32_t)(1000 + d), Data::ListElement422::type(), elementSize);
+        }
+        uint64_t written = 0;
+        uint64_t globalTime = 0;
+        while (written < bytes)
+        {
+            for (size_t d = 0; d < digitizers && written < bytes; ++d)
+            {
+                jadaq::buffer<Data::ListElement422>& buffer = *buffers[d];
+                buffer.clear();
+                for (size_t i = 0; i < elements; ++i)
+                {
+                    Data::ListElement422 element;
+                    element.time = time;
+                    element.channel = (uint16_t)(i%64);
+                    element.charge = (uint16_t)(time*13);
+                    buffer.push_back(element);
+                    time += 7;
+                }
+                writer(&buffer, (uint32_t)(1000 + d), globalTime);
+                written += elements*elementSize;
+            }
+            globalTime += 1;
+        }
+        closing = std::chrono::steady_clock::now();
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.close = std::chrono::duration<double>(end - closing).count();
+    struct stat st;
+    result.fileSize = stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+    unlink(filename.c_str());
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const char* const short_opts = "cd:e:hm:P:r:sz:";
+    const option long_opts[] = {
+        {"columnar", 0, nullptr, 'c'},
+        {"compress", 1, nullptr, 'z'},
+        {"digitizers", 1, nullptr, 'd'},
+        {"elements", 1, nullptr, 'e'},
+        {"help", 0, nullptr, 'h'},
+        {"path", 1, nullptr, 'P'},
+        {"repeat", 1, nullptr, 'r'},
+        {"size", 1, nullptr, 'm'},
+        {"swmr", 0, nullptr, 's'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    /* Default option values */
+    std::string path;
+    size_t digitizers = 8;
+    uint64_t megabytes = 512;
+    size_t elements = 4096;
+    size_t repeat = 3;
+    DataWriterHDF5::Settings settings;
+
+    /* Parse command line options */
+    while (true) {
+        const auto opt = getopt_long(argc, argv, short_opts, long_opts, nullptr);
+        if (-1 == opt)
+            break;
+
+        try {
+            switch (opt) {
+            case 'c':
+                settings.columnar = true;
+                break;
+            case 'd':
+                digitizers = std::max(std::stoul(optarg), 1ul);
+                break;
+            case 'e':
+                elements = std::max(std::stoul(optarg), 1ul);
+                break;
+            case 'm':
+                megabytes = std::max(std::stoul(optarg), 1ul);
+                break;
+            case 'P':
+                path = std::string(optarg);
+                break;
+            case 'r':
+                repeat = std::max(std::stoul(optarg), 1ul);
+                break;
+            case 's':
+                settings.swmr = true;
+                break;
+            case 'z':
+                settings.compression.filter = ChunkCompressor::filter(optarg);
+                break;
+            case 'h': // -h or --help
+            case '?': // Unrecognized option
+            default:
+                usageHelp(argv[0]);
+                exit(0);
+                break;
+            }
+        } catch (std::exception& e) {
+            std::cerr << "Invalid option value: " << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
+    /* No further command-line arguments */
+    if (argc - optind > 0) {
+        usageHelp(argv[0]);
+        exit(1);
+    }
+    if (!path.empty() && *path.rbegin() != '/')
+        path += '/';
+    if (!ChunkCompressor::available(settings.compression.filter)) {
+        std::cerr << ChunkCompressor::name(settings.compression.filter) << " compression is not available" << std::endl;
+        exit(1);
+    }
+
+    const char* profiles[] = {"default", "throughput"};
+    std::vector<Result> results[2];
+    /* Alternate the profiles so both see the same page cache and disk state */
+    for (size_t i = 0; i < repeat; ++i)
+    {
+        for (int p = 0; p < 2; ++p)
+        {
+            settings.tuning = DataWriterHDF5::Tuning::profile(profiles[p]);
+            results[p].push_back(run(path, settings, digitizers, megabytes<<20, elements));
+        }
+    }
+
+    std::cout << "Wrote " << megabytes << " MB from " << digitizers << " digitizer(s) in writes of " << elements <<
+              " elements, " << repeat << " run(s) each" << std::endl;
+    std::cout << std::setw(12) << "PROFILE" << std::setw(12) << "MB/s" << std::setw(12) << "close ms" <<
+              std::setw(16) << "file bytes" << std::endl;
+    for (int p = 0; p < 2; ++p)
+    {
+        std::vector<Result>& r = results[p];
+        std::sort(r.begin(), r.end(), [](const Result& a, const Result& b) { return a.seconds < b.seconds; });
+        const Result& median = r[r.size()/2];
+        std::vector<double> close;
+        for (const Result& result: r)
+        {
+            close.push_back(result.close);
+        }
+        std::sort(close.begin(), close.end());
+        std::cout << std::setw(12) << profiles[p] << std::setw(12) << std::fixed << std::setprecision(1) <<
+                  megabytes/median.seconds << std::setw(12) << close[close.size()/2]*1e3 <<
+                  std::setw(16) << median.fileSize << std::endl;
+    }
+    return 0;
+}
@@ -28,12 +28,18 @@
 #include <csignal>
 
 volatile sig_atomic_t interrupt = 0;
+volatile sig_atomic_t traceRequest = 0;
 
 static void handler(int s)
 {
     interrupt = s;
 }
 
+static void traceHandler(int)
+{
+    traceRequest = 1;
+}
+
 static void setup_interrupt_handler()
 {
     struct sigaction sigIntHandler;
@@ -45,5 +51,15 @@ static void setup_interrupt_handler()
     sigaction(SIGHUP, &sigIntHandler, NULL);
 }
 
+/* SIGUSR1 asks for a trace dump */
+static void setup_trace_handler()
+{
+    struct sigaction sigUsr1Handler;
+    sigUsr1Handler.sa_handler = traceHandler;
+    sigemptyset(&sigUsr1Handler.sa_mask);
+    sigUsr1Handler.sa_flags = 0;
+    sigaction(SIGUSR1, &sigUsr1Handler, NULL);
+}
+
 
 #endif //JADAQ_INTERRUPT_H
@@ -18,8 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  * @section DESCRIPTION
- * Full acquisition control flow to intialize digitizer, acquire data
- * and send it out on UDP.
+ * Data sink receiving acquired data from jadaq over UDP and writing it
+ * to file with the same writers as jadaq.
  *
  */
 
@@ -28,6 +28,12 @@
 #include "DataHandler.hpp"
 #include "NetworkReceive.hpp"
 #include "interrupt.hpp"
+#include "Scheduler.hpp"
+#include "DataWriter.hpp"
+#include "DataWriterText.hpp"
+#include "DataWriterHDF5.hpp"
+#include "DataWriterBinary.hpp"
+#include "FileID.hpp"
 
 namespace po = boost::program_options;
 
@@ -35,9 +41,25 @@ struct
 {
     bool  textout = false;
     bool  hdf5out = false;
+    bool  binaryout = false;
     bool  nullout = false;
     bool  sort    = false;
+    float stats   = -1.0f;
     int   verbose =  1;
+    int   threads = NetworkReceive::defaultThreads;
+    int   writers = NetworkReceive::defaultWriters;
+    int   receiveBuffer = NetworkReceive::defaultReceiveBufferSize;
+    std::string path;
+    std::string basename;
+    std::string backend;
+    size_t sortMemory = ExternalSort::defaultMemoryLimit>>20;
+    std::string sortDirectory;
+    uint32_t flushAge = NetworkReceive::defaultFlushAge;
+    std::string compress;
+    std::string profile;
+    uint64_t splitMB = 0;
+    DataWriterHDF5::Settings hdf5;
+    DataWriterBinary::Settings binary;
 } conf;
 
 
@@ -53,10 +75,35 @@ int main(int argc, const char *argv[])
                 ("address,a", po::value<std::string>()->default_value(NetworkReceive::listenAll)->value_name("<address>"), "Address to bind to. Defaults all network interfaces")
                 ("port,p", po::value<std::string>()->value_name("<port>")->default_value(Data::defaultDataPort), "Network port to bind to")
                 ("verbose,v", po::value<int>()->value_name("<level>")->default_value(conf.verbose), "Set program verbosity level.")
-                ("sort,s", po::bool_switch(&conf.sort), "Sort output before writing to file (only valid for file output).")
+                ("sort,s", po::bool_switch(&conf.sort), "Sort output by time before writing to file (only valid for file output).")
+                ("sort_memory", po::value<size_t>(&conf.sortMemory)->value_name("<MB>")->default_value(conf.sortMemory), "Memory to use for sorting before spilling to temporary files")
+                ("sort_dir", po::value<std::string>(&conf.sortDirectory)->value_name("<path>")->default_value(ExternalSort::defaultDirectory), "Directory for temporary sort files")
+                ("stats", po::value<float>()->value_name("<seconds>")->default_value(conf.stats), "Print package loss statistics every <seconds> seconds")
+                ("threads,j", po::value<int>(&conf.threads)->value_name("<count>")->default_value(conf.threads), "Number of receive threads each with its own socket")
+                ("writers,w", po::value<int>(&conf.writers)->value_name("<count>")->default_value(conf.writers), "Number of writer threads")
+                ("flush_age", po::value<uint32_t>(&conf.flushAge)->value_name("<ms>")->default_value(conf.flushAge), "Hand on data from a digitizer after <ms> ms without new data")
+                ("receive_buffer", po::value<int>(&conf.receiveBuffer)->value_name("<bytes>")->default_value(conf.receiveBuffer), "Socket receive buffer size per receive thread")
+                ("path", po::value<std::string>(&conf.path)->value_name("<path>")->default_value(""), "Store data in local <path>.")
+                ("basename", po::value<std::string>(&conf.basename)->value_name("<name>")->default_value("jadaq-"), "Use <name> as the basename for file output.")
+                ("null,N", po::bool_switch(&conf.nullout), "Throw data away - for performance testing.")
                 ("text,T", po::bool_switch(&conf.textout), "Output to text file.")
                 ("hdf5,H", po::bool_switch(&conf.hdf5out), "Output to hdf5 file.")
-                ("backend,b", po::value<std::string>()->value_name("<file type>")->default_value("text"), "Storage back end. [text,hdf5]");
+                ("binary,B", po::bool_switch(&conf.binaryout), "Output to binary list file.")
+                ("backend,b", po::value<std::string>(&conf.backend)->value_name("<file type>")->default_value("text"), "Storage back end. [text,hdf5,binary,null]")
+                ("direct", po::bool_switch(&conf.binary.direct), "Write binary list files with O_DIRECT, bypassing the page cache.")
+                ("split_size", po::value<uint64_t>(&conf.splitMB)->value_name("<MB>")->default_value(conf.splitMB), "Split HDF5 output of a run after <MB> megabytes of data, 0 for no limit")
+                ("split_events", po::value<uint64_t>(&conf.hdf5.splitEvents)->value_name("<count>")->default_value(conf.hdf5.splitEvents), "Split HDF5 output of a run after <count> events, 0 for no limit")
+                ("columnar", po::bool_switch(&conf.hdf5.columnar), "Write list data to HDF5 with a data set per field.")
+                ("compress", po::value<std::string>(&conf.compress)->value_name("<filter>")->default_value("none"), "Compress HDF5 data. [none,deflate,lz4,zstd]")
+                ("compress_level", po::value<int>(&conf.hdf5.compression.level)->value_name("<level>")->default_value(conf.hdf5.compression.level), "Compression level for deflate and zstd")
+                ("compress_threads", po::value<size_t>(&conf.hdf5.compression.threads)->value_name("<count>")->default_value(conf.hdf5.compression.threads), "Compression threads per HDF5 file, 0 for one per core")
+                ("hdf5_profile", po::value<std::string>(&conf.profile)->value_name("<name>")->default_value("default"), "HDF5 file properties. [default,throughput]")
+                ("latest_format", po::value<bool>()->value_name("<0|1>"), "Write HDF5 with the latest file format (overrides the profile)")
+                ("page_size", po::value<uint64_t>()->value_name("<bytes>"), "HDF5 file space page size, 0 for no paged aggregation (overrides the profile)")
+                ("page_buffer", po::value<uint64_t>()->value_name("<MB>"), "HDF5 page buffer size, 0 for none (overrides the profile)")
+                ("metadata_cache", po::value<uint64_t>()->value_name("<MB>"), "HDF5 metadata cache size, 0 for the HDF5 default (overrides the profile)")
+                ("alignment", po::value<uint64_t>()->value_name("<bytes>"), "Align large HDF5 objects e.g. to the stripe size, 0 for the file system block size, 1 for none (overrides the profile)")
+                ("chunk_cache", po::value<uint64_t>()->value_name("<bytes>"), "HDF5 chunk cache per data set, 0 for the HDF5 default (overrides the profile)");
 
         po::variables_map vm;
         po::store(parse_command_line(argc, argv, desc), vm);
@@ -67,19 +114,101 @@ int main(int argc, const char *argv[])
             std::cout << desc << '\n';
             return 0;
         }
+        if (!conf.textout && !conf.hdf5out && !conf.binaryout && !conf.nullout)
+        {
+            if (conf.backend == "text")
+                conf.textout = true;
+            else if (conf.backend == "hdf5")
+                conf.hdf5out = true;
+            else if (conf.backend == "binary")
+                conf.binaryout = true;
+            else if (conf.backend == "null")
+                conf.nullout = true;
+            else
+            {
+                std::cerr << "Unknown storage back end: " << conf.backend << std::endl;
+                return -1;
+            }
+        }
+        if (conf.threads < 1 || conf.writers < 1)
+        {
+            std::cerr << "--threads and --writers must be at least 1." << std::endl;
+            return -1;
+        }
+        if (conf.sort && conf.nullout)
+        {
+            std::cerr << "WARNING: --sort only applies to file output." << std::endl;
+        }
+        try
+        {
+            conf.hdf5.compression.filter = ChunkCompressor::filter(conf.compress);
+            conf.hdf5.tuning = DataWriterHDF5::Tuning::profile(conf.profile);
+            if (vm.count("latest_format"))
+                conf.hdf5.tuning.latestFormat = vm["latest_format"].as<bool>();
+            if (vm.count("page_size"))
+                conf.hdf5.tuning.pageSize = vm["page_size"].as<uint64_t>();
+            if (vm.count("page_buffer"))
+                conf.hdf5.tuning.pageBuffer = vm["page_buffer"].as<uint64_t>()<<20;
+            if (vm.count("metadata_cache"))
+                conf.hdf5.tuning.metadataCache = vm["metadata_cache"].as<uint64_t>()<<20;
+            if (vm.count("alignment"))
+                conf.hdf5.tuning.alignment = vm["alignment"].as<uint64_t>();
+            if (vm.count("chunk_cache"))
+                conf.hdf5.tuning.chunkCache = vm["chunk_cache"].as<uint64_t>();
+        } catch (std::invalid_argument& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+        if (!ChunkCompressor::available(conf.hdf5.compression.filter))
+        {
+            std::cerr << "WARNING: " << conf.compress << " compression is not available - using deflate." << std::endl;
+            conf.hdf5.compression.filter = ChunkCompressor::Deflate;
+        }
+        conf.hdf5.splitBytes = conf.splitMB*1024*1024;
+        conf.hdf5.preopen = conf.hdf5.splitBytes > 0 || conf.hdf5.splitEvents > 0;
         address = vm["address"].as<std::string>();
         port = vm["port"].as<std::string>();
-
+        conf.stats = vm["stats"].as<float>();
+        // add trailing slash to path (if given)
+        if (!conf.path.empty() && *conf.path.rbegin() != '/')
+            conf.path += '/';
     }
     catch (const po::error &ex)
     {
         std::cerr << ex.what() << '\n';
+        return -1;
     }
-    NetworkReceive networkReceive(address,port);
+    NetworkReceive::WriterFactory writerFactory = [](DataWriter& dataWriter, const uuid& runID)
+    {
+        if (conf.hdf5out)
+        {
+            /* Files after the first in a run are numbered */
+            DataWriterHDF5::Settings settings = conf.hdf5;
+            std::shared_ptr<FileID> fileID = std::make_shared<FileID>();
+            const std::string run = runID.toString();
+            settings.nextFileID = [run, fileID]() -> std::string { return run + "-" + (++*fileID).toString(); };
+            dataWriter = new DataWriterHDF5(conf.path, conf.basename, runID.toString(), settings);
+        }
+        else if (conf.binaryout)
+            dataWriter = new DataWriterBinary(conf.path, conf.basename, runID.toString(), conf.binary);
+        else if (conf.textout)
+            dataWriter = new DataWriterText(conf.path, conf.basename, runID.toString());
+        else
+            dataWriter = new DataWriterNull();
+    };
+    NetworkReceive networkReceive(address, port, writerFactory, conf.threads, conf.writers, conf.receiveBuffer,
+                                  (conf.sort && !conf.nullout) ? std::max(conf.sortMemory<<20, (size_t)1) : 0,
+                                  conf.sortDirectory, conf.flushAge);
 
     /* Set up interrupt handler and start handling acquired data */
     setup_interrupt_handler();
+    Scheduler scheduler;
+    if (conf.stats > 0.0f)
+    { scheduler.every(conf.stats, [&networkReceive]() { networkReceive.printStats(std::cout); }); }
     std::cout << "Running file writer loop - Ctrl-C to interrupt" << std::endl;
     networkReceive.run(&interrupt);
+    scheduler.clear();
     std::cout << "caught interrupt - stop file writer and clean up." << std::endl;
+    networkReceive.printStats(std::cout);
 }
@@ -27,8 +27,12 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <memory>
+#include <sstream>
 #include <boost/program_options.hpp>
 #include <queue>
+#include <unistd.h>
 #include "interrupt.hpp"
 #include "Digitizer.hpp"
 #include "Configuration.hpp"
@@ -36,9 +40,13 @@
 #include "DataWriter.hpp"
 #include "DataWriterHDF5.hpp"
 #include "DataWriterText.hpp"
+#include "DataWriterBinary.hpp"
 #include "DataWriterNetwork.hpp"
+#include "DataWriterFanOut.hpp"
 #include "FileID.hpp"
-#include "Timer.hpp"
+#include "Scheduler.hpp"
+#include "ControlSocket.hpp"
+#include "trace.hpp"
 
 namespace po = boost::program_options;
 
@@ -46,26 +54,46 @@ struct
 {
     bool  textout = false;
     bool  hdf5out = false;
+    bool  binaryout = false;
     bool  nullout = false;
+    bool  serialConfig = false;
     long  events  = -1;
     float time    = -1.0f;
     float split   = -1.0f;
+    uint64_t splitMB = 0;
     float stats   = -1.0f;
+    float watchdog = 10.0f;
     int   verbose =  1;
     std::string* path = nullptr;
     std::string* basename = nullptr;
     std::string* network = nullptr;
     std::string* port = nullptr;
     std::string* outConfigFile = nullptr;
+    bool  verifyConfig = false;
     std::vector<std::string> configFile;
+    std::string compress;
+    std::string profile;
+    std::string networkPolicy;
+    std::string filePolicy;
+    std::string shadowPath;
+    std::string* control = nullptr;
+    DataWriterFanOut::Settings sink;
+    int   recoverRetries = 5;
+    size_t traceSize = 16384;
+    float recoverBackoff = 0.5f;
+    DataWriterHDF5::Settings hdf5;
+    DataWriterBinary::Settings binary;
 } conf;
 
 static void printStats(const std::vector<Digitizer>& digitizers)
 {
     long eventsFound = 0;
     long bytesRead = 0;
+    long recoveries = 0;
+    long downtime = 0;
     std::cout << std::setw(15) << "DIGITIZER" << "       " <<
-              PRINTHS(eventsFound,"Events") << PRINTHS(bytesRead,"Bytes") << std::endl;
+              PRINTHS(eventsFound,"Events") << PRINTHS(bytesRead,"Bytes") <<
+              PRINTHS(recoveries,"Recoveries") << PRINTHS(downtime,"Downtime[ms]") << std::endl;
     for (const Digitizer& digitizer: digitizers)
     {
         std::cout << std::setw(15) << digitizer.name() << ": ";
@@ -76,15 +104,685 @@ static void printStats(const std::vector<Digitizer>& digitizers)
             std::cout << "DEAD!! ";
         }
         const Digitizer::Stats& stats = digitizer.getStats();
-        std::cout << PRINTD(stats.eventsFound) << PRINTD(stats.bytesRead) << std::endl;
+        std::cout << PRINTD(stats.eventsFound) << PRINTD(stats.bytesRead) <<
+                  PRINTD(stats.recoveries) << PRINTD(stats.downtime) << std::endl;
         eventsFound += stats.eventsFound;
         bytesRead += stats.bytesRead;
+        recoveries += stats.recoveries;
+        downtime += stats.downtime;
     }
     std::cout << std::setw(15) << "TOTAL" << ":        " <<
-              PRINTD(eventsFound) << PRINTD(bytesRead) << std::endl << std::endl;
+              PRINTD(eventsFound) << PRINTD(bytesRead) << PRINTD(recoveries) << PRINTD(downtime) << std::endl << std::endl;
 
 }
 
+/* The output and scheduled tasks of one acquisition run */
+struct Run
+{
+    uuid runID;
+    std::string path;      // The writers keep references to path and basename
+    std::string basename;
+    FileID fileID;
+    std::mutex fileIDMutex;
+    DataWriter dataWriter;
+    DataWriterFanOut* fanOut = nullptr;  // Owned by dataWriter if the outputs go through one
+    std::atomic<bool> timeout{false};
+    Scheduler scheduler;
+    bool stalled = false;  // The watchdog has warned about the acquisition loop
+    long start = 0;
+    long stop = 0;
+    long eventsFound = 0;
+    int64_t startSkew = 0;  // ns the time tags of the digitizers can be apart at most, -1 if not known
+    int64_t firstStart = 0; // ns since the epoch the first digitizer started
+    /* A digitizer taken out of the readout by an error, and when to try to bring it back */
+    struct Outage
+    {
+        int64_t since = 0;     // ms, 0 while the digitizer is fine
+        int64_t retry = 0;     // ms of the next attempt
+        float backoff = 0.0f;  // s to the next attempt if this one fails
+        int attempts = 0;      // In this run - at most conf.recoverRetries
+    };
+    std::vector<Outage> outages;  // By digitizer
+
+    Run(const std::string& path_, const std::string& basename_)
+            : path(path_)
+            , basename(basename_) {}
+
+    /* Files are split by the timer and by the HDF5 writer itself when it is full */
+    std::string nextFileID()
+    {
+        std::lock_guard<std::mutex> lock(fileIDMutex);
+        return (++fileID).toString();
+    }
+};
+
+// TODO: move DataHandler creation to factory method in DataHandlerGeneric
+static bool openOutput(Run& run)
+{
+    DataWriter& dataWriter = run.dataWriter;
+    conf.hdf5.nextFileID = [&run]() { return run.nextFileID(); };
+    /* File output next to network output - e.g. for an online monitor - or file output that must not
+     * block the acquisition goes through a fan-out writer */
+    DataWriterFanOut::Settings file = conf.sink;
+    DataWriterFanOut::Settings network = conf.sink;
+    file.policy = DataWriterFanOut::policy(conf.filePolicy);
+    network.policy = DataWriterFanOut::policy(conf.networkPolicy);
+    DataWriterFanOut* fanOut = nullptr;
+    if ((conf.hdf5out || conf.binaryout || conf.textout) &&
+        (conf.network != nullptr || file.policy != DataWriterFanOut::Block))
+    {
+        fanOut = new DataWriterFanOut();
+        dataWriter = fanOut;
+    }
+    run.fanOut = fanOut;
+    if (conf.hdf5out)
+    {
+        /* SWMR flushes come from the scheduler rather than a thread of their own */
+        DataWriterHDF5::Settings settings = conf.hdf5;
+        settings.flushInterval = 0.0f;
+        DataWriterHDF5* hdf5 = new DataWriterHDF5(run.path, run.basename, conf.hdf5.preopen?run.fileID.toString():"", settings);
+        if (conf.hdf5.swmr && conf.hdf5.flushInterval > 0.0f)
+            run.scheduler.every(conf.hdf5.flushInterval, [hdf5]() { hdf5->flush(); });
+        if (fanOut)
+            fanOut->add("HDF5", hdf5, file);
+        else
+            dataWriter = hdf5;
+    }
+    else if (conf.binaryout)
+    {
+        DataWriterBinary* binary = new DataWriterBinary(run.path, run.basename, conf.split>0.0f?run.fileID.toString():"", conf.binary);
+        if (fanOut)
+            fanOut->add("binary", binary, file);
+        else
+            dataWriter = binary;
+    }
+    else if (conf.textout)
+    {
+        DataWriterText* text = new DataWriterText(run.path, run.basename, conf.split>0.0f?run.fileID.toString():"");
+        if (fanOut)
+            fanOut->add("text", text, file);
+        else
+            dataWriter = text;
+    }
+    if(conf.network != nullptr)
+    {
+        DataWriterNetwork* sender = new DataWriterNetwork(*conf.network,*conf.port,run.runID.value());
+        if (fanOut)
+            fanOut->add("network", sender, network);
+        else
+            dataWriter = sender;
+    }
+    else if (conf.nullout)
+    {
+        dataWriter = new DataWriterNull();
+    }
+    else if (!conf.hdf5out && !conf.binaryout && !conf.textout)
+    {
+        std::cerr << "No valid data handler." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* Write a snapshot of the trace rings - to a new file next to the data unless file is given. Returns
+ * the outcome as a control reply */
+static std::string dumpTrace(const std::string& why, std::string file = "")
+{
+    static std::atomic<int> dumps{0};
+    if (file.empty())
+        file = *conf.path + "jadaq-trace-" + std::to_string(getpid()) + "-" + std::to_string(++dumps) + ".bin";
+    try {
+        const size_t records = trace::dump(file);
+        std::cout << "Wrote " << records << " trace records to " << file << " (" << why << ")" << std::endl;
+        return "OK wrote " + std::to_string(records) + " trace records to " + file;
+    } catch (std::exception& e)
+    {
+        std::cerr << "ERROR: could not write trace dump: " << e.what() << std::endl;
+        return std::string("ERROR could not write trace dump: ") + e.what();
+    }
+}
+
+static int64_t nanoseconds(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/* Arm every digitizer, then start the ones in software start mode back to back. The others start in
+ * hardware from those - e.g. down the S-IN daisy chain - or from an external signal. When each one
+ * started is measured and handed to the DataWriter */
+static void startDigitizers(Run& run, std::vector<Digitizer>& digitizers)
+{
+    for (Digitizer& digitizer: digitizers) {
+        if (conf.verbose)
+        {
+            std::cout << "Arm digitizer " << digitizer.name() << std::endl;
+        }
+        digitizer.initialize(run.dataWriter);
+        digitizer.arm();
+        digitizer.active = true;
+    }
+    const auto armed = std::chrono::system_clock::now();
+    std::vector<Data::StartTime> starts(digitizers.size());
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        if (digitizers[i].startMode() != 0)
+            continue;
+        const auto before = std::chrono::system_clock::now();
+        digitizers[i].start();
+        const auto after = std::chrono::system_clock::now();
+        starts[i].issued = nanoseconds(before);
+        starts[i].window = (uint32_t)std::min<int64_t>(nanoseconds(after) - nanoseconds(before), UINT32_MAX);
+    }
+    /* A board started in hardware starts with the master - whichever of the software started boards it is */
+    Data::StartTime master;
+    bool software = false;
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        if (digitizers[i].startMode() != 0)
+            continue;
+        const int64_t end = std::max(master.issued + master.window, starts[i].issued + starts[i].window);
+        master.issued = software ? std::min(master.issued, starts[i].issued) : starts[i].issued;
+        master.window = (uint32_t)std::min<int64_t>(end - master.issued, UINT32_MAX);
+        software = true;
+    }
+    if (!software)
+    {
+        /* Started from outside - some time after they were armed */
+        master.issued = nanoseconds(armed);
+        master.window = UINT32_MAX;
+    }
+    int64_t first = INT64_MAX;
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        if (digitizers[i].startMode() != 0)
+            starts[i] = master;
+        starts[i].mode = digitizers[i].startMode();
+        first = std::min(first, starts[i].issued);
+    }
+    run.firstStart = first;
+    run.outages.assign(digitizers.size(), Run::Outage());
+    run.startSkew = 0;
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        starts[i].offset = starts[i].issued - first;
+        run.dataWriter.setStartTime(digitizers[i].serial(), starts[i]);
+        run.startSkew = std::max(run.startSkew, starts[i].offset + starts[i].window);
+        if (conf.verbose)
+        {
+            std::cout << "Started digitizer " << digitizers[i].name() << " at +" << starts[i].offset / 1000.0 <<
+                      " us within " << starts[i].window / 1000.0 << " us" <<
+                      (starts[i].mode ? " by hardware" : "") << std::endl;
+        }
+    }
+    if (!software)
+        run.startSkew = -1;
+}
+
+static bool startRun(Run& run, std::vector<Digitizer>& digitizers)
+{
+    if (!openOutput(run))
+        return false;
+    startDigitizers(run, digitizers);
+    if (conf.verbose)
+    {
+        if (run.startSkew < 0)
+            std::cout << "Digitizers armed for an external start" << std::endl;
+        else
+            std::cout << "Started " << digitizers.size() << " digitizer(s) within " << run.startSkew / 1000.0 <<
+                      " us" << std::endl;
+    }
+
+    /* Splits and statistics run on the acquisition thread between readouts, so they need no locking */
+    if (conf.time > 0.0f)
+    { run.scheduler.after(conf.time, [&run]() { run.timeout = true; }); }
+    if (conf.split > 0.0f)
+    {
+        run.scheduler.every(conf.split, [&run]() {
+            trace::emit(trace::Split);
+            run.dataWriter.split(run.nextFileID());
+        }, Scheduler::Acquisition);
+    }
+    if (conf.stats > 0.0f)
+    {
+        run.scheduler.every(conf.stats, [&run, &digitizers]() {
+            printStats(digitizers);
+            if (run.fanOut)
+                run.fanOut->printStats(std::cout);
+        }, Scheduler::Acquisition);
+    }
+    /* The acquisition loop stuck, e.g. in an output that blocks, would not say so itself */
+    if (conf.watchdog > 0.0f)
+    {
+        run.scheduler.every(std::min(conf.watchdog/2, 1.0f), [&run]() {
+            const float idle = std::chrono::duration<float>(run.scheduler.idle()).count();
+            if (idle >= conf.watchdog && !run.stalled)
+            {
+                std::cerr << "WARNING: the acquisition loop has not come round for " << idle <<
+                          " s - is an output blocking it?" << std::endl;
+                run.stalled = true;
+                dumpTrace("acquisition loop stalled");
+            } else if (idle < conf.watchdog && run.stalled)
+            {
+                std::cerr << "WARNING: the acquisition loop is running again." << std::endl;
+                run.stalled = false;
+            }
+        });
+    }
+    /* From the scheduler thread, so a stuck acquisition loop can be looked at */
+    run.scheduler.every(0.25f, []() {
+        if (traceRequest)
+        {
+            traceRequest = 0;
+            dumpTrace("requested");
+        }
+    });
+    run.start = DataHandler::getTimeMsecs();
+    trace::emit(trace::RunStart, (uint32_t)digitizers.size());
+    return true;
+}
+
+/* The longest wait between attempts to recover a digitizer */
+static const float recoverBackoffMax = 30.0f;
+
+/* Take a digitizer out of the readout after an error - it is brought back by recover */
+static void lose(Digitizer& digitizer, Run::Outage& outage)
+{
+    trace::emit(trace::DigitizerLost, digitizer.serial());
+    dumpTrace(digitizer.name() + " failed");
+    digitizer.active = false;
+    outage.since = DataHandler::getTimeMsecs();
+    outage.backoff = conf.recoverBackoff;
+    if (outage.attempts >= conf.recoverRetries)
+    {
+        std::cerr << "ERROR: " << digitizer.name() << " is lost for the rest of the run - no recovery attempts left." <<
+                  std::endl;
+        outage.retry = INT64_MAX;
+        return;
+    }
+    outage.retry = outage.since + (int64_t)(outage.backoff * 1000);
+    std::cerr << "WARNING: " << digitizer.name() << " taken out of the readout - trying to recover it in " <<
+              outage.backoff << " s." << std::endl;
+}
+
+/* Open the digitizer again, apply its configuration and start it. The data from then on is in a new
+ * globalTime epoch and the new start is handed to the DataWriter. A failed attempt is retried with
+ * exponential backoff until the attempts of the run are used up */
+static void recover(Run& run, Configuration& configuration, Digitizer& digitizer, Run::Outage& outage)
+{
+    outage.attempts += 1;
+    try {
+        digitizer.reopen();
+        configuration.restore(digitizer);
+        const uint64_t epoch = DataHandler::getTimeMsecs();
+        const auto arm = std::chrono::system_clock::now();
+        digitizer.resume(run.dataWriter, epoch);
+        const auto before = std::chrono::system_clock::now();
+        if (digitizer.startMode() == 0)
+            digitizer.start();
+        const auto after = std::chrono::system_clock::now();
+        /* In a hardware start mode the board starts as soon as it is armed if the signal is there */
+        Data::StartTime start;
+        start.issued = nanoseconds(digitizer.startMode() == 0 ? before : arm);
+        start.window = (uint32_t)std::min<int64_t>(nanoseconds(after) - start.issued, UINT32_MAX);
+        start.offset = start.issued - run.firstStart;
+        start.epoch = epoch;
+        start.mode = digitizer.startMode();
+        run.dataWriter.setStartTime(digitizer.serial(), start);
+    } catch (std::exception& e)
+    {
+        std::cerr << "WARNING: attempt " << outage.attempts << " to recover " << digitizer.name() << " failed: " <<
+                  e.what() << std::endl;
+        if (outage.attempts >= conf.recoverRetries)
+        {
+            std::cerr << "ERROR: " << digitizer.name() << " is lost for the rest of the run - no recovery attempts left." <<
+                      std::endl;
+            outage.retry = INT64_MAX;
+            return;
+        }
+        outage.backoff = std::min(outage.backoff * 2, recoverBackoffMax);
+        outage.retry = DataHandler::getTimeMsecs() + (int64_t)(outage.backoff * 1000);
+        return;
+    }
+    const long down = DataHandler::getTimeMsecs() - outage.since;
+    digitizer.addDowntime(down);
+    digitizer.active = true;
+    outage.since = 0;
+    trace::emit(trace::DigitizerBack, digitizer.serial(), down);
+    std::cout << "Recovered " << digitizer.name() << " after " << down / 1000.0 << " s." << std::endl;
+}
+
+/* One readout of every digitizer - returns the events found in the run so far */
+static long acquire(Run& run, Configuration& configuration)
+{
+    std::vector<Digitizer>& digitizers = configuration.getDigitizers();
+    long eventsFound = 0;
+    for (size_t i = 0; i < digitizers.size(); ++i) {
+        Digitizer& digitizer = digitizers[i];
+        Run::Outage& outage = run.outages[i];
+        if (digitizer.active)
+        {
+            try { digitizer.acquisition(); }
+            catch (caen::Error &e)
+            {
+                std::cerr << "ERROR: unexpected exception during acquisition: " << e.what() << "(" << e.code() << ")" << std::endl;
+                lose(digitizer, outage);
+            }
+        } else if (outage.since > 0 && DataHandler::getTimeMsecs() >= outage.retry)
+        {
+            recover(run, configuration, digitizer, outage);
+        }
+        eventsFound += digitizer.getStats().eventsFound;
+    }
+    run.scheduler.poll();
+    return eventsFound;
+}
+
+static void stopRun(Run& run, std::vector<Digitizer>& digitizers)
+{
+    run.scheduler.clear();
+    run.stop = DataHandler::getTimeMsecs();
+    trace::emit(trace::RunStop, (uint32_t)digitizers.size());
+    for (size_t i = 0; i < digitizers.size(); ++i)
+    {
+        Digitizer& digitizer = digitizers[i];
+        if (conf.verbose)
+        {
+            std::cout << "Stop acquisition on digitizer " << digitizer.name() << std::endl;
+        }
+        try {
+            digitizer.stopAcquisition();
+        } catch (caen::Error& e)
+        {
+            std::cerr << "WARNING: could not stop " << digitizer.name() << ": " << e.what() << std::endl;
+        }
+        digitizer.active = false;
+        if (i < run.outages.size() && run.outages[i].since > 0)
+        {
+            digitizer.addDowntime(run.stop - run.outages[i].since);
+        }
+    }
+    /* Flush the data handlers before the writers go */
+    for (Digitizer& digitizer: digitizers)
+    {
+        digitizer.finish();
+    }
+    run.dataWriter.close();
+    if (conf.verbose)
+    {
+        std::cout << "Acquisition complete." << std::endl;
+        double runtime = (run.stop - run.start) / 1000.0;
+        std::cout << "Acquisition ran for " << runtime << " seconds." << std::endl;
+        std::cout << "Collecting " << run.eventsFound << " events." << std::endl;
+        std::cout << "Resulting in a collection rate of " << run.eventsFound/runtime/1000.0 << " kHz." << std::endl;
+    }
+}
+
+/* Acquire until interrupted, timed out or the requested events are collected */
+static int oneShot(Configuration& configuration)
+{
+    std::vector<Digitizer>& digitizers = configuration.getDigitizers();
+    Run run(*conf.path, *conf.basename);
+    if (!startRun(run, digitizers))
+        return -1;
+    if (conf.verbose)
+    {
+        std::cout << "Running acquisition loop - Ctrl-C to interrupt" << std::endl;
+    }
+    while(true)
+    {
+        run.eventsFound = acquire(run, configuration);
+        if (interrupt)
+        {
+            std::cout << "Caught interrupt - stop acquisition and clean up." << std::endl;
+            break;
+        }
+        if (run.timeout)
+        {
+            std::cout << "Time out - stop acquisition and clean up." << std::endl;
+            break;
+        }
+        if (conf.events >= 0 && run.eventsFound >= conf.events)
+        {
+            std::cout << "Collected requested events - stop acquisition and clean up." << std::endl;
+            break;
+        }
+    }
+    stopRun(run, digitizers);
+    return 0;
+}
+
+/* Run control for the daemon */
+class Daemon
+{
+private:
+    Configuration& configuration;
+    std::vector<Digitizer>& digitizers;
+    std::unique_ptr<Run> run;
+    int runs = 0;
+    std::vector<int> waiting;  // Clients waiting for the run to end
+    bool quit = false;
+
+    std::string start(std::istringstream& args)
+    {
+        if (run)
+            return "ERROR run " + std::to_string(runs) + " is in progress";
+        std::string path = *conf.path;
+        std::string basename = *conf.basename + FileID(runs + 1, 5).toString() + "-";
+        std::string arg;
+        while (args >> arg)
+        {
+            if (arg.compare(0, 5, "path=") == 0)
+            {
+                path = arg.substr(5);
+                if (!path.empty() && *path.rbegin() != '/')
+                    path += '/';
+            } else if (arg.compare(0, 9, "basename=") == 0)
+            {
+                basename = arg.substr(9);
+            } else
+            {
+                return "ERROR unknown start argument: " + arg;
+            }
+        }
+        run.reset(new Run(path, basename));
+        try {
+            if (!startRun(*run, digitizers))
+            {
+                run.reset();
+                return "ERROR no valid data handler";
+            }
+        } catch (std::exception& e)
+        {
+            stop();
+            return std::string("ERROR could not start: ") + e.what();
+        }
+        runs += 1;
+        std::cout << "Started run " << runs << " (" << run->runID << ") writing " << path << basename << std::endl;
+        return "OK run " + std::to_string(runs) + " " + run->runID.toString() + (run->startSkew < 0 ?
+                " armed for an external start" : " started within " + std::to_string(run->startSkew) + " ns");
+    }
+
+    std::string stop()
+    {
+        if (!run)
+            return "ERROR no run in progress";
+        stopRun(*run, digitizers);
+        std::string reply = "OK run " + std::to_string(runs) + " stopped after " +
+                std::to_string((run->stop - run->start) / 1000.0) + " s with " + std::to_string(run->eventsFound) + " events";
+        run.reset();
+        return reply;
+    }
+
+    std::string reconfigure(std::istringstream& args)
+    {
+        if (run)
+            return "ERROR run " + std::to_string(runs) + " is in progress";
+        std::string fileName;
+        args >> fileName;
+        std::ifstream file(fileName);
+        if (fileName.empty() || !file.good())
+            return "ERROR could not open configuration file: " + fileName;
+        try {
+            configuration.reconfigure(file);
+        } catch (std::exception& e)
+        {
+            return std::string("ERROR ") + e.what();
+        }
+        if (conf.verbose)
+        {
+            configuration.printTimings(std::cout, conf.verbose > 1);
+        }
+        size_t unchanged = 0;
+        for (const Configuration::BoardTiming& board: configuration.getTimings())
+        {
+            unchanged += board.unchanged;
+        }
+        return "OK reconfigured " + std::to_string(digitizers.size()) + " digitizer(s), " +
+                std::to_string(unchanged) + " setting(s) unchanged";
+    }
+
+    std::string configOut(std::istringstream& args)
+    {
+        std::string fileName;
+        args >> fileName;
+        std::ofstream file(fileName);
+        if (fileName.empty() || !file.good())
+            return "ERROR unable to open configuration out file: " + fileName;
+        configuration.write(file, conf.verifyConfig);
+        return "OK";
+    }
+
+    std::string status()
+    {
+        if (!run)
+            return "OK stopped after " + std::to_string(runs) + " run(s)";
+        return "OK running run " + std::to_string(runs) + " for " +
+               std::to_string((DataHandler::getTimeMsecs() - run->start) / 1000.0) + " s with " +
+               std::to_string(run->eventsFound) + " events";
+    }
+
+    std::string command(int client, const std::string& line)
+    {
+        std::istringstream args(line);
+        std::string command;
+        args >> command;
+        if (command == "start")
+            return start(args);
+        if (command == "stop")
+            return stop();
+        if (command == "split")
+        {
+            if (!run)
+                return "ERROR no run in progress";
+            trace::emit(trace::Split);
+            run->dataWriter.split(run->nextFileID());
+            return "OK";
+        }
+        if (command == "reconfigure")
+            return reconfigure(args);
+        if (command == "config_out")
+            return configOut(args);
+        if (command == "status")
+            return status();
+        if (command == "wait")
+        {
+            if (!run)
+                return status();
+            waiting.push_back(client);
+            return "";
+        }
+        if (command == "trace")
+        {
+            std::string file;
+            args >> file;
+            return dumpTrace("control", file);
+        }
+        if (command == "quit")
+        {
+            quit = true;
+            return "OK";
+        }
+        return "ERROR unknown command: " + command + " [start,stop,split,reconfigure,config_out,status,wait,trace,quit]";
+    }
+
+    /* Answer the clients waiting for the run to end */
+    void wake(ControlSocket& control, const std::string& reply)
+    {
+        for (int client: waiting)
+            control.reply(client, reply);
+        waiting.clear();
+    }
+
+public:
+    explicit Daemon(Configuration& configuration_)
+            : configuration(configuration_)
+            , digitizers(configuration_.getDigitizers()) {}
+
+    /* Serve the control socket until quit or interrupted. The acquisition of a run and the commands
+     * share this thread, so a command never runs in the middle of a readout */
+    int operator()(const std::string& path)
+    {
+        ControlSocket control(path);
+        if (conf.verbose)
+        {
+            std::cout << "Waiting for run control commands on " << path << " - Ctrl-C to quit" << std::endl;
+        }
+        while (!interrupt && !quit)
+        {
+            if (run)
+            {
+                run->eventsFound = acquire(*run, configuration);
+                const char* reason = nullptr;
+                if (run->timeout)
+                    reason = "Time out";
+                else if (conf.events >= 0 && run->eventsFound >= conf.events)
+                    reason = "Collected requested events";
+                if (reason)
+                {
+                    std::cout << reason << " - stop run " << runs << "." << std::endl;
+                    wake(control, stop());
+                }
+            }
+            else if (traceRequest)
+            {
+                traceRequest = 0;
+                dumpTrace("requested");
+            }
+            int client;
+            std::string line;
+            if (control.command(run ? 0 : 100, client, line))
+            {
+                std::string reply = command(client, line);
+                if (!run)
+                    wake(control, reply);
+                if (!reply.empty())
+                    control.reply(client, reply);
+            }
+        }
+        if (interrupt)
+        {
+            std::cout << "Caught interrupt - stop acquisition and clean up." << std::endl;
+        }
+        if (run)
+        {
+            wake(control, stop());
+        }
+        return 0;
+    }
+};
+
+static int serve(Configuration& configuration)
+{
+    try {
+        return Daemon(configuration)(*conf.control);
+    } catch (std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        dumpTrace("error");
+        return -1;
+    }
+}
+
 int main(int argc, const char *argv[])
 {
 
@@ -98,13 +796,44 @@ int main(int argc, const char *argv[])
                 ("time,t", po::value<float>()->value_name("<seconds>")->default_value(conf.time), "Stop acquisition after <seconds> seconds")
                 ("text,T", po::bool_switch(&conf.textout), "Output to text file.")
                 ("hdf5,H", po::bool_switch(&conf.hdf5out), "Output to hdf5 file.")
+                ("binary,B", po::bool_switch(&conf.binaryout), "Output to binary list file.")
+                ("direct", po::bool_switch(&conf.binary.direct), "Write binary list files with O_DIRECT, bypassing the page cache.")
                 ("split,s", po::value<float>()->value_name("<seconds>")->default_value(conf.split), "Split output file every <seconds> seconds")
+                ("split_size", po::value<uint64_t>(&conf.splitMB)->value_name("<MB>")->default_value(conf.splitMB), "Split HDF5 output file after <MB> megabytes of data, 0 for no limit")
+                ("split_events", po::value<uint64_t>(&conf.hdf5.splitEvents)->value_name("<count>")->default_value(conf.hdf5.splitEvents), "Split HDF5 output file after <count> events, 0 for no limit")
+                ("columnar", po::bool_switch(&conf.hdf5.columnar), "Write list data to HDF5 with a data set per field.")
+                ("swmr", po::bool_switch(&conf.hdf5.swmr), "Write HDF5 in SWMR mode so readers can follow the run.")
+                ("swmr_flush", po::value<float>(&conf.hdf5.flushInterval)->value_name("<seconds>")->default_value(conf.hdf5.flushInterval), "Make new data visible to SWMR readers every <seconds> seconds")
+                ("compress", po::value<std::string>(&conf.compress)->value_name("<filter>")->default_value("none"), "Compress HDF5 data. [none,deflate,lz4,zstd]")
+                ("compress_level", po::value<int>(&conf.hdf5.compression.level)->value_name("<level>")->default_value(conf.hdf5.compression.level), "Compression level for deflate and zstd")
+                ("compress_threads", po::value<size_t>(&conf.hdf5.compression.threads)->value_name("<count>")->default_value(conf.hdf5.compression.threads), "Compression threads, 0 for one per core")
+                ("hdf5_profile", po::value<std::string>(&conf.profile)->value_name("<name>")->default_value("default"), "HDF5 file properties. [default,throughput]")
+                ("latest_format", po::value<bool>()->value_name("<0|1>"), "Write HDF5 with the latest file format (overrides the profile)")
+                ("page_size", po::value<uint64_t>()->value_name("<bytes>"), "HDF5 file space page size, 0 for no paged aggregation (overrides the profile)")
+                ("page_buffer", po::value<uint64_t>()->value_name("<MB>"), "HDF5 page buffer size, 0 for none (overrides the profile)")
+                ("metadata_cache", po::value<uint64_t>()->value_name("<MB>"), "HDF5 metadata cache size, 0 for the HDF5 default (overrides the profile)")
+                ("alignment", po::value<uint64_t>()->value_name("<bytes>"), "Align large HDF5 objects e.g. to the stripe size, 0 for the file system block size, 1 for none (overrides the profile)")
+                ("chunk_cache", po::value<uint64_t>()->value_name("<bytes>"), "HDF5 chunk cache per data set, 0 for the HDF5 default (overrides the profile)")
+                ("watchdog", po::value<float>(&conf.watchdog)->value_name("<seconds>")->default_value(conf.watchdog), "Warn when the acquisition loop has been stuck for <seconds> seconds, 0 to not watch it")
                 ("stats", po::value<float>()->value_name("<seconds>")->default_value(conf.stats), "Print statistics every <seconds> seconds")
                 ("path,p", po::value<std::string>()->value_name("<path>")->default_value(""), "Store data and other run information in local <path>.")
                 ("basename,b", po::value<std::string>()->value_name("<name>")->default_value("jadaq-"), "Use <name> as the basename for file output.")
                 ("network,N", po::value<std::string>()->value_name("<address>"), "Send data over network - address to bind to.")
                 ("port,P", po::value<std::string>()->value_name("<port>")->default_value(Data::defaultDataPort), "Network port to bind to if sending over network")
+                ("network_policy", po::value<std::string>(&conf.networkPolicy)->value_name("<policy>")->default_value("drop"), "When sending over network next to file output and the network falls behind: block acquisition, drop data, drop waveforms or spill to scratch. [block,drop,downsample,spill]")
+                ("file_policy", po::value<std::string>(&conf.filePolicy)->value_name("<policy>")->default_value("block"), "When file output falls behind: block acquisition, drop data, drop waveforms or spill to scratch. [block,drop,downsample,spill]")
+                ("sink_queue", po::value<size_t>(&conf.sink.depth)->value_name("<buffers>")->default_value(conf.sink.depth), "Buffers queued for each output when writing to file and network or with a file policy")
+                ("sink_high_water", po::value<float>(&conf.sink.highWater)->value_name("<fraction>")->default_value(conf.sink.highWater), "Part of the output queue filled before the policy takes over")
+                ("spill_path", po::value<std::string>(&conf.sink.scratch)->value_name("<path>")->default_value(conf.sink.scratch), "Directory on fast local storage for the spill policy")
+                ("spill_limit", po::value<uint64_t>(&conf.sink.spillLimit)->value_name("<MB>")->default_value(conf.sink.spillLimit), "Megabytes each output can spill before it drops data")
+                ("trace_size", po::value<size_t>(&conf.traceSize)->value_name("<records>")->default_value(conf.traceSize), "Trace records kept per thread for trace dumps (SIGUSR1, errors), 0 to not trace")
+                ("recover_retries", po::value<int>(&conf.recoverRetries)->value_name("<count>")->default_value(conf.recoverRetries), "Attempts per digitizer and run to bring a digitizer back after an error, 0 to drop it for the rest of the run")
+                ("recover_backoff", po::value<float>(&conf.recoverBackoff)->value_name("<seconds>")->default_value(conf.recoverBackoff), "Wait <seconds> before the first recovery attempt, doubled after each failed one")
+                ("serial_config", po::bool_switch(&conf.serialConfig), "Configure the digitizers one at a time instead of one link at a time in parallel")
+                ("shadow", po::value<std::string>(&conf.shadowPath)->value_name("<path>"), "Keep a shadow of the digitizer settings in <path> and only write what changed since the last run")
                 ("config_out", po::value<std::string>()->value_name("<file>"), "Read back device(s) configuration and write to <file>")
+                ("control", po::value<std::string>()->value_name("<socket>"), "Run as a daemon that keeps the digitizers open and takes run control commands on the unix socket <socket>")
+                ("config_out_verify", po::bool_switch(&conf.verifyConfig), "Read every value for --config_out from the device(s) - otherwise the values just written are taken as written")
                 ("config", po::value<std::vector<std::string> >()->value_name("<file>"), "Configuration file");
         po::positional_options_description pos;
         pos.add("config", -1);
@@ -135,6 +864,38 @@ int main(int argc, const char *argv[])
         {
             conf.outConfigFile = new std::string(vm["config_out"].as<std::string>());
         }
+        if (vm.count("control"))
+        {
+            conf.control = new std::string(vm["control"].as<std::string>());
+        }
+        try
+        {
+            conf.hdf5.compression.filter = ChunkCompressor::filter(conf.compress);
+            conf.hdf5.tuning = DataWriterHDF5::Tuning::profile(conf.profile);
+            DataWriterFanOut::policy(conf.networkPolicy);
+            DataWriterFanOut::policy(conf.filePolicy);
+            if (vm.count("latest_format"))
+                conf.hdf5.tuning.latestFormat = vm["latest_format"].as<bool>();
+            if (vm.count("page_size"))
+                conf.hdf5.tuning.pageSize = vm["page_size"].as<uint64_t>();
+            if (vm.count("page_buffer"))
+                conf.hdf5.tuning.pageBuffer = vm["page_buffer"].as<uint64_t>()<<20;
+            if (vm.count("metadata_cache"))
+                conf.hdf5.tuning.metadataCache = vm["metadata_cache"].as<uint64_t>()<<20;
+            if (vm.count("alignment"))
+                conf.hdf5.tuning.alignment = vm["alignment"].as<uint64_t>();
+            if (vm.count("chunk_cache"))
+                conf.hdf5.tuning.chunkCache = vm["chunk_cache"].as<uint64_t>();
+        } catch (std::invalid_argument& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+        if (!ChunkCompressor::available(conf.hdf5.compression.filter))
+        {
+            std::cerr << "WARNING: " << conf.compress << " compression is not available - using deflate." << std::endl;
+            conf.hdf5.compression.filter = ChunkCompressor::Deflate;
+        }
         conf.path = new std::string(vm["path"].as<std::string>());
         conf.basename = new std::string(vm["basename"].as<std::string>());
         // add trailing slash to path (if given)
@@ -143,14 +904,22 @@ int main(int argc, const char *argv[])
         conf.events = vm["events"].as<int>();
         conf.time   = vm["time"].as<float>();
         conf.split  = vm["split"].as<float>();
+        conf.hdf5.splitBytes = conf.splitMB*1024*1024;
+        conf.hdf5.preopen = conf.split > 0.0f || conf.hdf5.splitBytes > 0 || conf.hdf5.splitEvents > 0;
+        if (!conf.hdf5out && (conf.hdf5.splitBytes > 0 || conf.hdf5.splitEvents > 0))
+        {
+            std::cerr << "WARNING: --split_size and --split_events only apply to HDF5 output." << std::endl;
+        }
         conf.stats  = vm["stats"].as<float>();
+        trace::registry().setSize(conf.traceSize);
+        trace::name("acquisition");
         if (vm.count("network"))
         {
             conf.network = new std::string(vm["network"].as<std::string>());
             conf.port = new std::string(vm["port"].as<std::string>());
         }
         // We will use the Null data handlere if no other is selected
-        conf.nullout = (!conf.textout && !conf.hdf5out && (conf.network == nullptr));
+        conf.nullout = (!conf.textout && !conf.hdf5out && !conf.binaryout && (conf.network == nullptr));
     }
     catch (const po::error &error)
     {
@@ -158,11 +927,6 @@ int main(int argc, const char *argv[])
         throw;
     }
 
-    // get a unique run ID
-    uuid runID;
-    // prepare a run number
-    FileID fileID;
-
     /* Read-in and write resulting digitizer configuration */
     std::string configFileName = conf.configFile[0];
     std::ifstream configFile(configFileName);
@@ -171,20 +935,45 @@ int main(int argc, const char *argv[])
         std::cerr << "Could not open jadaq configuration file: " << configFileName << std::endl;
         return -1;
     }
-    DEBUG(std::cout << "Reading digitizer configuration from" << configFileName << std::endl;)
+    if (conf.verbose > 1)
+    {
+        std::cout << "Reading digitizer configuration from " << configFileName << std::endl;
+    }
     // NOTE: switch verbose (2nd) arg on here to enable conf warnings
     // TODO: implement a general verbose mode in sted of this
-    Configuration configuration(configFile, conf.verbose > 1);
+    std::unique_ptr<Configuration> configurationPtr;
+    try
+    {
+        configurationPtr.reset(new Configuration(configFile, conf.verbose > 1, !conf.serialConfig, conf.shadowPath));
+    } catch (std::runtime_error& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return -1;
+    }
+    Configuration& configuration = *configurationPtr;
     configFile.close();
+    if (conf.verbose)
+    {
+        configuration.printTimings(std::cout, conf.verbose > 1);
+    }
 
     if (conf.outConfigFile)
     {
         std::ofstream outFile(*conf.outConfigFile);
         if (outFile.good())
         {
-            DEBUG(std::cout << "Writing current digitizer configuration to " << *conf.outConfigFile << std::endl;)
-            configuration.write(outFile);
+            if (conf.verbose > 1)
+            {
+                std::cout << "Writing current digitizer configuration to " << *conf.outConfigFile << std::endl;
+            }
+            auto start = std::chrono::steady_clock::now();
+            configuration.write(outFile, conf.verifyConfig);
             outFile.close();
+            if (conf.verbose)
+            {
+                std::cout << "Read back configuration in " <<
+                          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+            }
         } else
         {
             std::cerr << "Unable to open configuration out file: " << *conf.outConfigFile << std::endl;
@@ -201,117 +990,17 @@ int main(int argc, const char *argv[])
         }
     }
 
-    // TODO: move DataHandler creation to factory method in DataHandlerGeneric
-    DataWriter dataWriter;
-    if (conf.hdf5out)
-    {
-        dataWriter = new DataWriterHDF5(*conf.path, *conf.basename, conf.split>0.0f?fileID.toString():"");
-    }
-    else if (conf.textout)
-    {
-        dataWriter = new DataWriterText(*conf.path, *conf.basename, conf.split>0.0f?fileID.toString():"");
-    }
-    else if(conf.network != nullptr)
-    {
-      dataWriter = new DataWriterNetwork(*conf.network,*conf.port,runID.value());
-    }
-    else if (conf.nullout)
-    {
-        dataWriter = new DataWriterNull();
-    }
-    else
-    {
-        std::cerr << "No valid data handler." << std::endl;
-        return -1;
-    }
-    for (Digitizer& digitizer: digitizers) {
-        if (conf.verbose)
-        {
-            std::cout << "Start acquisition on digitizer " << digitizer.name() << std::endl;
-        }
-        digitizer.initialize(dataWriter);
-        digitizer.startAcquisition();
-        digitizer.active = true;
-    }
-
     /* Set up interrupt handler */
     setup_interrupt_handler();
+    setup_trace_handler();
+
+    int result = conf.control ? serve(configuration) : oneShot(configuration);
 
-    // Setup IO service for timer
-    std::atomic<bool> timeout{false};
-    std::deque<Timer> timers;
-    if (conf.time > 0.0f)
-    { timers.emplace_back(conf.time, [&timeout]() { timeout = true; }); }
-    if (conf.split > 0.0f)
-    { timers.emplace_back(conf.split, [&dataWriter, &fileID]() { dataWriter.split((++fileID).toString()); }, true); }
-    if (conf.stats > 0.0f)
-    { timers.emplace_back(conf.stats, [&digitizers]() { printStats(digitizers); }, true); }
-    if (conf.verbose)
-    {
-        std::cout << "Running acquisition loop - Ctrl-C to interrupt" << std::endl;
-    }
-    long acquisitionStart = DataHandler::getTimeMsecs();
-    long eventsFound = 0;
-    while(true)
-    {
-        eventsFound = 0;
-        for (Digitizer& digitizer: digitizers) {
-            if (digitizer.active)
-            {
-                try { digitizer.acquisition(); }
-                catch (caen::Error &e)
-                {
-                    std::cerr << "ERROR: unexpected exception during acquisition: " << e.what() << "(" << e.code() << ")" << std::endl;
-                    digitizer.active = false;
-                }
-            }
-            eventsFound += digitizer.getStats().eventsFound;
-        }
-        if (interrupt)
-        {
-            std::cout << "Caught interrupt - stop acquisition and clean up." << std::endl;
-            break;
-        }
-        if (timeout)
-        {
-            std::cout << "Time out - stop acquisition and clean up." << std::endl;
-            break;
-        }
-        if (conf.events >= 0 && eventsFound >= conf.events)
-        {
-            std::cout << "Collected requested events - stop acquisition and clean up." << std::endl;
-            break;
-        }
-    }
-    for (Timer& timer: timers)
-    {
-        timer.cancel();
-    }
-    long acquisitionStop = DataHandler::getTimeMsecs();
-    for (Digitizer& digitizer: digitizers)
-    {
-        if (conf.verbose)
-        {
-            std::cout << "Stop acquisition on digitizer " << digitizer.name() << std::endl;
-        }
-        digitizer.stopAcquisition();
-    }
-    if (conf.verbose)
-    {
-        std::cout << "Acquisition complete - shutting down." << std::endl;
-    }
     /* Clean up after all digitizers: buffers, etc. */
     for (Digitizer& digitizer: digitizers)
     {
         digitizer.close();
     }
     digitizers.clear();
-    if (conf.verbose)
-    {
-        double runtime = (acquisitionStop - acquisitionStart) / 1000.0;
-        std::cout << "Acquisition ran for " << runtime << " seconds." << std::endl;
-        std::cout << "Collecting " << eventsFound << " events." << std::endl;
-        std::cout << "Resulting in a collection rate of " << eventsFound/runtime/1000.0 << " kHz." << std::endl;
-    }
-    return 0;
+    return result;
 }
@@ -0,0 +1,125 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Send a run control command to a jadaq daemon (jadaq --control) and
+ * print the reply. Exits with 0 if the daemon answered OK.
+ *
+ */
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+void usageHelp(char *name)
+{
+    std::cout << "Usage: " << name << " --socket <socket> <command> [<arguments>]" << std::endl;
+    std::cout << "Where <options> can be:" << std::endl;
+    std::cout << "--socket / -s SOCKET     the control socket the daemon was started with." << std::endl;
+    std::cout << std::endl << "Commands:" << std::endl;
+    std::cout << "start [path=<path>] [basename=<name>]   start a run" << std::endl;
+    std::cout << "stop                                    stop the run" << std::endl;
+    std::cout << "split                                   split the output files" << std::endl;
+    std::cout << "reconfigure <file>                      apply a configuration file while stopped" << std::endl;
+    std::cout << "config_out <file>                       read back the configuration to <file>" << std::endl;
+    std::cout << "status                                  print the run status" << std::endl;
+    std::cout << "wait                                    wait for the run to end" << std::endl;
+    std::cout << "trace [<file>]                          write a trace dump" << std::endl;
+    std::cout << "quit                                    stop the daemon" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char* const short_opts = "hs:";
+    const option long_opts[] = {
+        {"socket", 1, nullptr, 's'},
+        {"help", 0, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    std::string path;
+
+    /* Parse command line options */
+    while (true) {
+        const auto opt = getopt_long(argc, argv, short_opts, long_opts, nullptr);
+        if (-1 == opt)
+            break;
+
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'h': // -h or --help
+        case '?': // Unrecognized option
+        default:
+            usageHelp(argv[0]);
+            exit(0);
+            break;
+        }
+    }
+
+    if (path.empty() || argc - optind < 1) {
+        usageHelp(argv[0]);
+        exit(1);
+    }
+
+    std::string command;
+    for (int i = optind; i < argc; ++i)
+    {
+        command += (i > optind ? " " : "") + std::string(argv[i]);
+    }
+    command += '\n';
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        std::cerr << "ERROR: could not connect to " << path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    if (send(sock, command.data(), command.size(), MSG_NOSIGNAL) != (ssize_t)command.size())
+    {
+        std::cerr << "ERROR: could not send command: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    /* The reply is one line */
+    std::string reply;
+    char c;
+    while (recv(sock, &c, 1, 0) == 1 && c != '\n')
+    {
+        reply += c;
+    }
+    close(sock);
+    if (reply.empty())
+    {
+        std::cerr << "ERROR: no reply from " << path << std::endl;
+        exit(1);
+    }
+    std::cout << reply << std::endl;
+    return reply.compare(0, 2, "OK") == 0 ? 0 : 1;
+}
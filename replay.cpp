@@ -0,0 +1,555 @@
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Replay recorded runs - HDF5 files written by DataWriterHDF5 or binary
+ * list files written by DataWriterBinary - as UDP data packages, e.g. to
+ * load test jadaq-ds with real data at a reproducible rate.
+ * The data is read into memory up front and cut into packages as
+ * DataWriterNetwork would send them. Each package is due when its globalTime
+ * was, scaled by the speed, with the packages of a millisecond spread evenly
+ * across it. An optional token bucket caps the rate. Each emulated digitizer
+ * sends from its own thread and socket, copies of a recorded digitizer with
+ * IDs of their own.
+ *
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <boost/asio.hpp>
+
+#include "DataFormat.hpp"
+#include "DataReaderHDF5.hpp"
+#include "DataReaderBinary.hpp"
+#include "uuid.hpp"
+
+#define DEFAULT_UDP_SEND_ADDRESS "127.0.0.1"
+
+using boost::asio::ip::udp;
+typedef std::chrono::steady_clock Clock;
+
+/* Keep running marker and interrupt signal handler */
+static volatile sig_atomic_t interrupted = 0;
+static void interrupt_handler(int s)
+{
+    interrupted = 1;
+}
+static void setup_interrupt_handler()
+{
+    struct sigaction sigIntHandler;
+    sigIntHandler.sa_handler = interrupt_handler;
+    sigemptyset(&sigIntHandler.sa_mask);
+    sigIntHandler.sa_flags = 0;
+    sigaction(SIGINT, &sigIntHandler, NULL);
+    sigaction(SIGTERM, &sigIntHandler, NULL);
+}
+
+static const size_t maxPayload = Data::maxBufferSize - sizeof(Data::Header);
+
+void usageHelp(char *name)
+{
+    std::cout << "Usage: " << name << " [<options>] <input_file>..." << std::endl;
+    std::cout << "Where <options> can be:" << std::endl;
+    std::cout << "--address / -a ADDRESS   the UDP network address to send to (default is " << DEFAULT_UDP_SEND_ADDRESS << ")." << std::endl;
+    std::cout << "--port / -p PORT         the UDP network port to send to (default is " << Data::defaultDataPort << ")." << std::endl;
+    std::cout << "--speed / -s FACTOR      replay FACTOR times as fast as recorded, 0 for as fast as the rate allows (default is 1)." << std::endl;
+    std::cout << "--rate / -r MBIT         cap the rate of all digitizers together at MBIT Mbit/s (default is no cap)." << std::endl;
+    std::cout << "--burst / -B COUNT       let each digitizer send COUNT packages back to back under the cap (default is 8)." << std::endl;
+    std::cout << "--digitizers / -d COUNT  the number of digitizers to emulate - one thread each (default is as recorded)." << std::endl;
+    std::cout << "--id_step / -i STEP      copy n of recorded digitizer ID is sent as ID + n*STEP (default is 1000)." << std::endl;
+    std::cout << "--batch / -b COUNT       send up to COUNT due packages with each sendmmsg call, 1 for send (default is 1)." << std::endl;
+    std::cout << "--loops / -l COUNT       replay COUNT times, 0 until interrupted (default is 1)." << std::endl;
+    std::cout << "--limit / -m MB          read at most MB megabytes of data from the input (default is 1024)." << std::endl;
+    std::cout << std::endl << "Reads the HDF5 or binary files <input_file>... written by jadaq and " << std::endl;
+    std::cout << "sends the data as UDP packages to the provided destination at the recorded pace." << std::endl;
+}
+
+/* A package in the slab of its digitizer, with room for the header in front of the elements */
+struct Package
+{
+    size_t offset;
+    uint32_t size;        // Bytes, header included
+    uint16_t elementType;
+    uint16_t numElements;
+    uint64_t globalTime;
+    uint64_t due;         // ns from the start of the recording at speed 1
+};
+
+struct Recording
+{
+    uint32_t digitizerID;
+    std::vector<char> slab;
+    std::vector<Package> packages;
+    uint64_t elements = 0;
+};
+
+struct Settings
+{
+    double speed = 1.0;
+    double rate = 0.0;      // Bytes/s for each digitizer, 0 for no cap
+    size_t burst = 8;       // Packages
+    size_t batch = 1;
+    size_t loops = 1;
+    uint64_t span = 0;      // ns of a loop at speed 1
+    uint64_t runID = 0;
+};
+
+struct Sender
+{
+    uint32_t digitizerID;
+    const Recording* recording;
+    uint64_t packages = 0;
+    uint64_t bytes = 0;
+    uint64_t elements = 0;
+    uint64_t refused = 0;   // Packages sent while nobody was listening
+    uint64_t replayed = 0;  // ns of the recording replayed, at speed 1
+    uint64_t sends = 0;
+    uint64_t lateTotal = 0; // ns, of the first package of each send
+    uint64_t lateMax = 0;
+};
+
+/* Cut count elements at data into packages of the recording */
+static void addPackages(Recording& recording, uint16_t elementType, size_t elementSize, uint64_t globalTime,
+                        const char* data, size_t count)
+{
+    const size_t perPackage = std::min<size_t>(maxPayload/elementSize, UINT16_MAX);
+    for (size_t first = 0; first < count; first += perPackage)
+    {
+        const size_t n = std::min(perPackage, count - first);
+        Package package{recording.slab.size(), (uint32_t)(sizeof(Data::Header) + n*elementSize), elementType,
+                        (uint16_t)n, globalTime, 0};
+        recording.slab.resize(recording.slab.size() + package.size);
+        memcpy(recording.slab.data() + package.offset + sizeof(Data::Header), data + first*elementSize, n*elementSize);
+        recording.packages.push_back(package);
+        recording.elements += n;
+    }
+}
+
+/* Read the elements of each table, as far as the limit allows, into packages per globalTime index entry */
+static void readHDF5(const std::string& filename, std::map<uint32_t, Recording>& recordings, size_t& limit)
+{
+    DataReaderHDF5 reader(filename);
+    std::vector<char> elements;
+    for (const DataReaderHDF5::Table& table: reader.tables())
+    {
+        Recording& recording = recordings[table.digitizerID];
+        recording.digitizerID = table.digitizerID;
+        const hsize_t rows = std::min<hsize_t>(table.rows, limit/table.elementSize);
+        if (rows < table.rows)
+            std::cerr << "WARNING: " << filename << ": only " << rows << " of " << table.rows << " elements of " <<
+                      table.digitizerID << "/" << table.name << " fit in the limit" << std::endl;
+        elements.resize(rows*table.elementSize);
+        reader.read(table, 0, rows, elements.data());
+        limit -= rows*table.elementSize;
+        for (const DataReaderHDF5::IndexEntry& entry: reader.index(table))
+        {
+            if (entry.first >= rows)
+                continue;
+            addPackages(recording, table.elementType, table.elementSize, entry.globalTime,
+                        elements.data() + entry.first*table.elementSize, std::min<size_t>(entry.count, rows - entry.first));
+        }
+    }
+}
+
+static void readBinary(const std::string& filename, std::map<uint32_t, Recording>& recordings, size_t& limit)
+{
+    DataReaderBinary reader(filename);
+    for (const DataReaderBinary::Block& block: reader)
+    {
+        const size_t size = block.size()*block.elementSize();
+        if (size > limit)
+        {
+            std::cerr << "WARNING: " << filename << ": stopped at the limit" << std::endl;
+            limit = 0;
+            return;
+        }
+        Recording& recording = recordings[block.digitizerID()];
+        recording.digitizerID = block.digitizerID();
+        addPackages(recording, block.elementType(), block.elementSize(), block.globalTime(), block.data(), block.size());
+        limit -= size;
+    }
+}
+
+/* Order the packages of each digitizer by globalTime and set when they are due. Returns the span of the recording */
+static uint64_t schedule(std::map<uint32_t, Recording>& recordings)
+{
+    uint64_t first = UINT64_MAX, last = 0;
+    for (auto& r: recordings)
+    {
+        for (const Package& package: r.second.packages)
+        {
+            first = std::min(first, package.globalTime);
+            last = std::max(last, package.globalTime);
+        }
+    }
+    for (auto& r: recordings)
+    {
+        std::vector<Package>& packages = r.second.packages;
+        std::stable_sort(packages.begin(), packages.end(),
+                         [](const Package& a, const Package& b) { return a.globalTime < b.globalTime; });
+        /* globalTime is in ms - spread the packages of each ms across it */
+        for (size_t i = 0; i < packages.size(); )
+        {
+            size_t end = i;
+            while (end < packages.size() && packages[end].globalTime == packages[i].globalTime)
+                ++end;
+            for (size_t j = i; j < end; ++j)
+                packages[j].due = (packages[j].globalTime - first)*1000000 + (j - i)*1000000/(end - i);
+            i = end;
+        }
+    }
+    return first <= last ? (last - first + 1)*1000000 : 0;
+}
+
+/* Bytes may be taken when the bucket is not in debt, so a batch larger than the bucket still goes */
+class TokenBucket
+{
+private:
+    const double rate;      // Bytes/ns
+    const double capacity;  // Bytes
+    double tokens;
+    Clock::time_point last;
+public:
+    TokenBucket(double bytesPerSecond, double capacity_)
+            : rate(bytesPerSecond/1e9)
+            , capacity(capacity_)
+            , tokens(capacity_)
+            , last(Clock::now()) {}
+
+    /* When bytes can go */
+    Clock::time_point ready()
+    {
+        const Clock::time_point now = Clock::now();
+        tokens = std::min(capacity, tokens + rate*std::chrono::duration<double, std::nano>(now - last).count());
+        last = now;
+        if (tokens >= 0)
+            return now;
+        return now + std::chrono::nanoseconds((int64_t)(-tokens/rate) + 1);
+    }
+
+    void take(size_t bytes) { tokens -= bytes; }
+};
+
+/* Sleep most of the way and spin the rest, for a wake up within microseconds */
+static void waitUntil(Clock::time_point when)
+{
+    const Clock::duration spin = std::chrono::microseconds(100);
+    for (Clock::time_point now = Clock::now(); now < when && !interrupted; now = Clock::now())
+    {
+        if (when - now > 2*spin)
+            std::this_thread::sleep_for(when - now - spin);
+    }
+}
+
+static void replay(Sender& sender, const udp::endpoint& endpoint, const Settings& settings, Clock::time_point start)
+{
+    boost::asio::io_service ioService;
+    udp::socket socket(ioService);
+    socket.open(udp::v4());
+    socket.connect(endpoint);
+    const int fd = socket.native_handle();
+    const std::vector<Package>& packages = sender.recording->packages;
+    const char* slab = sender.recording->slab.data();
+    std::vector<char> buffers(settings.batch*Data::maxBufferSize);
+    std::vector<struct iovec> iovecs(settings.batch);
+    std::vector<struct mmsghdr> messages(settings.batch);
+    for (size_t i = 0; i < settings.batch; ++i)
+    {
+        iovecs[i].iov_base = buffers.data() + i*Data::maxBufferSize;
+        memset(&messages[i], 0, sizeof(struct mmsghdr));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    TokenBucket bucket(settings.rate, (double)settings.burst*Data::maxBufferSize);
+    auto due = [&](uint64_t loop, const Package& package)
+    {
+        return start + std::chrono::nanoseconds((uint64_t)((loop*settings.span + package.due)/settings.speed));
+    };
+    uint32_t sequence = 0;
+    for (uint64_t loop = 0; (settings.loops == 0 || loop < settings.loops) && !interrupted; ++loop)
+    {
+        for (size_t i = 0; i < packages.size() && !interrupted; )
+        {
+            Clock::time_point when = settings.speed > 0 ? due(loop, packages[i]) : start;
+            waitUntil(when);
+            /* Take what else is due now, as long as it fits in the batch */
+            const Clock::time_point now = Clock::now();
+            size_t n = 1, bytes = packages[i].size;
+            for (; n < settings.batch && i + n < packages.size() &&
+                   (settings.speed == 0 || due(loop, packages[i + n]) <= now); ++n)
+                bytes += packages[i + n].size;
+            if (settings.rate > 0)
+            {
+                waitUntil(bucket.ready());
+                bucket.take(bytes);
+            }
+            if (interrupted)
+                break;
+            const uint64_t late = settings.speed > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - when).count() : 0;
+            for (size_t j = 0; j < n; ++j)
+            {
+                const Package& package = packages[i + j];
+                char* buffer = (char*)iovecs[j].iov_base;
+                memcpy(buffer, slab + package.offset, package.size);
+                Data::Header* header = (Data::Header*)buffer;
+                memset(header, 0, sizeof(Data::Header));
+                header->runID = settings.runID;
+                header->globalTime = package.globalTime + loop*(settings.span/1000000);
+                header->digitizerID = sender.digitizerID;
+                header->elementType = package.elementType;
+                header->numElements = package.numElements;
+                header->version = Data::currentVersion;
+                header->sequence = sequence + (uint32_t)j;
+                iovecs[j].iov_len = package.size;
+            }
+            int sent;
+            if (settings.batch == 1)
+                sent = ::send(fd, iovecs[0].iov_base, iovecs[0].iov_len, 0) < 0 ? -1 : 1;
+            else
+                sent = sendmmsg(fd, messages.data(), (unsigned int)n, 0);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != ECONNREFUSED)
+                {
+                    std::cerr << "ERROR sending UDP package: " << strerror(errno) << std::endl;
+                    break;
+                }
+                /* Nobody listening (yet) - the first package is lost, as it would be live */
+                sender.refused += 1;
+                sent = 1;
+            }
+            for (int j = 0; j < sent; ++j)
+            {
+                sender.bytes += packages[i + j].size;
+                sender.elements += packages[i + j].numElements;
+            }
+            sender.packages += sent;
+            sender.replayed = loop*settings.span + packages[i + sent - 1].due;
+            sender.sends += 1;
+            sender.lateTotal += late;
+            sender.lateMax = std::max(sender.lateMax, late);
+            sequence += (uint32_t)sent;
+            i += sent;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const char* const short_opts = "a:b:B:d:hi:l:m:p:r:s:";
+    const option long_opts[] = {
+        {"address", 1, nullptr, 'a'},
+        {"batch", 1, nullptr, 'b'},
+        {"burst", 1, nullptr, 'B'},
+        {"digitizers", 1, nullptr, 'd'},
+        {"help", 0, nullptr, 'h'},
+        {"id_step", 1, nullptr, 'i'},
+        {"loops", 1, nullptr, 'l'},
+        {"limit", 1, nullptr, 'm'},
+        {"port", 1, nullptr, 'p'},
+        {"rate", 1, nullptr, 'r'},
+        {"speed", 1, nullptr, 's'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    /* Default option values */
+    std::string address = DEFAULT_UDP_SEND_ADDRESS, port = Data::defaultDataPort;
+    Settings settings;
+    size_t digitizers = 0;
+    uint32_t idStep = 1000;
+    size_t limit = 1024;
+    double rate = 0.0;
+
+    /* Parse command line options */
+    while (true) {
+        const auto opt = getopt_long(argc, argv, short_opts, long_opts, nullptr);
+        if (-1 == opt)
+            break;
+
+        switch (opt) {
+        case 'a':
+            address = std::string(optarg);
+            break;
+        case 'b':
+            settings.batch = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'B':
+            settings.burst = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'd':
+            digitizers = std::max(std::stoul(optarg), 1ul);
+            break;
+        case 'i':
+            idStep = (uint32_t)std::stoul(optarg);
+            break;
+        case 'l':
+            settings.loops = std::stoul(optarg);
+            break;
+        case 'm':
+            limit = std::stoul(optarg);
+            break;
+        case 'p':
+            port = std::string(optarg);
+            break;
+        case 'r':
+            rate = std::max(std::stod(optarg), 0.0);
+            break;
+        case 's':
+            settings.speed = std::max(std::stod(optarg), 0.0);
+            break;
+        case 'h': // -h or --help
+        case '?': // Unrecognized option
+        default:
+            usageHelp(argv[0]);
+            exit(0);
+            break;
+        }
+    }
+
+    if (argc - optind < 1) {
+        usageHelp(argv[0]);
+        exit(1);
+    }
+
+    /* Read the recording */
+    H5::Exception::dontPrint();
+    std::map<uint32_t, Recording> recordings;
+    size_t budget = limit*1024*1024;
+    for (int i = optind; i < argc && budget > 0; ++i)
+    {
+        try {
+            if (H5::H5File::isHdf5(argv[i]))
+                readHDF5(argv[i], recordings, budget);
+            else
+                readBinary(argv[i], recordings, budget);
+        } catch (std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            exit(1);
+        } catch (H5::Exception& e) {
+            std::cerr << "ERROR: " << argv[i] << ": " << e.getDetailMsg() << std::endl;
+            exit(1);
+        }
+    }
+    for (auto r = recordings.begin(); r != recordings.end(); )
+    {
+        if (r->second.packages.empty())
+            r = recordings.erase(r);
+        else
+            ++r;
+    }
+    if (recordings.empty()) {
+        std::cerr << "ERROR: no data to replay" << std::endl;
+        exit(1);
+    }
+    settings.span = schedule(recordings);
+    uint64_t recordedBytes = 0, recordedPackages = 0;
+    for (auto& r: recordings)
+    {
+        for (const Package& package: r.second.packages)
+            recordedBytes += package.size;
+        recordedPackages += r.second.packages.size();
+    }
+
+    /* Emulated digitizer n replays recorded digitizer n % recorded, copies with IDs of their own */
+    std::vector<const Recording*> recorded;
+    for (auto& r: recordings)
+        recorded.push_back(&r.second);
+    if (digitizers == 0)
+        digitizers = recorded.size();
+    std::vector<Sender> senders(digitizers);
+    for (size_t i = 0; i < digitizers; ++i)
+    {
+        senders[i].recording = recorded[i % recorded.size()];
+        senders[i].digitizerID = senders[i].recording->digitizerID + (uint32_t)(i/recorded.size())*idStep;
+    }
+    settings.rate = rate*1e6/8/digitizers;
+
+    udp::endpoint endpoint;
+    try {
+        boost::asio::io_service ioService;
+        udp::resolver resolver(ioService);
+        udp::resolver::query query(udp::v4(), address.c_str(), port.c_str());
+        endpoint = *resolver.resolve(query);
+    } catch (std::exception& e) {
+        std::cerr << "ERROR in UDP connection setup to " << address << " : " << e.what() << std::endl;
+        exit(1);
+    }
+
+    const double recordedSeconds = settings.span/1e9;
+    std::cout << "Replaying " << recordedPackages << " packages, " << recordedBytes << " bytes from " <<
+              recorded.size() << " digitizer(s) over " << recordedSeconds << " seconds as " << digitizers <<
+              " digitizer(s) to: " << address << ":" << port << " - Ctrl-C to interrupt" << std::endl;
+    setup_interrupt_handler();
+
+    uuid runID;
+    settings.runID = runID.value();
+    std::vector<std::thread> threads;
+    const Clock::time_point start = Clock::now() + std::chrono::milliseconds(10);
+    for (Sender& sender: senders)
+    {
+        threads.emplace_back(replay, std::ref(sender), endpoint, std::cref(settings), start);
+    }
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t packages = 0, bytes = 0, elements = 0, refused = 0, replayed = 0, sends = 0, lateTotal = 0, lateMax = 0;
+    for (const Sender& sender: senders)
+    {
+        std::cout << "Digitizer " << sender.digitizerID << " sent " << sender.packages << " packages, " <<
+                  sender.elements << " elements";
+        if (sender.refused)
+            std::cout << ", " << sender.refused << " refused";
+        std::cout << std::endl;
+        packages += sender.packages;
+        bytes += sender.bytes;
+        elements += sender.elements;
+        refused += sender.refused;
+        replayed = std::max(replayed, sender.replayed);
+        sends += sender.sends;
+        lateTotal += sender.lateTotal;
+        lateMax = std::max(lateMax, sender.lateMax);
+    }
+    std::cout << "Sent " << packages << " packages, " << elements << " elements, " << bytes << " bytes in " <<
+              seconds << " seconds: " << packages/seconds << " packages/s, " << bytes*8/seconds/1e9 << " Gbit/s" <<
+              std::endl;
+    if (settings.speed > 0)
+        std::cout << "Replayed " << replayed/1e9 << " recorded seconds at " << std::setprecision(3) <<
+                  replayed/1e9/seconds << "x, sends were on average " << (sends ? lateTotal/sends/1000.0 : 0) <<
+                  " us and at most " << lateMax/1000.0 << " us late" << std::endl;
+    if (refused)
+        std::cout << refused << " packages were refused - nobody listening" << std::endl;
+
+    return 0;
+}
@@ -33,6 +33,28 @@ def show_waveformelem_struct(name, data):
         key = "%s_name" % field
         print "    %s %d" % (field, data[0][key])
 
+def show_datasets(root):
+    """Print the size and latest element of every data set written by
+    DataWriterHDF5 in SWMR mode - one group per digitizer"""
+    for (digitizer, group) in root.items():
+        for (name, item) in group.items():
+            if isinstance(item, h5py.Group):
+                # Columnar layout - one data set per field
+                columns = item.items()
+                for (_, column) in columns:
+                    column.refresh()
+                if columns and columns[0][1].shape[0] > 0:
+                    latest = ", ".join("%s %d" % (field, column[-1]) for (field, column) in columns)
+                    print "%s/%s: %d elements, latest: %s" % (digitizer, name, columns[0][1].shape[0], latest)
+                else:
+                    print "%s/%s: 0 elements" % (digitizer, name)
+                continue
+            item.refresh()
+            if name.endswith('_index') or name.endswith('_blocks') or name == 'starts' or item.shape[0] == 0:
+                print "%s/%s: %d entries" % (digitizer, name, item.shape[0])
+            else:
+                print "%s/%s: %d elements, latest: %s" % (digitizer, name, item.shape[0], item[-1])
+
 def show_entries(root):
     """Print out the contents of root and recursively apply to nested items"""
     
@@ -67,8 +89,13 @@ if __name__ == '__main__':
         print "Are you sure it is a HDF5 file created/opened in SWMR mode?"
         sys.exit(1)
     root = h5file["/"]
+    # DataWriterHDF5 files have a group per digitizer named by its ID
+    jadaq_layout = all(key.isdigit() for key in root.keys())
     while True:
         print "Display contents"
-        show_entries(root)
+        if jadaq_layout:
+            show_datasets(root)
+        else:
+            show_entries(root)
         print
         time.sleep(2)
@@ -21,6 +21,9 @@ DATA_PATH=/data
 CONFIG_PATH=${HOME}/jadaq/config
 # path to binary
 JADAQ=${HOME}/jadaq/build/jadaq
+# Keep digitizer register shadows here so each run only writes the settings
+# that changed since the previous one - leave empty to reset the digitizers every run
+SHADOW_PATH=${HOME}/.jadaq/shadow
 
 ##        END of configuration       ##
 #######################################
@@ -81,6 +84,12 @@ do
     fi
 done
 
+if [ -n "${SHADOW_PATH}" ]
+then
+    mkdir -p ${SHADOW_PATH}
+    SHADOW="--shadow ${SHADOW_PATH}"
+fi
+
 #check folder exist 
 if [ -d "${base_path}" ]
 then
@@ -120,7 +129,7 @@ then
         set_basename ${i}
         mkdir -p $path
         cp ${config} ${path}/${BASE_NAME}.in.ini
-	COMMAND="${JADAQ} --hdf5 --time ${RUN_TIME} --split ${SPLIT_TIME} --stats ${STAT_TIME} --path $path --basename ${basename} --config ${config} --config_out ${path}/${BASE_NAME}.out.ini 2>&1 | tee -a ${path}/outputmessages_$datee.log"
+	COMMAND="${JADAQ} --hdf5 --time ${RUN_TIME} --split ${SPLIT_TIME} --stats ${STAT_TIME} ${SHADOW} --path $path --basename ${basename} --config ${config} --config_out ${path}/${BASE_NAME}.out.ini 2>&1 | tee -a ${path}/outputmessages_$datee.log"
         if [ ${1} ]
         then
             echo ${COMMAND}
@@ -0,0 +1,113 @@
+#!/usr/bin/python
+
+"""Convert a jadaq trace dump - written on SIGUSR1, on errors or with the
+trace control command - to Chrome trace JSON, which can be opened in
+chrome://tracing or https://ui.perfetto.dev ."""
+
+from __future__ import print_function
+
+import json
+import struct
+import sys
+
+# Names of the arguments of the events - the rest are shown as arg0..arg2
+event_args = {
+    'Read': ['digitizer', 'bytes'],
+    'Decode': ['digitizer', 'bytes_or_events'],
+    'Store': ['digitizer', 'type', 'elements'],
+    'Write': ['digitizer', 'type', 'elements'],
+    'Block': ['digitizer', 'type', 'elements'],
+    'Drop': ['digitizer', 'type', 'elements'],
+    'RunStart': ['digitizers'],
+    'RunStop': ['digitizers'],
+    'DigitizerLost': ['digitizer'],
+    'DigitizerBack': ['digitizer', 'downtime_ms'],
+}
+
+def usage(name):
+    """Print usage help"""
+    print("Usage: %s TRACE_PATH [JSON_PATH]" % name)
+    print("""converts the jadaq trace dump in TRACE_PATH to Chrome trace JSON in
+JSON_PATH, by default TRACE_PATH with .json appended.""")
+
+def read(dump_fd, fmt):
+    """Read and unpack one struct"""
+    size = struct.calcsize(fmt)
+    data = dump_fd.read(size)
+    if len(data) != size:
+        raise ValueError("truncated trace dump")
+    return struct.unpack(fmt, data)
+
+def name_of(raw):
+    """A zero padded C string"""
+    return raw.split(b'\0', 1)[0].decode('ascii', 'replace')
+
+def parse_dump(dump_path):
+    """Parse the dump and return the event names, the clock calibration and
+    a list of (thread name, tid, records) tuples"""
+    with open(dump_path, 'rb') as dump_fd:
+        (magic, ) = read(dump_fd, '<8s')
+        if magic != b'JDQTRC1\0':
+            raise ValueError("%s is not a jadaq trace dump" % dump_path)
+        clock = read(dump_fd, '<QqQq')
+        (events, threads) = read(dump_fd, '<II')
+        names = [name_of(read(dump_fd, '<24s')[0]) for _ in range(events)]
+        rings = []
+        for _ in range(threads):
+            (thread, tid, _, count) = read(dump_fd, '<32sIIQ')
+            records = [read(dump_fd, '<QHHIQQ') for _ in range(count)]
+            rings.append((name_of(thread), tid, records))
+    return names, clock, rings
+
+def convert(names, clock, rings):
+    """Chrome trace events: spans from Begin/End pairs, the rest instants"""
+    (ticks0, ns0, ticks1, ns1) = clock
+    ticks_per_ns = float(ticks1 - ticks0) / max(ns1 - ns0, 1)
+    trace = []
+    for (thread, tid, records) in rings:
+        trace.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid,
+                      'args': {'name': thread}})
+        open_spans = {}
+        for (ticks, event, _, arg0, arg1, arg2) in records:
+            name = names[event] if event < len(names) else 'event%d' % event
+            phase = 'i'
+            if name.endswith('Begin'):
+                name, phase = name[:-5], 'B'
+            elif name.endswith('End'):
+                name, phase = name[:-3], 'E'
+                # The Begin may have been overwritten in the ring
+                if open_spans.get(name, 0) == 0:
+                    continue
+            time = (ns0 + (ticks - ticks0) / ticks_per_ns) / 1000.0
+            if phase == 'B':
+                # A span left by an exception ends where the next one begins
+                if open_spans.get(name, 0) > 0:
+                    trace.append({'name': name, 'ph': 'E', 'pid': 1, 'tid': tid, 'ts': time,
+                                  'args': {'unfinished': 1}})
+                open_spans[name] = 1
+            elif phase == 'E':
+                open_spans[name] = 0
+            keys = event_args.get(name, ['arg0', 'arg1', 'arg2'])
+            keys = keys + ['arg%d' % i for i in range(len(keys), 3)]
+            entry = {'name': name, 'ph': phase, 'pid': 1, 'tid': tid, 'ts': time,
+                     'args': dict(zip(keys, (arg0, arg1, arg2)))}
+            if phase == 'i':
+                entry['s'] = 't'
+            trace.append(entry)
+    return {'traceEvents': trace, 'displayTimeUnit': 'ns'}
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        usage(sys.argv[0])
+        sys.exit(1)
+    dump_path = sys.argv[1]
+    json_path = sys.argv[2] if len(sys.argv) > 2 else dump_path + '.json'
+    try:
+        (names, clock, rings) = parse_dump(dump_path)
+    except (IOError, ValueError) as err:
+        print("Error in parsing: %s" % err)
+        sys.exit(1)
+    result = convert(names, clock, rings)
+    with open(json_path, 'w') as json_fd:
+        json.dump(result, json_fd)
+    print("Wrote %d trace events from %d threads to %s" % (len(result['traceEvents']), len(rings), json_path))
@@ -1,32 +1,311 @@
-//
-// Created by troels on 2/9/18.
-//
-//#define DEBUGING
-#define STATS
-//#define TIMING
-
+/**
+ * jadaq (Just Another DAQ)
+ * Copyright (C) 2018  Troels Blum <troels@blum.dk>
+ *
+ * @file
+ * @author Troels Blum <troels@blum.dk>
+ * @section LICENSE
+ * This program is free software: you can redistribute it and/or modify
+ *        it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ *         but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ * Event tracing that is always compiled in and cheap enough to leave on:
+ * each thread writes fixed size binary records - a TSC time stamp, an event
+ * and three integer arguments - to a ring of its own, without locks or
+ * system calls, overwriting the oldest records. dump() writes a snapshot of
+ * all the rings, e.g. on request or after an error, and
+ * scripts/trace2json.py turns it into Chrome / Perfetto trace JSON.
+ *
+ */
 
 #ifndef JADAQ_TRACE_HPP
 #define JADAQ_TRACE_HPP
 
-#ifdef TIMING
-#define TIME(x) x
-#else
-#define TIME(x)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
 #endif
 
-#ifdef DEBUGING
-#define DEBUG(x) x
-#else
-#define DEBUG(x)
-#endif
+namespace trace
+{
+    /* A Begin and the next End of the same kind on a thread make a span, the rest are instants */
+    enum Event: uint16_t
+    {
+        None,
+        ReadBegin,       // digitizer
+        ReadEnd,         // digitizer, bytes
+        DecodeBegin,     // digitizer, bytes
+        DecodeEnd,       // digitizer, events
+        Store,           // digitizer, element type, elements - a buffer handed to the writer
+        WriteBegin,      // digitizer, element type, elements
+        WriteEnd,        // digitizer, element type, elements
+        BlockBegin,      // digitizer, element type, elements - waiting for room in an output queue
+        BlockEnd,        // digitizer, element type, elements
+        Drop,            // digitizer, element type, elements
+        Split,
+        RunStart,        // run
+        RunStop,         // run
+        DigitizerLost,   // digitizer
+        DigitizerBack,   // digitizer, downtime in ms
+        Events
+    };
+
+    static const char* const names[Events] = {
+        "None", "ReadBegin", "ReadEnd", "DecodeBegin", "DecodeEnd", "Store", "WriteBegin", "WriteEnd",
+        "BlockBegin", "BlockEnd", "Drop", "Split", "RunStart", "RunStop", "DigitizerLost", "DigitizerBack"
+    };
+
+    struct Record
+    {
+        uint64_t time;  // TSC ticks
+        uint16_t event;
+        uint16_t spare;
+        uint32_t arg0;
+        uint64_t arg1;
+        uint64_t arg2;
+    };
+    static_assert(sizeof(Record) == 32, "trace::Record must be 32 bytes");
 
-#ifdef STATS
-#define STAT(x) x
+    inline uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
 #else
-#define STAT(x)
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
 #endif
+    }
+
+    inline int64_t nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /* Written by its thread only. A reader takes what was not overwritten while it copied */
+    class Ring
+    {
+    private:
+        std::unique_ptr<Record[]> records;
+        const uint64_t mask;
+        std::atomic<uint64_t> head{0};
+    public:
+        char name[32] = {0};
+        uint32_t tid = 0;
+        std::atomic<bool> retired{false};
+
+        explicit Ring(size_t size)
+                : records(new Record[size])
+                , mask(size - 1) {}
+
+        void emit(Event event, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+        {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            Record& record = records[h & mask];
+            record.time = ticks();
+            record.event = event;
+            record.spare = 0;
+            record.arg0 = arg0;
+            record.arg1 = arg1;
+            record.arg2 = arg2;
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        std::vector<Record> snapshot() const
+        {
+            const uint64_t size = mask + 1;
+            const uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > size ? end - size : 0;
+            std::vector<Record> copy;
+            copy.reserve(end - begin);
+            for (uint64_t i = begin; i < end; ++i)
+                copy.push_back(records[i & mask]);
+            /* The writer may be filling the slot of the record after the last one published */
+            const uint64_t now = head.load(std::memory_order_acquire);
+            if (now + 1 > begin + size)
+            {
+                const uint64_t stale = std::min(now + 1 - (begin + size), end - begin);
+                copy.erase(copy.begin(), copy.begin() + stale);
+            }
+            return copy;
+        }
+
+        void reset()
+        {
+            head = 0;
+            retired = false;
+        }
+    };
+
+    class Registry
+    {
+    private:
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Ring> > rings;
+        size_t size = 16384;
+        const uint64_t ticks0;
+        const int64_t nanoseconds0;
+    public:
+        Registry()
+                : ticks0(ticks())
+                , nanoseconds0(nanoseconds()) {}
+
+        /* Records per thread, rounded up to a power of two, 0 to not trace. Set it before tracing starts */
+        void setSize(size_t records)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size = 0;
+            if (records > 0)
+            {
+                size = 1;
+                while (size < records)
+                    size <<= 1;
+            }
+            for (std::shared_ptr<Ring>& ring: rings)
+                ring->retired = true;
+            rings.clear();
+        }
+
+        /* A ring for the calling thread - one left by a thread that ended if there is one */
+        std::shared_ptr<Ring> attach()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (size == 0)
+                return nullptr;
+            std::shared_ptr<Ring> ring;
+            for (std::shared_ptr<Ring>& old: rings)
+            {
+                if (old->retired && old.use_count() == 1)
+                {
+                    ring = old;
+                    ring->reset();
+                    break;
+                }
+            }
+            if (!ring)
+            {
+                ring = std::make_shared<Ring>(size);
+                rings.push_back(ring);
+            }
+            ring->tid = (uint32_t)syscall(SYS_gettid);
+            snprintf(ring->name, sizeof(ring->name), "thread %u", ring->tid);
+            return ring;
+        }
+
+        /* Write a snapshot of all rings to path. Returns the number of records */
+        size_t dump(const std::string& path)
+        {
+            std::vector<std::shared_ptr<Ring> > all;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                all = rings;
+            }
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                throw std::runtime_error("could not create " + path);
+            /* Header: magic, then time stamps at start and now in ticks and ns to calibrate the ticks */
+            const uint64_t ticks1 = ticks();
+            const int64_t nanoseconds1 = nanoseconds();
+            const char magic[8] = {'J', 'D', 'Q', 'T', 'R', 'C', '1', '\0'};
+            const uint64_t clock[4] = {ticks0, (uint64_t)nanoseconds0, ticks1, (uint64_t)nanoseconds1};
+            const uint32_t counts[2] = {Events, (uint32_t)all.size()};
+            out.write(magic, sizeof(magic));
+            out.write((const char*)clock, sizeof(clock));
+            out.write((const char*)counts, sizeof(counts));
+            for (const char* name: names)
+            {
+                char field[24] = {0};
+                strncpy(field, name, sizeof(field) - 1);
+                out.write(field, sizeof(field));
+            }
+            size_t total = 0;
+            for (std::shared_ptr<Ring>& ring: all)
+            {
+                const std::vector<Record> records = ring->snapshot();
+                const uint32_t tid[2] = {ring->tid, 0};
+                const uint64_t count = records.size();
+                out.write(ring->name, sizeof(ring->name));
+                out.write((const char*)tid, sizeof(tid));
+                out.write((const char*)&count, sizeof(count));
+                out.write((const char*)records.data(), count*sizeof(Record));
+                total += count;
+            }
+            if (!out.flush())
+                throw std::runtime_error("could not write " + path);
+            return total;
+        }
+    };
+
+    inline Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    /* Hands the ring back when the thread ends */
+    struct Local
+    {
+        std::shared_ptr<Ring> ring;
+        bool attached = false;
+        ~Local()
+        {
+            if (ring)
+                ring->retired = true;
+        }
+    };
+
+    inline Ring* local()
+    {
+        static thread_local Local thread;
+        if (!thread.attached || (thread.ring && thread.ring->retired))
+        {
+            thread.ring.reset();
+            thread.ring = registry().attach();
+            thread.attached = true;
+        }
+        return thread.ring.get();
+    }
+
+    inline void emit(Event event, uint32_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0)
+    {
+        Ring* ring = local();
+        if (ring)
+            ring->emit(event, arg0, arg1, arg2);
+    }
+
+    /* Name the calling thread in the trace */
+    inline void name(const std::string& name)
+    {
+        Ring* ring = local();
+        if (ring)
+            strncpy(ring->name, name.c_str(), sizeof(ring->name) - 1);
+    }
 
+    inline size_t dump(const std::string& path)
+    { return registry().dump(path); }
 
+} // namespace trace
 
 #endif //JADAQ_TRACE_HPP